@@ -0,0 +1,325 @@
+#include <cfloat>
+#include <cstring>
+#include "BOW_Extractor.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BOW_EXTRACTOR_X86 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define BOW_TARGET(isa) __attribute__((target(isa)))
+#else
+#define BOW_TARGET(isa)
+#endif
+#endif
+
+// nearest codeword kernels: return the index of the row of words closest to query. Query and rows of words are 64-byte
+// aligned and zero padded to dims, a multiple of 16 floats, so vector kernels need neither unaligned loads nor a tail loop
+typedef int (*Nearest_Fn)(const float* query, const cv::Mat& words, int dims);
+
+
+static int nearestScalar(const float* query, const cv::Mat& words, int dims) {
+
+	int best = 0;
+	float best_dist = FLT_MAX;
+
+	for (int w = 0; w < words.rows; w++) {
+
+		const float* word = words.ptr<float>(w);
+		float dist = 0;
+
+		for (int k = 0; k < dims; k++) {
+
+			float diff = query[k] - word[k];
+			dist += diff * diff;
+		}
+
+		if (dist < best_dist) {
+
+			best_dist = dist;
+			best = w;
+		}
+	}
+
+	return best;
+}
+
+
+#ifdef BOW_EXTRACTOR_X86
+
+BOW_TARGET("avx2,fma") static inline float horizontalSum(__m256 v) {
+
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+	return _mm_cvtss_f32(sum);
+}
+
+
+BOW_TARGET("avx2,fma") static int nearestAVX2(const float* query, const cv::Mat& words, int dims) {
+
+	int best = 0;
+	float best_dist = FLT_MAX;
+	int w = 0;
+
+	// four codewords at a time, to keep independent accumulators in flight
+	for (; w + 4 <= words.rows; w += 4) {
+
+		const float* w0 = words.ptr<float>(w);
+		const float* w1 = words.ptr<float>(w + 1);
+		const float* w2 = words.ptr<float>(w + 2);
+		const float* w3 = words.ptr<float>(w + 3);
+
+		__m256 s0 = _mm256_setzero_ps();
+		__m256 s1 = _mm256_setzero_ps();
+		__m256 s2 = _mm256_setzero_ps();
+		__m256 s3 = _mm256_setzero_ps();
+
+		for (int k = 0; k < dims; k += 8) {
+
+			__m256 q = _mm256_load_ps(query + k);
+			__m256 d0 = _mm256_sub_ps(q, _mm256_load_ps(w0 + k));
+			__m256 d1 = _mm256_sub_ps(q, _mm256_load_ps(w1 + k));
+			__m256 d2 = _mm256_sub_ps(q, _mm256_load_ps(w2 + k));
+			__m256 d3 = _mm256_sub_ps(q, _mm256_load_ps(w3 + k));
+			s0 = _mm256_fmadd_ps(d0, d0, s0);
+			s1 = _mm256_fmadd_ps(d1, d1, s1);
+			s2 = _mm256_fmadd_ps(d2, d2, s2);
+			s3 = _mm256_fmadd_ps(d3, d3, s3);
+		}
+
+		float dist[4] = { horizontalSum(s0), horizontalSum(s1), horizontalSum(s2), horizontalSum(s3) };
+
+		for (int j = 0; j < 4; j++) {
+
+			if (dist[j] < best_dist) {
+
+				best_dist = dist[j];
+				best = w + j;
+			}
+		}
+	}
+
+	// remaining codewords
+	for (; w < words.rows; w++) {
+
+		const float* word = words.ptr<float>(w);
+		__m256 s = _mm256_setzero_ps();
+
+		for (int k = 0; k < dims; k += 8) {
+
+			__m256 d = _mm256_sub_ps(_mm256_load_ps(query + k), _mm256_load_ps(word + k));
+			s = _mm256_fmadd_ps(d, d, s);
+		}
+
+		float dist = horizontalSum(s);
+
+		if (dist < best_dist) {
+
+			best_dist = dist;
+			best = w;
+		}
+	}
+
+	return best;
+}
+
+
+BOW_TARGET("avx512f") static int nearestAVX512(const float* query, const cv::Mat& words, int dims) {
+
+	int best = 0;
+	float best_dist = FLT_MAX;
+	int w = 0;
+
+	// four codewords at a time, to keep independent accumulators in flight
+	for (; w + 4 <= words.rows; w += 4) {
+
+		const float* w0 = words.ptr<float>(w);
+		const float* w1 = words.ptr<float>(w + 1);
+		const float* w2 = words.ptr<float>(w + 2);
+		const float* w3 = words.ptr<float>(w + 3);
+
+		__m512 s0 = _mm512_setzero_ps();
+		__m512 s1 = _mm512_setzero_ps();
+		__m512 s2 = _mm512_setzero_ps();
+		__m512 s3 = _mm512_setzero_ps();
+
+		for (int k = 0; k < dims; k += 16) {
+
+			__m512 q = _mm512_load_ps(query + k);
+			__m512 d0 = _mm512_sub_ps(q, _mm512_load_ps(w0 + k));
+			__m512 d1 = _mm512_sub_ps(q, _mm512_load_ps(w1 + k));
+			__m512 d2 = _mm512_sub_ps(q, _mm512_load_ps(w2 + k));
+			__m512 d3 = _mm512_sub_ps(q, _mm512_load_ps(w3 + k));
+			s0 = _mm512_fmadd_ps(d0, d0, s0);
+			s1 = _mm512_fmadd_ps(d1, d1, s1);
+			s2 = _mm512_fmadd_ps(d2, d2, s2);
+			s3 = _mm512_fmadd_ps(d3, d3, s3);
+		}
+
+		float dist[4] = { _mm512_reduce_add_ps(s0), _mm512_reduce_add_ps(s1),
+						  _mm512_reduce_add_ps(s2), _mm512_reduce_add_ps(s3) };
+
+		for (int j = 0; j < 4; j++) {
+
+			if (dist[j] < best_dist) {
+
+				best_dist = dist[j];
+				best = w + j;
+			}
+		}
+	}
+
+	// remaining codewords
+	for (; w < words.rows; w++) {
+
+		const float* word = words.ptr<float>(w);
+		__m512 s = _mm512_setzero_ps();
+
+		for (int k = 0; k < dims; k += 16) {
+
+			__m512 d = _mm512_sub_ps(_mm512_load_ps(query + k), _mm512_load_ps(word + k));
+			s = _mm512_fmadd_ps(d, d, s);
+		}
+
+		float dist = _mm512_reduce_add_ps(s);
+
+		if (dist < best_dist) {
+
+			best_dist = dist;
+			best = w;
+		}
+	}
+
+	return best;
+}
+
+#endif
+
+
+BOW_Extractor::BOW_Extractor(Kernel kernel) : kernel(KERNEL_SCALAR), n_words(0), dims(0) {
+
+#ifdef BOW_EXTRACTOR_X86
+	bool avx512 = cv::checkHardwareSupport(CV_CPU_AVX_512F);
+	bool avx2 = cv::checkHardwareSupport(CV_CPU_AVX2) && cv::checkHardwareSupport(CV_CPU_FMA3);
+
+	if ((kernel == KERNEL_AUTO || kernel == KERNEL_AVX512) && avx512) {
+
+		this->kernel = KERNEL_AVX512;
+	}
+	else if ((kernel == KERNEL_AUTO || kernel == KERNEL_AVX2 || kernel == KERNEL_AVX512) && avx2) {
+
+		this->kernel = KERNEL_AVX2;
+	}
+#endif
+}
+
+
+void BOW_Extractor::setVocabulary(const cv::Mat& vocabulary) {
+
+	CV_Assert(vocabulary.type() == CV_32F);
+
+	this->vocabulary = vocabulary;
+	n_words = vocabulary.rows;
+	dims = vocabulary.cols;
+
+	// pad rows to 64 bytes, so that every codeword starts on a cache line (cv::Mat data is 64-byte aligned)
+	int padded_dims = (dims + 15) & ~15;
+	aligned_words = cv::Mat::zeros(n_words, padded_dims, CV_32F);
+	vocabulary.copyTo(aligned_words.colRange(0, dims));
+	CV_Assert(((size_t)aligned_words.data & 63) == 0);
+}
+
+
+const cv::Mat& BOW_Extractor::getVocabulary() const {
+
+	return vocabulary;
+}
+
+
+int BOW_Extractor::descriptorSize() const {
+
+	return n_words;
+}
+
+
+void BOW_Extractor::assign(const cv::Mat& descriptors, std::vector<int>& words) const {
+
+	words.resize(descriptors.rows);
+
+	if (descriptors.empty()) {
+
+		return;
+	}
+
+	CV_Assert(descriptors.type() == CV_32F && descriptors.cols == dims && n_words > 0);
+
+	Nearest_Fn nearest = nearestScalar;
+
+#ifdef BOW_EXTRACTOR_X86
+	if (kernel == KERNEL_AVX512) {
+
+		nearest = nearestAVX512;
+	}
+	else if (kernel == KERNEL_AVX2) {
+
+		nearest = nearestAVX2;
+	}
+#endif
+
+	// each descriptor is copied to an aligned buffer, zero padded as the codewords (the padding adds nothing to distances)
+	int padded_dims = aligned_words.cols;
+	cv::Mat query = cv::Mat::zeros(1, padded_dims, CV_32F);
+	CV_Assert(((size_t)query.data & 63) == 0);
+
+	for (int i = 0; i < descriptors.rows; i++) {
+
+		std::memcpy(query.data, descriptors.ptr<float>(i), dims * sizeof(float));
+		words[i] = nearest(query.ptr<float>(), aligned_words, padded_dims);
+	}
+}
+
+
+void BOW_Extractor::compute(const cv::Mat& descriptors, cv::Mat& histogram,
+							std::vector<std::vector<int>>* point_idxs_of_clusters) const {
+
+	std::vector<int> words;
+	assign(descriptors, words);
+
+	if (point_idxs_of_clusters) {
+
+		point_idxs_of_clusters->assign(n_words, std::vector<int>());
+	}
+
+	histogram = cv::Mat::zeros(1, n_words, CV_32F);
+	float* bins = histogram.ptr<float>();
+
+	for (size_t i = 0; i < words.size(); i++) {
+
+		bins[words[i]] += 1.0f;
+
+		if (point_idxs_of_clusters) {
+
+			(*point_idxs_of_clusters)[words[i]].push_back((int)i);
+		}
+	}
+
+	// normalize by the number of descriptors, as cv::BOWImgDescriptorExtractor does
+	if (!words.empty()) {
+
+		histogram /= (double)words.size();
+	}
+}
+
+
+cv::String BOW_Extractor::getKernelName() const {
+
+	switch (kernel) {
+
+	case KERNEL_AVX512:
+		return "avx512";
+	case KERNEL_AVX2:
+		return "avx2";
+	default:
+		return "scalar";
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+/*
+* Bag of words descriptor extractor based on an exact, brute-force nearest codeword search.
+*
+* It replaces cv::BOWImgDescriptorExtractor + cv::FlannBasedMatcher: for a vocabulary of a few hundred words a linear
+* scan is cheaper than building and traversing randomized kd-trees, and it always returns the true nearest codeword.
+* Histograms are computed as cv::BOWImgDescriptorExtractor does (codeword counts divided by the number of descriptors).
+*
+* The vocabulary is copied in a cache-aligned buffer whose rows are zero padded to a multiple of 64 bytes, and each
+* descriptor to a buffer padded the same way, so that the distance kernel runs over whole vectors with aligned loads.
+* The kernel is vectorized for AVX-512 and AVX2 (+FMA); the best implementation supported by the CPU is chosen at
+* runtime, falling back to a scalar loop.
+*/
+
+class BOW_Extractor {
+
+public:
+
+	// implementations of the nearest codeword kernel
+	enum Kernel { KERNEL_AUTO, KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512 };
+
+
+	/*
+	* Constructor.
+	*
+	* @param kernel			Implementation of the nearest codeword kernel. KERNEL_AUTO picks the fastest one
+	*						supported by the CPU. If the CPU does not support the requested one, KERNEL_AVX512 falls
+	*						back to KERNEL_AVX2 and KERNEL_AVX2 to KERNEL_SCALAR.
+	*/
+	BOW_Extractor(Kernel kernel = KERNEL_AUTO);
+
+
+	/*
+	* Function to set the vocabulary of visual words.
+	*
+	* @param vocabulary		n_words x descriptor size CV_32F matrix, one codeword per row.
+	*/
+	void setVocabulary(const cv::Mat& vocabulary);
+
+
+	/*
+	* @return cv::Mat		Vocabulary of visual words, as provided to setVocabulary.
+	*/
+	const cv::Mat& getVocabulary() const;
+
+
+	/*
+	* @return int			Size of the bag of words descriptor (number of codewords).
+	*/
+	int descriptorSize() const;
+
+
+	/*
+	* Function to assign each descriptor to its nearest codeword (Euclidean distance).
+	*
+	* @param descriptors	Descriptors to assign (CV_32F, one per row).
+	* @param &words			Index of the nearest codeword of each descriptor.
+	*/
+	void assign(const cv::Mat& descriptors, std::vector<int>& words) const;
+
+
+	/*
+	* Function to compute the bag of words descriptor of a set of keypoint descriptors.
+	*
+	* @param descriptors			Keypoint descriptors (CV_32F, one per row).
+	* @param &histogram				1 x n_words CV_32F normalized histogram of the codewords.
+	* @param *point_idxs_of_clusters	If provided, indices of the descriptors assigned to each codeword.
+	*/
+	void compute(const cv::Mat& descriptors, cv::Mat& histogram,
+				std::vector<std::vector<int>>* point_idxs_of_clusters = 0) const;
+
+
+	/*
+	* @return cv::String	Name of the kernel in use (scalar, avx2 or avx512).
+	*/
+	cv::String getKernelName() const;
+
+private:
+
+	Kernel kernel;
+
+	// vocabulary as provided
+	cv::Mat vocabulary;
+
+	// vocabulary copy with rows zero padded to a multiple of 16 floats (64 bytes), read by the kernels
+	cv::Mat aligned_words;
+
+	int n_words;
+	int dims;
+};
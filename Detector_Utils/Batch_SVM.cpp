@@ -0,0 +1,305 @@
+#include <algorithm>
+#include "Batch_SVM.h"
+#include "Trace.h"
+
+Batch_SVM::Batch_SVM(int block_size) : block_size(std::max(block_size, 1)), feature_map(Feature_Map::NONE), batched(false), sign_labels(false), kernel_type(cv::ml::SVM::RBF),
+	gamma(0), rho(0), positive_label(0), negative_label(1) {
+
+}
+
+
+bool Batch_SVM::load(const cv::String& filename) {
+
+	try {
+
+		svm = cv::ml::SVM::load(filename);
+
+		// class labels are not exposed by cv::ml::SVM, read them from the model file
+		cv::FileStorage fs(filename, cv::FileStorage::READ);
+		extractModel(fs.getFirstTopLevelNode());
+
+		// feature map, if the model was trained on mapped samples
+		cv::String map_name;
+		cv::read(fs["feature_map"], map_name, "none");
+
+		if (!Feature_Map::parse(map_name, feature_map)) {
+
+			svm.reset();
+			batched = false;
+			return false;
+		}
+	}
+	catch (const cv::Exception&) {
+
+		svm.reset();
+		batched = false;
+		return false;
+	}
+
+	return !empty();
+}
+
+
+void Batch_SVM::setModel(const cv::Ptr<cv::ml::SVM>& svm, Feature_Map::Type feature_map) {
+
+	this->svm = svm;
+	this->feature_map = feature_map;
+
+	// serialize the model in memory to read back the class labels, which are not exposed by cv::ml::SVM
+	cv::FileStorage out(".yml", cv::FileStorage::WRITE + cv::FileStorage::MEMORY);
+	out << "opencv_ml_svm" << "{";
+	svm->write(out);
+	out << "}";
+
+	cv::FileStorage in(out.releaseAndGetString(), cv::FileStorage::READ + cv::FileStorage::MEMORY);
+	extractModel(in.getFirstTopLevelNode());
+}
+
+
+void Batch_SVM::setDecisionFunction(int kernel_type, double gamma, double rho, const cv::Mat& support_vectors, const cv::Mat& alpha,
+									float positive_label, float negative_label, Feature_Map::Type feature_map) {
+
+	CV_Assert(kernel_type == cv::ml::SVM::RBF || kernel_type == cv::ml::SVM::LINEAR);
+	CV_Assert(support_vectors.type() == CV_32F && alpha.total() == (size_t)support_vectors.rows);
+
+	svm.reset();
+	this->kernel_type = kernel_type;
+	this->gamma = gamma;
+	this->rho = rho;
+	this->positive_label = positive_label;
+	this->negative_label = negative_label;
+	this->feature_map = feature_map;
+
+	int n_sv = support_vectors.rows;
+	this->support_vectors = support_vectors.clone();
+	alpha.reshape(1, n_sv).convertTo(this->alpha, CV_32F);
+	sv_norms.create(1, n_sv, CV_32F);
+
+	for (int k = 0; k < n_sv; k++) {
+
+		sv_norms.at<float>(k) = (float)this->support_vectors.row(k).dot(this->support_vectors.row(k));
+	}
+
+	batched = n_sv > 0;
+}
+
+
+bool Batch_SVM::getDecisionFunction(int& kernel_type, double& gamma, double& rho, cv::Mat& support_vectors, cv::Mat& alpha) const {
+
+	if (!batched) {
+
+		return false;
+	}
+
+	kernel_type = this->kernel_type;
+	gamma = this->gamma;
+	rho = this->rho;
+	support_vectors = this->support_vectors;
+	alpha = this->alpha;
+
+	return true;
+}
+
+
+void Batch_SVM::save(const cv::String& filename) const {
+
+	CV_Assert(!svm.empty() && svm->isTrained());
+
+	// same layout written by cv::ml::SVM::save, followed by the feature map
+	cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+	fs << "opencv_ml_svm" << "{";
+	svm->write(fs);
+	fs << "}";
+	fs << "feature_map" << Feature_Map::getName(feature_map);
+}
+
+
+void Batch_SVM::extractModel(const cv::FileNode& node) {
+
+	batched = false;
+	sign_labels = false;
+
+	if (svm.empty() || !svm->isTrained()) {
+
+		return;
+	}
+
+	cv::Mat class_labels;
+	node["class_labels"] >> class_labels;
+
+	if (class_labels.total() == 2) {
+
+		class_labels.convertTo(class_labels, CV_32F);
+		positive_label = class_labels.at<float>(0);
+		negative_label = class_labels.at<float>(1);
+	}
+
+	kernel_type = svm->getKernelType();
+	gamma = svm->getGamma();
+
+	bool classifier = svm->getType() == cv::ml::SVM::C_SVC || svm->getType() == cv::ml::SVM::NU_SVC;
+	bool kernel = kernel_type == cv::ml::SVM::RBF || kernel_type == cv::ml::SVM::LINEAR;
+	sign_labels = classifier && class_labels.total() == 2;
+
+	if (!classifier || !kernel || class_labels.total() != 2) {
+
+		// evaluated sample by sample with cv::ml::SVM::predict
+		return;
+	}
+
+	// gather the support vectors of the (only) decision function, in the order of their coefficients
+	cv::Mat all_sv = svm->getSupportVectors();
+	cv::Mat alpha_d, sv_idx;
+	rho = svm->getDecisionFunction(0, alpha_d, sv_idx);
+
+	int n_sv = (int)sv_idx.total();
+	support_vectors.create(n_sv, all_sv.cols, CV_32F);
+	sv_norms.create(1, n_sv, CV_32F);
+
+	for (int k = 0; k < n_sv; k++) {
+
+		all_sv.row(sv_idx.at<int>(k)).copyTo(support_vectors.row(k));
+		sv_norms.at<float>(k) = (float)support_vectors.row(k).dot(support_vectors.row(k));
+	}
+
+	alpha_d.reshape(1, n_sv).convertTo(alpha, CV_32F);
+
+	batched = true;
+}
+
+
+void Batch_SVM::predict(const cv::Mat& samples, cv::Mat& labels, cv::Mat& decision_values) const {
+
+	TRACE_SCOPE("svm_predict");
+
+	CV_Assert(!empty());
+
+	int n = samples.rows;
+	labels.create(n, 1, CV_32F);
+	decision_values.create(n, 1, CV_32F);
+
+	if (n == 0) {
+
+		return;
+	}
+
+	cv::Mat input = samples;
+
+	if (input.type() != CV_32F) {
+
+		samples.convertTo(input, CV_32F);
+	}
+
+	// map the samples to the space the SVM was trained in (leaving the provided samples untouched)
+	cv::Mat mapped;
+	Feature_Map::apply(input, mapped, feature_map);
+	input = mapped;
+
+	if (batched) {
+
+		// blocks of samples are independent, evaluate them in parallel
+		int n_blocks = (n + block_size - 1) / block_size;
+
+		cv::parallel_for_(cv::Range(0, n_blocks), [&](const cv::Range& range) {
+
+			for (int b = range.start; b < range.end; b++) {
+
+				int start = b * block_size;
+				int end = std::min(start + block_size, n);
+				cv::Mat out = decision_values.rowRange(start, end);
+				predictBlock(input.rowRange(start, end), out);
+			}
+		});
+	}
+	else {
+
+		for (int i = 0; i < n; i++) {
+
+			decision_values.at<float>(i) = svm->predict(input.row(i), cv::noArray(), cv::ml::StatModel::RAW_OUTPUT);
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+
+		if (batched || sign_labels) {
+
+			// same rule as cv::ml::SVM::predict for two classes
+			labels.at<float>(i) = decision_values.at<float>(i) > 0 ? positive_label : negative_label;
+		}
+		else {
+
+			labels.at<float>(i) = svm->predict(input.row(i));
+		}
+	}
+}
+
+
+void Batch_SVM::predictBlock(const cv::Mat& samples, cv::Mat& decision_values) const {
+
+	cv::Mat kernel;
+
+	if (kernel_type == cv::ml::SVM::LINEAR) {
+
+		// K(x, s) = x.s
+		cv::gemm(samples, support_vectors, 1, cv::noArray(), 0, kernel, cv::GEMM_2_T);
+	}
+	else {
+
+		// ||x - s||^2 = ||x||^2 + ||s||^2 - 2 x.s
+		cv::gemm(samples, support_vectors, -2, cv::noArray(), 0, kernel, cv::GEMM_2_T);
+
+		const float* norms = sv_norms.ptr<float>();
+		float neg_gamma = (float)-gamma;
+
+		for (int i = 0; i < samples.rows; i++) {
+
+			float x_norm = (float)samples.row(i).dot(samples.row(i));
+			float* row = kernel.ptr<float>(i);
+
+			for (int k = 0; k < kernel.cols; k++) {
+
+				row[k] = neg_gamma * std::max(row[k] + x_norm + norms[k], 0.0f);
+			}
+		}
+
+		// K(x, s) = exp(-gamma * ||x - s||^2)
+		cv::exp(kernel, kernel);
+	}
+
+	// f(x) = sum_k alpha_k * K(x, s_k) - rho
+	cv::Mat result;
+	cv::gemm(kernel, alpha, 1, cv::noArray(), 0, result);
+	result -= cv::Scalar(rho);
+	result.copyTo(decision_values);
+}
+
+
+bool Batch_SVM::empty() const {
+
+	// a model set from its decision function has no underlying cv::ml::SVM
+	return !batched && (svm.empty() || !svm->isTrained());
+}
+
+
+int Batch_SVM::getSupportVectorCount() const {
+
+	return batched ? support_vectors.rows : (svm.empty() ? 0 : svm->getSupportVectors().rows);
+}
+
+
+float Batch_SVM::getLabel(bool negative) const {
+
+	return negative ? negative_label : positive_label;
+}
+
+
+cv::Ptr<cv::ml::SVM> Batch_SVM::getModel() const {
+
+	return svm;
+}
+
+
+Feature_Map::Type Batch_SVM::getFeatureMap() const {
+
+	return feature_map;
+}
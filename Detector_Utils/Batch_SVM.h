@@ -0,0 +1,175 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/ml.hpp>
+#include "Feature_Map.h"
+
+/*
+* Batched evaluation of a two-class cv::ml::SVM.
+*
+* Instead of calling cv::ml::SVM::predict once per sample, all the samples of an image (e.g. the bag of words
+* descriptors of all the proposed regions) are classified at once. For RBF and linear kernels the decision function
+* is evaluated as a blocked matrix computation: for a block of samples X and the support vectors S
+*
+*		||x - s||^2 = ||x||^2 + ||s||^2 - 2 x.s			(one cv::gemm for the whole block)
+*		f(x) = sum_k alpha_k * exp(-gamma * ||x - s_k||^2) - rho
+*
+* so that the work is done by OpenCV's vectorized gemm/exp kernels rather than walking the support vectors sample
+* by sample. Other kernels, and models with more than two classes, fall back to cv::ml::SVM::predict.
+*
+* The model may have been trained on samples transformed by an explicit feature map (see Feature_Map): the map is
+* stored in the model file next to the SVM and applied to the samples before classification.
+*
+* The batched decision function (kernel, support vectors, coefficients, labels) can be read and set directly, e.g. to
+* store it in a Model_Bundle: a model set this way has no underlying cv::ml::SVM.
+*
+* Decision values follow the cv::ml::SVM convention (StatModel::RAW_OUTPUT): a positive value is assigned to the
+* first (smallest) class label, a negative value to the second one.
+*/
+
+class Batch_SVM {
+
+public:
+
+	/*
+	* Constructor.
+	*
+	* @param block_size		Number of samples processed together in a block.
+	*/
+	Batch_SVM(int block_size = 256);
+
+
+	/*
+	* Function to load a model saved with cv::ml::SVM::save or Batch_SVM::save (e.g. the svm.yml written by the
+	* training program).
+	*
+	* @param filename		Path to the model file.
+	*
+	* @return bool			Returns false if the model could not be loaded.
+	*/
+	bool load(const cv::String& filename);
+
+
+	/*
+	* Function to set the model from a trained cv::ml::SVM.
+	*
+	* @param svm			Trained support vector machine.
+	* @param feature_map	Feature map applied to the samples the SVM was trained on.
+	*/
+	void setModel(const cv::Ptr<cv::ml::SVM>& svm, Feature_Map::Type feature_map = Feature_Map::NONE);
+
+
+	/*
+	* Function to set the model from its decision function, without an underlying cv::ml::SVM.
+	*
+	* @param kernel_type		Kernel (cv::ml::SVM::RBF or cv::ml::SVM::LINEAR).
+	* @param gamma				Parameter of the RBF kernel.
+	* @param rho				Bias of the decision function.
+	* @param support_vectors	Support vectors, one per row (CV_32F).
+	* @param alpha				Coefficient of each support vector (CV_32F).
+	* @param positive_label		Label assigned to samples whose decision value is positive.
+	* @param negative_label		Label assigned to samples whose decision value is negative.
+	* @param feature_map		Feature map applied to the samples the SVM was trained on.
+	*/
+	void setDecisionFunction(int kernel_type, double gamma, double rho, const cv::Mat& support_vectors, const cv::Mat& alpha,
+							float positive_label, float negative_label, Feature_Map::Type feature_map = Feature_Map::NONE);
+
+
+	/*
+	* Function to get the decision function of the model.
+	*
+	* @param &kernel_type		Kernel (cv::ml::SVM::RBF or cv::ml::SVM::LINEAR).
+	* @param &gamma				Parameter of the RBF kernel.
+	* @param &rho				Bias of the decision function.
+	* @param &support_vectors	Support vectors, one per row (CV_32F).
+	* @param &alpha				Coefficient of each support vector (CV_32F).
+	*
+	* @return bool				Returns false if the decision function is not evaluated as a blocked matrix computation
+	*							(e.g. other kernels), so it cannot be set with setDecisionFunction.
+	*/
+	bool getDecisionFunction(int& kernel_type, double& gamma, double& rho, cv::Mat& support_vectors, cv::Mat& alpha) const;
+
+
+	/*
+	* Function to save the model. The file can be loaded with cv::ml::SVM::load as well.
+	* Only models with an underlying cv::ml::SVM can be saved.
+	*
+	* @param filename		Path to the model file.
+	*/
+	void save(const cv::String& filename) const;
+
+
+	/*
+	* Function to classify a set of samples.
+	*
+	* @param samples			N x var_count CV_32F matrix, one sample per row (before the feature map).
+	* @param &labels			N x 1 CV_32F predicted labels.
+	* @param &decision_values	N x 1 CV_32F raw decision values.
+	*/
+	void predict(const cv::Mat& samples, cv::Mat& labels, cv::Mat& decision_values) const;
+
+
+	/*
+	* @return bool			Returns true if no model has been loaded.
+	*/
+	bool empty() const;
+
+
+	/*
+	* @return int			Number of support vectors used by the batched decision function.
+	*/
+	int getSupportVectorCount() const;
+
+
+	/*
+	* @param negative		Whether to return the label of negative or positive decision values.
+	*
+	* @return float			Label assigned to samples whose decision value is positive (negative = false)
+	*						or negative (negative = true).
+	*/
+	float getLabel(bool negative) const;
+
+
+	/*
+	* @return cv::Ptr<cv::ml::SVM>		Underlying OpenCV model (empty if set with setDecisionFunction).
+	*/
+	cv::Ptr<cv::ml::SVM> getModel() const;
+
+
+	/*
+	* @return Feature_Map::Type		Feature map applied to the samples before classification.
+	*/
+	Feature_Map::Type getFeatureMap() const;
+
+private:
+
+	// function to extract support vectors, coefficients and labels from the OpenCV model
+	void extractModel(const cv::FileNode& node);
+
+	// function to evaluate the decision function on a block of samples
+	void predictBlock(const cv::Mat& samples, cv::Mat& decision_values) const;
+
+	int block_size;
+	cv::Ptr<cv::ml::SVM> svm;
+	Feature_Map::Type feature_map;
+
+	// true if the decision function can be evaluated as a blocked matrix computation
+	bool batched;
+
+	// true if labels follow from the sign of the decision value (two-class classifier), also when not batched
+	bool sign_labels;
+
+	int kernel_type;
+	double gamma;
+	double rho;
+
+	// support vectors (one per row), their squared norms and coefficients
+	cv::Mat support_vectors;
+	cv::Mat sv_norms;
+	cv::Mat alpha;
+
+	// labels for positive and negative decision values
+	float positive_label;
+	float negative_label;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/*
+* Thread-safe FIFO queue with a maximum capacity, used to connect the stages of a pipeline.
+*
+* push blocks while the queue is full, so that a fast producer is slowed down to the pace of its consumer
+* (backpressure) and the number of items in flight stays bounded. pop blocks while the queue is empty.
+* Once the producer calls close, consumers drain the remaining items and then pop returns false.
+*/
+
+template <typename T>
+class Bounded_Queue {
+
+public:
+
+	/*
+	* Constructor.
+	*
+	* @param capacity		Maximum number of items held by the queue.
+	*/
+	Bounded_Queue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), closed(false) {
+
+	}
+
+
+	/*
+	* Function to add an item, waiting while the queue is full.
+	*
+	* @param item			Item to add.
+	*
+	* @return bool			Returns false if the queue has been closed (the item is discarded).
+	*/
+	bool push(T item) {
+
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [this] { return items.size() < capacity || closed; });
+
+		if (closed) {
+
+			return false;
+		}
+
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+
+		return true;
+	}
+
+
+	/*
+	* Function to remove the oldest item, waiting while the queue is empty.
+	*
+	* @param &item			Removed item.
+	*
+	* @return bool			Returns false if the queue has been closed and no item is left.
+	*/
+	bool pop(T& item) {
+
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [this] { return !items.empty() || closed; });
+
+		if (items.empty()) {
+
+			return false;
+		}
+
+		item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+
+		return true;
+	}
+
+
+	/*
+	* Function to close the queue: no more items can be added, waiting consumers are woken up.
+	*/
+	void close() {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		not_empty.notify_all();
+		not_full.notify_all();
+	}
+
+private:
+
+	size_t capacity;
+	bool closed;
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+};
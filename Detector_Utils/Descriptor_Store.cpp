@@ -0,0 +1,455 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <opencv2/core/utils/filesystem.hpp>
+#include "Descriptor_Store.h"
+#include "Trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define DESCRIPTOR_STORE_MMAP
+#endif
+
+namespace {
+
+	const char MAGIC[4] = { 'B', 'D', 'S', 'T' };
+	const uint32_t VERSION = 1;
+	const uint64_t ALIGNMENT = 64;
+
+	const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+	const uint64_t FNV_PRIME = 1099511628211ULL;
+
+	// header of a chunk, followed by n_entries entries and their descriptors
+	struct Chunk_Header {
+
+		char magic[4];
+		uint32_t version;
+		uint64_t params_hash;
+		uint64_t n_entries;
+		uint64_t file_size;
+	};
+
+	// descriptors of a patch
+	struct Chunk_Entry {
+
+		uint64_t path_hash;
+		uint64_t file_size;
+		int64_t file_time;
+		uint64_t offset;
+		int32_t rows;
+		int32_t cols;
+	};
+
+	uint64_t fnv1a(const void* data, size_t size, uint64_t hash) {
+
+		const unsigned char* bytes = (const unsigned char*)data;
+
+		for (size_t i = 0; i < size; i++) {
+
+			hash ^= bytes[i];
+			hash *= FNV_PRIME;
+		}
+
+		return hash;
+	}
+
+	uint64_t align(uint64_t offset) {
+
+		return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+
+	// size and modification time of a file, to detect patches that changed since they were stored
+	bool getFileStamp(const cv::String& filename, uint64_t& size, int64_t& time) {
+
+		struct stat st;
+
+		if (stat(filename.c_str(), &st) != 0) {
+
+			return false;
+		}
+
+		size = (uint64_t)st.st_size;
+		time = (int64_t)st.st_mtime;
+
+		return true;
+	}
+
+	Chunk_Entry readEntry(const char* data, int i) {
+
+		Chunk_Entry entry;
+		std::memcpy(&entry, data + sizeof(Chunk_Header) + i * sizeof(Chunk_Entry), sizeof(entry));
+
+		return entry;
+	}
+
+	// room taken by an entry in its chunk (alignment padding aside)
+	size_t getEntryBytes(const Chunk_Entry& entry) {
+
+		return sizeof(Chunk_Entry) + (size_t)entry.rows * entry.cols * sizeof(float);
+	}
+
+	cv::String getFileName(const cv::String& path) {
+
+		return path.substr(path.find_last_of("/\\") + 1);
+	}
+}
+
+
+Descriptor_Store::Descriptor_Store(const cv::String& directory, const cv::String& params_key)
+	: directory(directory), params_hash(fnv1a(params_key.data(), params_key.size(), FNV_OFFSET)), next_chunk(0), stale_bytes(0) {
+
+	cv::utils::fs::createDirectories(directory);
+
+	std::vector<cv::String> paths;
+	cv::utils::fs::glob(directory, "chunk_*.bin", paths);
+
+	// chunk numbers are zero-padded, so that later chunks come last
+	std::sort(paths.begin(), paths.end());
+
+	for (int i = 0; i < paths.size(); i++) {
+
+		int number;
+
+		if (std::sscanf(getFileName(paths[i]).c_str(), "chunk_%d.bin", &number) == 1) {
+
+			next_chunk = std::max(next_chunk, number + 1);
+		}
+
+		if (!openChunk(paths[i])) {
+
+			uint64_t size;
+			int64_t time;
+			stale_bytes += getFileStamp(paths[i], size, time) ? (size_t)size : 0;
+		}
+	}
+
+	size_t live_bytes = 0;
+
+	for (std::unordered_map<uint64_t, Entry_Ref>::const_iterator it = index.begin(); it != index.end(); it++) {
+
+		live_bytes += getEntryBytes(readEntry(chunks[it->second.chunk].data, it->second.entry));
+	}
+
+	if (stale_bytes > live_bytes) {
+
+		compact();
+	}
+}
+
+
+Descriptor_Store::~Descriptor_Store() {
+
+	closeChunks();
+}
+
+
+bool Descriptor_Store::find(const cv::String& filename, cv::Mat& descriptors) const {
+
+	std::unordered_map<uint64_t, Entry_Ref>::const_iterator it = index.find(fnv1a(filename.data(), filename.size(), FNV_OFFSET));
+
+	if (it == index.end()) {
+
+		return false;
+	}
+
+	const char* data = chunks[it->second.chunk].data;
+	Chunk_Entry entry = readEntry(data, it->second.entry);
+
+	uint64_t size;
+	int64_t time;
+
+	if (!getFileStamp(filename, size, time) || size != entry.file_size || time != entry.file_time) {
+
+		return false;
+	}
+
+	// read-only view of the mapping
+	descriptors = entry.rows > 0 ? cv::Mat(entry.rows, entry.cols, CV_32F, (void*)(data + entry.offset)) : cv::Mat();
+
+	return true;
+}
+
+
+void Descriptor_Store::add(const cv::String& filename, const cv::Mat& descriptors) {
+
+	CV_Assert(descriptors.empty() || descriptors.type() == CV_32F);
+
+	Pending entry;
+	entry.path_hash = fnv1a(filename.data(), filename.size(), FNV_OFFSET);
+
+	if (!getFileStamp(filename, entry.file_size, entry.file_time)) {
+
+		return;
+	}
+
+	entry.descriptors = descriptors.isContinuous() ? descriptors : descriptors.clone();
+	pending.push_back(entry);
+}
+
+
+bool Descriptor_Store::flush() {
+
+	TRACE_SCOPE("descriptor_store_flush");
+
+	if (pending.empty()) {
+
+		return true;
+	}
+
+	// descriptors which could not be written are dropped, so that they do not pile up in memory
+	cv::String path;
+	bool written = writeChunk(pending, path);
+	pending.clear();
+
+	return written && openChunk(path);
+}
+
+
+int Descriptor_Store::getCount() const {
+
+	return (int)index.size();
+}
+
+
+bool Descriptor_Store::openChunk(const cv::String& path) {
+
+	Chunk chunk;
+	chunk.path = path;
+	chunk.data = 0;
+	chunk.size = 0;
+
+#ifdef DESCRIPTOR_STORE_MMAP
+	int fd = open(path.c_str(), O_RDONLY);
+
+	if (fd < 0) {
+
+		return false;
+	}
+
+	struct stat st;
+	void* mapped = MAP_FAILED;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+
+		mapped = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+
+	close(fd);
+
+	if (mapped == MAP_FAILED) {
+
+		return false;
+	}
+
+	chunk.data = (const char*)mapped;
+	chunk.size = st.st_size;
+#else
+	std::ifstream file(path, std::ios::binary);
+
+	if (!file.is_open()) {
+
+		return false;
+	}
+
+	chunk.buffer.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	chunk.data = chunk.buffer.data();
+	chunk.size = chunk.buffer.size();
+#endif
+
+	Chunk_Header header;
+	bool valid = chunk.size >= sizeof(header);
+
+	if (valid) {
+
+		std::memcpy(&header, chunk.data, sizeof(header));
+
+		valid = !std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) && header.version == VERSION &&
+			header.params_hash == params_hash && header.file_size == chunk.size &&
+			header.n_entries <= (chunk.size - sizeof(header)) / sizeof(Chunk_Entry);
+	}
+
+	if (!valid) {
+
+#ifdef DESCRIPTOR_STORE_MMAP
+		munmap((void*)chunk.data, chunk.size);
+#endif
+		return false;
+	}
+
+	int c = (int)chunks.size();
+
+	for (int i = 0; i < (int)header.n_entries; i++) {
+
+		Chunk_Entry entry = readEntry(chunk.data, i);
+
+		// entries pointing outside the chunk are ignored
+		if (entry.rows < 0 || entry.cols < 0 || entry.offset % ALIGNMENT || entry.offset > chunk.size ||
+			(uint64_t)entry.rows * entry.cols * sizeof(float) > chunk.size - entry.offset) {
+
+			stale_bytes += sizeof(Chunk_Entry);
+			continue;
+		}
+
+		std::unordered_map<uint64_t, Entry_Ref>::iterator it = index.find(entry.path_hash);
+
+		if (it != index.end()) {
+
+			// the entry of an older chunk is replaced
+			const Chunk& old_chunk = it->second.chunk == c ? chunk : chunks[it->second.chunk];
+			stale_bytes += getEntryBytes(readEntry(old_chunk.data, it->second.entry));
+		}
+
+		index[entry.path_hash] = { c, i };
+	}
+
+	// moving the buffer keeps its storage, so data stays valid
+	chunks.push_back(std::move(chunk));
+
+	return true;
+}
+
+
+void Descriptor_Store::closeChunks() {
+
+#ifdef DESCRIPTOR_STORE_MMAP
+	for (int c = 0; c < chunks.size(); c++) {
+
+		munmap((void*)chunks[c].data, chunks[c].size);
+	}
+#endif
+
+	chunks.clear();
+	index.clear();
+}
+
+
+bool Descriptor_Store::writeChunk(const std::vector<Pending>& entries, cv::String& path) {
+
+	char name[32];
+	std::snprintf(name, sizeof(name), "chunk_%06d.bin", next_chunk++);
+	path = directory + "/" + name;
+
+	// descriptors start at aligned offsets, after the table of entries
+	std::vector<Chunk_Entry> table(entries.size());
+	uint64_t offset = align(sizeof(Chunk_Header) + entries.size() * sizeof(Chunk_Entry));
+
+	for (int i = 0; i < entries.size(); i++) {
+
+		table[i].path_hash = entries[i].path_hash;
+		table[i].file_size = entries[i].file_size;
+		table[i].file_time = entries[i].file_time;
+		table[i].offset = offset;
+		table[i].rows = entries[i].descriptors.rows;
+		table[i].cols = entries[i].descriptors.cols;
+
+		offset = align(offset + (uint64_t)table[i].rows * table[i].cols * sizeof(float));
+	}
+
+	Chunk_Header header;
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.params_hash = params_hash;
+	header.n_entries = entries.size();
+	header.file_size = offset;
+
+	// write to a temporary file, then move it in place
+	cv::String tmp_path = path + ".tmp";
+
+	{
+		std::ofstream file(tmp_path, std::ios::binary);
+
+		if (!file.is_open()) {
+
+			return false;
+		}
+
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)table.data(), table.size() * sizeof(Chunk_Entry));
+
+		const char zeros[ALIGNMENT] = { 0 };
+		uint64_t position = sizeof(header) + table.size() * sizeof(Chunk_Entry);
+
+		for (int i = 0; i < entries.size(); i++) {
+
+			file.write(zeros, table[i].offset - position);
+			file.write((const char*)entries[i].descriptors.data, (uint64_t)table[i].rows * table[i].cols * sizeof(float));
+			position = table[i].offset + (uint64_t)table[i].rows * table[i].cols * sizeof(float);
+		}
+
+		file.write(zeros, header.file_size - position);
+
+		if (!file.good()) {
+
+			file.close();
+			std::remove(tmp_path.c_str());
+			return false;
+		}
+	}
+
+	if (std::rename(tmp_path.c_str(), path.c_str())) {
+
+		std::remove(tmp_path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+
+void Descriptor_Store::compact() {
+
+	TRACE_SCOPE("descriptor_store_compact");
+
+	// valid entries, in a fixed order
+	std::vector<Pending> live;
+	live.reserve(index.size());
+
+	for (std::unordered_map<uint64_t, Entry_Ref>::const_iterator it = index.begin(); it != index.end(); it++) {
+
+		const char* data = chunks[it->second.chunk].data;
+		Chunk_Entry entry = readEntry(data, it->second.entry);
+
+		Pending pending_entry;
+		pending_entry.path_hash = entry.path_hash;
+		pending_entry.file_size = entry.file_size;
+		pending_entry.file_time = entry.file_time;
+		pending_entry.descriptors = entry.rows > 0 ? cv::Mat(entry.rows, entry.cols, CV_32F, (void*)(data + entry.offset)) : cv::Mat();
+		live.push_back(pending_entry);
+	}
+
+	std::sort(live.begin(), live.end(), [](const Pending& a, const Pending& b) { return a.path_hash < b.path_hash; });
+
+	cv::String path;
+
+	if (!live.empty() && !writeChunk(live, path)) {
+
+		// the store is left as it is
+		return;
+	}
+
+	live.clear();
+	closeChunks();
+	stale_bytes = 0;
+
+	std::vector<cv::String> paths;
+	cv::utils::fs::glob(directory, "chunk_*.bin", paths);
+
+	for (int i = 0; i < paths.size(); i++) {
+
+		if (getFileName(paths[i]) != getFileName(path)) {
+
+			std::remove(paths[i].c_str());
+		}
+	}
+
+	if (!path.empty()) {
+
+		openChunk(path);
+	}
+}
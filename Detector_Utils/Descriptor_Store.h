@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/*
+* Persistent on-disk store of the keypoint descriptors of the training patches, so that retraining (e.g. with another
+* vocabulary size or SVM setting) does not read and describe the patches again.
+*
+* The store is a directory of chunk files, each written by one run with the descriptors of the patches that were not
+* in the store or changed since they were stored:
+*
+* - header: magic "BDST", format version, hash of the descriptor parameters, number of entries, file size
+* - entries: FNV-1a hash of the patch path, size and modification time of the patch file, rows, cols and offset of
+*   its descriptors (native byte order)
+* - payload: descriptors of each entry (rows x cols CV_32F), each starting at a 64-byte aligned offset
+*
+* Chunks are memory mapped where available and descriptors are returned as views of the mapping, without copies.
+* A patch is looked up by path; its entry is used only if the size and modification time of the file still match and
+* if it was computed with the same parameters (a string describing the detector, see the training program). When a
+* patch is stored several times, the most recent chunk wins. When outdated entries take more room than the valid ones,
+* the store is compacted when it is opened. Chunks are written to a temporary file and renamed, so readers never see
+* partial chunks.
+*
+* find is const and can be called by several threads; add and flush are not thread-safe.
+*/
+
+class Descriptor_Store {
+
+public:
+
+	/*
+	* Constructor. Opens the store, creating its directory if it does not exist.
+	*
+	* @param directory		Directory containing the chunks.
+	* @param params_key		Description of the parameters the descriptors are computed with.
+	*/
+	Descriptor_Store(const cv::String& directory, const cv::String& params_key);
+
+
+	/*
+	* Destructor. Descriptors returned by find are no longer valid.
+	*/
+	~Descriptor_Store();
+
+
+	/*
+	* Function to look up the descriptors of a patch.
+	*
+	* @param filename		Path to the patch file.
+	* @param &descriptors	Descriptors of the patch (view of the store, valid as long as the store), possibly empty
+	*						if the patch has no keypoint.
+	*
+	* @return bool			Returns false if the patch is not in the store or changed since it was stored.
+	*/
+	bool find(const cv::String& filename, cv::Mat& descriptors) const;
+
+
+	/*
+	* Function to add the descriptors of a patch, written to disk by flush.
+	*
+	* @param filename		Path to the patch file.
+	* @param descriptors	Descriptors of the patch (CV_32F, one per row, empty if the patch has no keypoint).
+	*/
+	void add(const cv::String& filename, const cv::Mat& descriptors);
+
+
+	/*
+	* Function to write the descriptors added since the last flush to a new chunk.
+	*
+	* @return bool			Returns false if the chunk could not be written (its descriptors are dropped).
+	*/
+	bool flush();
+
+
+	/*
+	* @return int			Number of patches in the store.
+	*/
+	int getCount() const;
+
+private:
+
+	// chunk file, mapped in memory (or read, where memory mapping is not available)
+	struct Chunk {
+
+		cv::String path;
+		const char* data;
+		size_t size;
+		std::vector<char> buffer;
+	};
+
+	// location of the entry of a patch
+	struct Entry_Ref {
+
+		int chunk;
+		int entry;
+	};
+
+	// descriptors added and not written yet
+	struct Pending {
+
+		uint64_t path_hash;
+		uint64_t file_size;
+		int64_t file_time;
+		cv::Mat descriptors;
+	};
+
+	Descriptor_Store(const Descriptor_Store&);
+	Descriptor_Store& operator=(const Descriptor_Store&);
+
+	// maps a chunk and indexes its entries, returns false if it is not a valid chunk written with the same parameters
+	bool openChunk(const cv::String& path);
+
+	void closeChunks();
+
+	// writes entries to a new chunk, named after the last one
+	bool writeChunk(const std::vector<Pending>& entries, cv::String& path);
+
+	// rewrites the valid entries to a single chunk and removes the other chunks
+	void compact();
+
+	cv::String directory;
+	uint64_t params_hash;
+
+	std::vector<Chunk> chunks;
+	std::unordered_map<uint64_t, Entry_Ref> index;
+	std::vector<Pending> pending;
+
+	// number of the next chunk
+	int next_chunk;
+
+	// bytes of the chunks taken by outdated entries (replaced, or computed with other parameters)
+	size_t stale_bytes;
+};
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <numeric>
+#include "Detection_Evaluator.h"
+#include "Detector_Utils.h"
+
+namespace {
+
+	void reportTimes(std::ostream& out, const cv::String& name, const std::vector<double>& values) {
+
+		double mean = values.empty() ? 0.0 : std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+
+		out << cv::format("  %-22s mean %9.2f  p50 %9.2f  p95 %9.2f  max %9.2f", name.c_str(), mean, Detector_Utils::percentile(values, 0.5),
+			Detector_Utils::percentile(values, 0.95), Detector_Utils::percentile(values, 1.0)) << std::endl;
+	}
+}
+
+
+Detection_Evaluator::Detection_Evaluator(const std::vector<float>& iou_thresholds, const std::vector<cv::String>& stage_names)
+	: iou_thresholds(iou_thresholds), stage_names(stage_names), matches(iou_thresholds.size()), n_ground_truth(0), n_images(0),
+	stage_ms(stage_names.size()) {
+
+}
+
+
+void Detection_Evaluator::add(const cv::String& image_name, const std::vector<cv::Rect>& boxes, const std::vector<float>& scores,
+							const std::vector<cv::Rect>& ground_truth, const std::vector<double>& stage_ms) {
+
+	CV_Assert(scores.size() == boxes.size());
+
+	std::vector<int> matched;
+
+	for (int t = 0; t < iou_thresholds.size(); t++) {
+
+		match(boxes, scores, ground_truth, iou_thresholds[t], matched);
+
+		for (int j = 0; j < boxes.size(); j++) {
+
+			matches[t].push_back({ scores[j], matched[j] >= 0 });
+		}
+	}
+
+	n_ground_truth += ground_truth.size();
+	n_images++;
+
+	image_names.push_back(image_name);
+	image_ms.push_back(std::accumulate(stage_ms.begin(), stage_ms.end(), 0.0));
+
+	for (int s = 0; s < this->stage_ms.size() && s < stage_ms.size(); s++) {
+
+		this->stage_ms[s].push_back(stage_ms[s]);
+	}
+}
+
+
+void Detection_Evaluator::match(const std::vector<cv::Rect>& boxes, const std::vector<float>& scores, const std::vector<cv::Rect>& ground_truth,
+								float iou_threshold, std::vector<int>& matched) {
+
+	matched.assign(boxes.size(), -1);
+
+	// most confident detections first
+	std::vector<int> order(boxes.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&scores](int a, int b) { return scores[a] > scores[b]; });
+
+	std::vector<bool> taken(ground_truth.size(), false);
+
+	for (int k = 0; k < order.size(); k++) {
+
+		int j = order[k];
+		float best_iou = 0;
+		int best = -1;
+
+		// ground truth box the detection overlaps most, whether it is already matched or not
+		for (int g = 0; g < ground_truth.size(); g++) {
+
+			float iou = Detector_Utils::intersectionOverUnion(boxes[j], ground_truth[g]);
+
+			if (iou > best_iou) {
+
+				best_iou = iou;
+				best = g;
+			}
+		}
+
+		// a detection of a box already matched by a more confident one is a duplicate, hence a false positive
+		if (best >= 0 && best_iou >= iou_threshold && !taken[best]) {
+
+			taken[best] = true;
+			matched[j] = best;
+		}
+	}
+}
+
+
+float Detection_Evaluator::computeCurve(int t, std::vector<PR_Point>& curve) const {
+
+	// rank the detections of all the images, true positives first among equal scores so that the order of the images
+	// does not matter
+	std::vector<Scored_Match> ranked = matches[t];
+	std::sort(ranked.begin(), ranked.end(), [](const Scored_Match& a, const Scored_Match& b) {
+
+		return a.score > b.score || (a.score == b.score && a.positive > b.positive);
+	});
+
+	curve.resize(ranked.size());
+	size_t tp = 0;
+
+	for (int k = 0; k < ranked.size(); k++) {
+
+		tp += ranked[k].positive ? 1 : 0;
+		curve[k].score = ranked[k].score;
+		curve[k].precision = (float)tp / (k + 1);
+		curve[k].recall = n_ground_truth > 0 ? (float)tp / n_ground_truth : 0.0f;
+	}
+
+	// area under the monotone envelope of the curve: at each recall step, the best precision reached at that recall or beyond
+	double ap = 0;
+	float envelope = 0;
+	std::vector<float> precision(curve.size());
+
+	for (int k = (int)curve.size() - 1; k >= 0; k--) {
+
+		envelope = std::max(envelope, curve[k].precision);
+		precision[k] = envelope;
+	}
+
+	float previous_recall = 0;
+
+	for (int k = 0; k < curve.size(); k++) {
+
+		if (curve[k].recall > previous_recall) {
+
+			ap += (curve[k].recall - previous_recall) * precision[k];
+			previous_recall = curve[k].recall;
+		}
+	}
+
+	return (float)ap;
+}
+
+
+void Detection_Evaluator::report(std::ostream& out, double wall_ms) const {
+
+	size_t n_detections = matches.empty() ? 0 : matches[0].size();
+
+	out << "Evaluation on " << n_images << " images, " << n_ground_truth << " ground truth boxes, ";
+	out << n_detections << " detections." << std::endl << std::endl;
+
+	// curves are independent, compute them in parallel
+	std::vector<std::vector<PR_Point>> curves(iou_thresholds.size());
+	std::vector<float> aps(iou_thresholds.size());
+
+	cv::parallel_for_(cv::Range(0, (int)iou_thresholds.size()), [&](const cv::Range& range) {
+
+		for (int t = range.start; t < range.end; t++) {
+
+			aps[t] = computeCurve(t, curves[t]);
+		}
+	});
+
+	out << "  IoU     AP   precision   recall   best F1 (score)" << std::endl;
+
+	for (int t = 0; t < iou_thresholds.size(); t++) {
+
+		const std::vector<PR_Point>& curve = curves[t];
+		float precision = curve.empty() ? 0.0f : curve.back().precision;
+		float recall = curve.empty() ? 0.0f : curve.back().recall;
+
+		// operating point with the best F1 score
+		float best_f1 = 0, best_score = 0;
+
+		for (int k = 0; k < curve.size(); k++) {
+
+			float sum = curve[k].precision + curve[k].recall;
+			float f1 = sum > 0 ? 2 * curve[k].precision * curve[k].recall / sum : 0.0f;
+
+			if (f1 > best_f1) {
+
+				best_f1 = f1;
+				best_score = curve[k].score;
+			}
+		}
+
+		out << cv::format("  %.2f  %.4f  %9.4f  %7.4f   %.4f (%.3f)", iou_thresholds[t], aps[t], precision, recall, best_f1, best_score);
+		out << std::endl;
+	}
+
+	if (!aps.empty()) {
+
+		out << cv::format("  mAP over %d IoU thresholds: %.4f", (int)aps.size(),
+			std::accumulate(aps.begin(), aps.end(), 0.0f) / aps.size()) << std::endl;
+	}
+
+	// timings of the detection stages, in ms per image
+	out << std::endl << "Timings (ms per image):" << std::endl;
+
+	for (int s = 0; s < stage_names.size(); s++) {
+
+		reportTimes(out, stage_names[s], stage_ms[s]);
+	}
+
+	// stages of different images overlap, so the throughput is higher than the inverse of the time per image
+	reportTimes(out, "all stages", image_ms);
+
+	if (!image_ms.empty()) {
+
+		size_t slowest = std::max_element(image_ms.begin(), image_ms.end()) - image_ms.begin();
+		out << "  slowest image: " << image_names[slowest] << " (" << image_ms[slowest] << " ms)" << std::endl;
+	}
+
+	if (wall_ms > 0) {
+
+		out << "  wall-clock time: " << wall_ms / 1000 << " s, " << n_images * 1000.0 / wall_ms << " images/s" << std::endl;
+	}
+}
+
+
+void Detection_Evaluator::writeCurves(std::ostream& out) const {
+
+	out << "iou,score,precision,recall" << std::endl;
+
+	for (int t = 0; t < iou_thresholds.size(); t++) {
+
+		std::vector<PR_Point> curve;
+		computeCurve(t, curve);
+
+		for (int k = 0; k < curve.size(); k++) {
+
+			out << iou_thresholds[t] << "," << curve[k].score << "," << curve[k].precision << "," << curve[k].recall << std::endl;
+		}
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/*
+* Evaluation of the detections of an annotated dataset.
+*
+* For each IoU threshold, the detections of an image are visited in decreasing order of score and each one is matched
+* to the ground truth box it overlaps most, if their intersection over union is at least the threshold and that box is
+* not matched yet (PASCAL VOC protocol: a detection whose best box is already taken is a duplicate, and is not matched
+* to another box). Matched detections are true positives, the others false positives; ground truth boxes left
+* unmatched are missed. Inputs are never modified.
+*
+* Detections of all the images are then ranked by score to build the precision-recall curve, and the average precision
+* is the area under its monotone (interpolated) envelope, summed at every recall step. Per-image timings of the
+* detection stages are collected as well, so that a report shows accuracy and speed of a run side by side.
+*
+* Images can be added in any order; the report does not depend on it.
+*/
+
+class Detection_Evaluator {
+
+public:
+
+	/*
+	* Point of a precision-recall curve.
+	*/
+	struct PR_Point {
+
+		float score;
+		float precision;
+		float recall;
+	};
+
+
+	/*
+	* Constructor.
+	*
+	* @param iou_thresholds		IoU thresholds the detections are evaluated at.
+	* @param stage_names		Names of the timed detection stages.
+	*/
+	Detection_Evaluator(const std::vector<float>& iou_thresholds, const std::vector<cv::String>& stage_names);
+
+
+	/*
+	* Function to add the detections of an image.
+	*
+	* @param image_name		Name of the image.
+	* @param boxes			Detected boxes.
+	* @param scores			Score of each box (the higher, the more confident).
+	* @param ground_truth	Ground truth boxes.
+	* @param stage_ms		Time (ms) spent in each detection stage, in the order of stage_names.
+	*/
+	void add(const cv::String& image_name, const std::vector<cv::Rect>& boxes, const std::vector<float>& scores,
+			const std::vector<cv::Rect>& ground_truth, const std::vector<double>& stage_ms);
+
+
+	/*
+	* Function to compute the precision-recall curve at an IoU threshold.
+	*
+	* @param t				Index of the IoU threshold.
+	* @param &curve			One point per detection, in decreasing order of score.
+	*
+	* @return float			Average precision.
+	*/
+	float computeCurve(int t, std::vector<PR_Point>& curve) const;
+
+
+	/*
+	* Function to write a summary of the evaluation: average precision at each IoU threshold (and their mean), precision,
+	* recall and best F1 score, and the distribution of the per-image timings.
+	*
+	* @param &out			Stream the report is written to.
+	* @param wall_ms		Wall-clock time of the whole run (ms), to report the throughput (0: not reported).
+	*/
+	void report(std::ostream& out, double wall_ms = 0) const;
+
+
+	/*
+	* Function to write the precision-recall curves, as CSV lines iou,score,precision,recall.
+	*
+	* @param &out			Stream the curves are written to.
+	*/
+	void writeCurves(std::ostream& out) const;
+
+
+	/*
+	* Function to match the detections of an image with its ground truth boxes at an IoU threshold.
+	*
+	* @param boxes			Detected boxes.
+	* @param scores			Score of each box.
+	* @param ground_truth	Ground truth boxes.
+	* @param iou_threshold	Minimum intersection over union of a match.
+	* @param &matched		For each box, index of the matched ground truth box (-1 if none).
+	*/
+	static void match(const std::vector<cv::Rect>& boxes, const std::vector<float>& scores, const std::vector<cv::Rect>& ground_truth,
+					float iou_threshold, std::vector<int>& matched);
+
+private:
+
+	// scored detection, true or false positive
+	struct Scored_Match {
+
+		float score;
+		bool positive;
+	};
+
+	std::vector<float> iou_thresholds;
+	std::vector<cv::String> stage_names;
+
+	// detections of all the images, for each IoU threshold
+	std::vector<std::vector<Scored_Match>> matches;
+	size_t n_ground_truth;
+	int n_images;
+
+	// per-image timings: total and per stage
+	std::vector<cv::String> image_names;
+	std::vector<double> image_ms;
+	std::vector<std::vector<double>> stage_ms;
+};
@@ -0,0 +1,113 @@
+#include "Detection_Writer.h"
+
+bool Detection_Writer::parseFormat(const cv::String& name, Format& format) {
+
+	if (name == "jsonl") {
+
+		format = JSONL;
+	}
+	else if (name == "csv") {
+
+		format = CSV;
+	}
+	else {
+
+		return false;
+	}
+
+	return true;
+}
+
+
+Detection_Writer::Detection_Writer(std::ostream& out, Format format) : out(out), format(format), header_written(false) {
+
+}
+
+
+void Detection_Writer::write(const cv::String& image_name, const std::vector<cv::Rect>& boxes, const std::vector<float>& scores,
+							const std::vector<float>& ious) {
+
+	CV_Assert(scores.size() == boxes.size() && ious.size() == boxes.size());
+
+	// escape the image name once for all the boxes of the image
+	std::string name;
+
+	if (format == JSONL) {
+
+		for (char c : image_name) {
+
+			if (c == '"' || c == '\\') {
+
+				name += '\\';
+				name += c;
+			}
+			else if ((unsigned char)c < 0x20) {
+
+				// control characters are not allowed in JSON strings
+				name += cv::format("\\u%04x", (unsigned char)c);
+			}
+			else {
+
+				name += c;
+			}
+		}
+	}
+	else {
+
+		// csv fields containing separators, quotes or line breaks are quoted, with quotes doubled
+		bool quote = image_name.find_first_of(",\"\r\n") != cv::String::npos;
+
+		for (char c : image_name) {
+
+			name += c;
+
+			if (c == '"') {
+
+				name += '"';
+			}
+		}
+
+		if (quote) {
+
+			name = "\"" + name + "\"";
+		}
+
+		if (!header_written) {
+
+			out << "image,x,y,width,height,score,iou\n";
+			header_written = true;
+		}
+	}
+
+	// a record with empty fields for an image without detections
+	if (boxes.empty()) {
+
+		if (format == JSONL) {
+
+			out << "{\"image\":\"" << name << "\",\"x\":null,\"y\":null,\"width\":null,\"height\":null,\"score\":null,\"iou\":null}\n";
+		}
+		else {
+
+			out << name << ",,,,,,\n";
+		}
+	}
+
+	for (int i = 0; i < boxes.size(); i++) {
+
+		const cv::Rect& box = boxes[i];
+
+		if (format == JSONL) {
+
+			out << "{\"image\":\"" << name << "\",\"x\":" << box.x << ",\"y\":" << box.y;
+			out << ",\"width\":" << box.width << ",\"height\":" << box.height;
+			out << ",\"score\":" << scores[i] << ",\"iou\":" << ious[i] << "}\n";
+		}
+		else {
+
+			out << name << "," << box.x << "," << box.y << "," << box.width << "," << box.height;
+			out << "," << scores[i] << "," << ious[i] << "\n";
+		}
+	}
+
+	out.flush();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/*
+* Writer of detections in a machine-readable format, one record per detected box:
+* image name, box (x, y, width, height), SVM score and intersection over union with the matched ground truth box
+* (0 if the box matches no ground truth box). An image without detections gets one record with empty box, score and
+* iou fields, so that "no boat" can be told apart from "image not processed".
+*
+* - JSONL: one JSON object per line, e.g. {"image":"image0001.png","x":10,"y":20,"width":200,"height":120,"score":1.25,"iou":0.71},
+*   empty fields are null.
+* - CSV: header line image,x,y,width,height,score,iou followed by one line per box, empty fields are left blank.
+*/
+
+class Detection_Writer {
+
+public:
+
+	enum Format { JSONL, CSV };
+
+
+	/*
+	* Function to parse the name of an output format.
+	*
+	* @param name			Name of the format (jsonl or csv).
+	* @param &format		Parsed format.
+	*
+	* @return bool			Returns false if name is not a known format.
+	*/
+	static bool parseFormat(const cv::String& name, Format& format);
+
+
+	/*
+	* Constructor.
+	*
+	* @param &out			Stream detections are written to. It must outlive the writer.
+	* @param format			Output format.
+	*/
+	Detection_Writer(std::ostream& out, Format format);
+
+
+	/*
+	* Function to write the detections of an image. The stream is flushed, so that records of processed images
+	* are available while the following ones are still running.
+	*
+	* @param image_name		Name of the image.
+	* @param boxes			Detected boxes.
+	* @param scores			SVM score of each box.
+	* @param ious			Intersection over union of each box with its matched ground truth box.
+	*/
+	void write(const cv::String& image_name, const std::vector<cv::Rect>& boxes, const std::vector<float>& scores,
+			const std::vector<float>& ious);
+
+private:
+
+	std::ostream& out;
+	Format format;
+	bool header_written;
+};
@@ -3,13 +3,18 @@
 #include <opencv2/highgui.hpp>
 #include <opencv2/features2d.hpp>
 #include <opencv2/core/utils/filesystem.hpp>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <queue>
 #include <opencv2/ml.hpp>
 #include <opencv2/ximgproc/segmentation.hpp>
 #include "Detector_Utils.h"
+#include "Trace.h"
 
-int Detector_Utils::loadFiles(cv::String path, std::vector<cv::String> pattern, std::vector<cv::String> &filenames) {
+int Detector_Utils::loadFiles(const cv::String& path, const std::vector<cv::String>& pattern, std::vector<cv::String> &filenames) {
 
 	while (filenames.empty()) {
 		
@@ -35,7 +40,7 @@ int Detector_Utils::loadFiles(cv::String path, std::vector<cv::String> pattern,
 }
 
 
-cv::String Detector_Utils::getImageName(cv::String filename, cv::String dir_path, cv::String ext) {
+cv::String Detector_Utils::getImageName(const cv::String& filename, const cv::String& dir_path, const cv::String& ext) {
 
 	// remove file format from name
 	cv::String image_name = filename.substr(0, filename.find(ext));
@@ -44,7 +49,7 @@ cv::String Detector_Utils::getImageName(cv::String filename, cv::String dir_path
 }
 
 
-std::vector<cv::Rect> Detector_Utils::getGroundTruth(cv::String filename) {
+std::vector<cv::Rect> Detector_Utils::getGroundTruth(const cv::String& filename) {
 
 	std::fstream filestream(filename);
 	int corners[4];
@@ -89,50 +94,171 @@ void Detector_Utils::getCorners(std::string line, int corners[]) {
 }
 
 
-void Detector_Utils::getPatches(std::vector<cv::Rect> rects, cv::Mat image, std::vector<cv::Mat> &patches) {
+void Detector_Utils::getPatches(const std::vector<cv::Rect>& rects, const cv::Mat& image, std::vector<cv::Mat>& patches) {
 
 	patches.clear();
-	cv::Mat patch;
+	patches.reserve(rects.size());
 
+	// patches are views on the image, no pixel is copied
 	for (int i = 0; i < rects.size(); i++) {
-		
-		// crop image
-		patch = image.clone();
-		patch = image(rects[i]);
 
-		patches.push_back(patch);
+		patches.push_back(image(rects[i]));
 	}
 }
 
 
 void Detector_Utils::processPatches(std::vector<cv::Mat>& patches) {
-	
+
+	TRACE_SCOPE("process_patches");
+
 	// switch to grayscale and perform CLAHE equalization
-	int clipLimit = 40;
-	cv::Size gridSize = cv::Size(8, 8);
-	cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(clipLimit, gridSize);
+	cv::CLAHE& clahe = getCLAHE();
+	thread_local cv::Mat gray;
+
 	for (int i = 0; i < patches.size(); i++) {
-	
-		cv::cvtColor(patches[i], patches[i], cv::COLOR_BGR2GRAY);
-		clahe->apply(patches[i], patches[i]);
+
+		// CLAHE pads patches whose sides are not multiple of the tiles: the patch is copied to its own buffer first,
+		// so that the border is reflected from the patch and not read from the image around it
+		if (patches[i].channels() != 1) {
+
+			cv::cvtColor(patches[i], gray, cv::COLOR_BGR2GRAY);
+		}
+		else {
+
+			patches[i].copyTo(gray);
+		}
+
+		// a new buffer is allocated for each patch, never written through a view of the image
+		patches[i] = cv::Mat();
+		clahe.apply(gray, patches[i]);
+	}
+}
+
+
+void Detector_Utils::processPatches(const cv::Mat& gray, const std::vector<cv::Rect>& rects, std::vector<cv::Mat>& patches) {
+
+	TRACE_SCOPE("process_patches");
+
+	// CLAHE is applied to each patch on its own, as for the patches used for training. Each patch is copied out of
+	// the image first, so that CLAHE pads it by reflecting the patch itself and not with the pixels around it
+	cv::CLAHE& clahe = getCLAHE();
+	thread_local cv::Mat scratch;
+	patches.resize(rects.size());
+
+	for (int i = 0; i < rects.size(); i++) {
+
+		gray(rects[i]).copyTo(scratch);
+		patches[i] = cv::Mat();
+		clahe.apply(scratch, patches[i]);
 	}
 }
 
 
-void Detector_Utils::savePatches(std::vector<cv::Mat> patches, cv::String image_name, cv::String patches_path) {
+void Detector_Utils::processImage(const cv::Mat& image, cv::Mat& processed) {
+
+	TRACE_SCOPE("process_image");
+
+	// same processing applied to patches: grayscale and CLAHE equalization
+	cv::CLAHE& clahe = getCLAHE();
+
+	if (image.channels() == 1) {
+
+		clahe.apply(image, processed);
+	}
+	else {
+
+		thread_local cv::Mat gray;
+		cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+		clahe.apply(gray, processed);
+	}
+}
+
+
+cv::CLAHE& Detector_Utils::getCLAHE() {
+
+	// one CLAHE object per thread: its lookup tables and buffers are reused from an image to the next
+	thread_local cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(CLAHE_CLIP_LIMIT, cv::Size(CLAHE_GRID_SIZE, CLAHE_GRID_SIZE));
+
+	return *clahe;
+}
+
+
+void Detector_Utils::savePatches(const std::vector<cv::Mat>& patches, const cv::String& image_name, const cv::String& patches_path) {
 
 	for (int i = 0; i < patches.size(); i++) {
 	
 		// save patch to the correct position
-		cv::String patchpath = patches_path + image_name + "_" + std::to_string(i) + ".png";
-		cv::imwrite(patchpath, patches[i]);
+		cv::imwrite(getPatchPath(patches_path, image_name, i), patches[i]);
+	}
+}
+
+
+cv::String Detector_Utils::getPatchPath(const cv::String& patches_path, const cv::String& image_name, int i) {
+
+	return patches_path + image_name + "_" + std::to_string(i) + ".png";
+}
+
+
+cv::String Detector_Utils::getPatchRegionsPath(const cv::String& patches_path) {
+
+	return cv::utils::fs::join(patches_path, "regions.txt");
+}
+
+
+bool Detector_Utils::savePatchRegions(const cv::String& filename, const std::vector<cv::String>& names, const std::vector<cv::Rect>& rects) {
+
+	std::ofstream filestream(filename);
+
+	if (!filestream.is_open()) {
+
+		return false;
 	}
+
+	for (int i = 0; i < names.size(); i++) {
+
+		filestream << names[i] << " " << rects[i].x << " " << rects[i].y << " " << rects[i].width << " " << rects[i].height << "\n";
+	}
+
+	return (bool)filestream;
+}
+
+
+bool Detector_Utils::loadPatchRegions(const cv::String& filename, std::map<cv::String, cv::Rect>& regions) {
+
+	std::ifstream filestream(filename);
+
+	if (!filestream.is_open()) {
+
+		return false;
+	}
+
+	std::string name;
+	cv::Rect rect;
+
+	while (filestream >> name >> rect.x >> rect.y >> rect.width >> rect.height) {
+
+		regions[name] = rect;
+	}
+
+	return true;
 }
 
 
-std::vector<cv::Rect> Detector_Utils::getProposals(cv::Mat image, cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentation> ss, int max_n) {
+std::vector<cv::Rect> Detector_Utils::getProposals(const cv::Mat& image, const cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentation>& ss, int max_n,
+													int max_side, double scale) {
+
+	TRACE_SCOPE("selective_search");
 
-	ss->setBaseImage(image);
+	// segment a downscaled copy of the image, if requested
+	double factor = getProposalsScale(image.size(), max_side, scale);
+	cv::Mat segmented = image;
+
+	if (factor < 1.0) {
+
+		cv::resize(image, segmented, cv::Size(), factor, factor, cv::INTER_AREA);
+	}
+
+	ss->setBaseImage(segmented);
 	ss->switchToSelectiveSearchFast();
 
 	// run selective search segmentation on input image
@@ -143,14 +269,28 @@ std::vector<cv::Rect> Detector_Utils::getProposals(cv::Mat image, cv::Ptr<cv::xi
 	// run selective search
 	ss->process(rects);
 
+	cv::Rect image_rect(0, 0, image.cols, image.rows);
 	int count = 0;
 	
 	for (int i = 0; count < max_n && i < rects.size(); i++) {
 
-		// consider only patches with significative area
-		if (rects[i].area() > 1000) {
+		cv::Rect rect = rects[i];
+
+		if (factor < 1.0) {
+
+			// map the region back to the original image, covering all the pixels it covers in the downscaled one
+			int x1 = cvFloor(rect.x / factor);
+			int y1 = cvFloor(rect.y / factor);
+			int x2 = cvCeil(rect.br().x / factor);
+			int y2 = cvCeil(rect.br().y / factor);
+
+			rect = cv::Rect(x1, y1, x2 - x1, y2 - y1) & image_rect;
+		}
+
+		// consider only patches with significative area (in the original image)
+		if (rect.area() > 1000) {
 
-			proposals.push_back(rects[i]);
+			proposals.push_back(rect);
 			++count;
 		}
 	}
@@ -160,6 +300,26 @@ std::vector<cv::Rect> Detector_Utils::getProposals(cv::Mat image, cv::Ptr<cv::xi
 }
 
 
+double Detector_Utils::getProposalsScale(cv::Size size, int max_side, double scale) {
+
+	double factor = scale > 0 ? std::min(scale, 1.0) : 1.0;
+	int side = std::max(size.width, size.height);
+
+	if (max_side > 0 && side > max_side) {
+
+		factor = std::min(factor, (double)max_side / side);
+	}
+
+	return factor;
+}
+
+
+cv::String Detector_Utils::getProposalsKey(int max_n, int max_side, double scale) {
+
+	return cv::format("selective_search_fast;min_area=1000;max_n=%d;max_side=%d;scale=%g", max_n, max_side, scale);
+}
+
+
 float Detector_Utils::intersectionOverUnion(cv::Rect rect1, cv::Rect rect2) {
 
 	// compute the area of intersection rectangle
@@ -172,7 +332,49 @@ float Detector_Utils::intersectionOverUnion(cv::Rect rect1, cv::Rect rect2) {
 }
 
 
-void Detector_Utils::nonMaximaSuppression(std::vector<cv::Rect> pred_boxes, std::vector<cv::Rect>& final_boxes, float threshold) {
+double Detector_Utils::percentile(std::vector<double> values, double p) {
+
+	if (values.empty()) {
+
+		return 0.0;
+	}
+
+	// rank ceil(p * n), counted from 1
+	size_t k = (size_t)std::min(std::max(std::ceil(p * values.size()) - 1, 0.0), values.size() - 1.0);
+	std::nth_element(values.begin(), values.begin() + k, values.end());
+
+	return values[k];
+}
+
+
+void Detector_Utils::getNegativeRects(const std::vector<cv::Rect>& proposals, const std::vector<cv::Rect>& ground_truth, int max_n,
+									std::vector<cv::Rect>& negatives) {
+
+	negatives.clear();
+
+	for (int j = 0; (int)negatives.size() < max_n && j < proposals.size(); j++) {
+
+		bool negative = true;
+
+		//proposals that do not overlap with ground_truth are negatives
+		for (int k = 0; k < ground_truth.size(); k++) {
+
+			if (intersectionOverUnion(proposals[j], ground_truth[k]) > 0) {
+
+				negative = false;
+				break;
+			}
+		}
+
+		if (negative) {
+
+			negatives.push_back(proposals[j]);
+		}
+	}
+}
+
+
+void Detector_Utils::nonMaximaSuppression(const std::vector<cv::Rect>& pred_boxes, std::vector<cv::Rect>& final_boxes, float threshold) {
 
 	final_boxes.clear();
 
@@ -199,7 +401,7 @@ void Detector_Utils::nonMaximaSuppression(std::vector<cv::Rect> pred_boxes, std:
 		idxs.erase(last);
 
 		// loop over remaining boxes
-		for (auto i = std::begin(idxs); i != std::end(idxs); i++) {
+		for (auto i = std::begin(idxs); i != std::end(idxs);) {
 		
 			// consider current box and compute IoU
 			cv::Rect rect2 = pred_boxes[i->second];
@@ -209,7 +411,10 @@ void Detector_Utils::nonMaximaSuppression(std::vector<cv::Rect> pred_boxes, std:
 				
 				// suppress rect2 as non-maximum
 				i = idxs.erase(i);
-				i--;
+			}
+			else {
+
+				i++;
 			}
 		}
 		// rect1 is kept
@@ -219,7 +424,208 @@ void Detector_Utils::nonMaximaSuppression(std::vector<cv::Rect> pred_boxes, std:
 }
 
 
-void Detector_Utils::getMaxResponseIOU(std::vector<cv::Rect> rects, cv::Rect gt_box, float &max_iou, int &max_i) {
+void Detector_Utils::nonMaximaSuppression(const std::vector<cv::Rect>& pred_boxes, const std::vector<float>& pred_scores,
+										std::vector<int>& kept_idxs, std::vector<float>& kept_scores, float threshold,
+										float soft_sigma, float min_score) {
+
+	TRACE_SCOPE("nms");
+
+	CV_Assert(pred_scores.size() == pred_boxes.size());
+
+	kept_idxs.clear();
+	kept_scores.clear();
+
+	int n = (int)pred_boxes.size();
+
+	if (n == 0) {
+
+		return;
+	}
+
+	// spatial grid: each box is registered in all the cells it overlaps, so two boxes intersect only if they share
+	// a cell and only boxes sharing a cell are compared. Cells are as large as the average box
+	cv::Rect bounds = pred_boxes[0];
+	double mean_side = 0;
+
+	for (int i = 0; i < n; i++) {
+
+		bounds |= pred_boxes[i];
+		mean_side += std::max(pred_boxes[i].width, pred_boxes[i].height);
+	}
+
+	int cell_size = std::max(cvRound(mean_side / n), 1);
+	int grid_cols = bounds.width / cell_size + 1;
+	int grid_rows = bounds.height / cell_size + 1;
+
+	// cells spanned by each box
+	std::vector<cv::Rect> spans(n);
+	// boxes of each cell, stored contiguously (compressed rows)
+	std::vector<int> cell_start(grid_cols * grid_rows + 1, 0);
+	std::vector<int> cell_boxes;
+
+	for (int pass = 0; pass < 2; pass++) {
+
+		std::vector<int> fill;
+
+		if (pass == 1) {
+
+			for (int c = 0; c < grid_cols * grid_rows; c++) {
+
+				cell_start[c + 1] += cell_start[c];
+			}
+
+			cell_boxes.resize(cell_start.back());
+			fill.assign(cell_start.begin(), cell_start.end() - 1);
+		}
+
+		for (int i = 0; i < n; i++) {
+
+			const cv::Rect& box = pred_boxes[i];
+			int x1 = (box.x - bounds.x) / cell_size;
+			int y1 = (box.y - bounds.y) / cell_size;
+			int x2 = (box.x + std::max(box.width - 1, 0) - bounds.x) / cell_size;
+			int y2 = (box.y + std::max(box.height - 1, 0) - bounds.y) / cell_size;
+			spans[i] = cv::Rect(x1, y1, x2 - x1 + 1, y2 - y1 + 1);
+
+			for (int cy = y1; cy <= y2; cy++) {
+
+				for (int cx = x1; cx <= x2; cx++) {
+
+					if (pass == 0) {
+
+						cell_start[cy * grid_cols + cx + 1]++;
+					}
+					else {
+
+						cell_boxes[fill[cy * grid_cols + cx]++] = i;
+					}
+				}
+			}
+		}
+	}
+
+	// visits the boxes sharing a cell with box i, each one once
+	std::vector<int> stamp(n, -1);
+
+	auto forNeighbours = [&](int i, const std::function<void(int)>& visit) {
+
+		const cv::Rect& span = spans[i];
+
+		for (int cy = span.y; cy < span.y + span.height; cy++) {
+
+			for (int cx = span.x; cx < span.x + span.width; cx++) {
+
+				int c = cy * grid_cols + cx;
+
+				for (int k = cell_start[c]; k < cell_start[c + 1]; k++) {
+
+					int j = cell_boxes[k];
+
+					if (stamp[j] != i) {
+
+						stamp[j] = i;
+						visit(j);
+					}
+				}
+			}
+		}
+	};
+
+	// true once a box has been kept or suppressed
+	std::vector<char> done(n, 0);
+
+	if (soft_sigma <= 0) {
+
+		// visit boxes in decreasing order of score: each kept box suppresses the overlapping boxes with lower score
+		std::vector<int> order(n);
+
+		for (int i = 0; i < n; i++) {
+
+			order[i] = i;
+		}
+
+		std::stable_sort(order.begin(), order.end(), [&pred_scores](int a, int b) { return pred_scores[a] > pred_scores[b]; });
+
+		for (int k = 0; k < n; k++) {
+
+			int i = order[k];
+
+			if (done[i]) {
+
+				continue;
+			}
+
+			done[i] = 1;
+			kept_idxs.push_back(i);
+			kept_scores.push_back(pred_scores[i]);
+
+			forNeighbours(i, [&](int j) {
+
+				if (!done[j] && intersectionOverUnion(pred_boxes[i], pred_boxes[j]) > threshold) {
+
+					// suppress box j as non-maximum
+					done[j] = 1;
+				}
+			});
+		}
+
+		return;
+	}
+
+	// soft-NMS (Bodla et al., "Soft-NMS: improving object detection with one line of code", ICCV 2017):
+	// instead of being suppressed, the boxes overlapping a kept box have their score decayed by exp(-iou^2 / sigma),
+	// and are dropped once their score is lower than min_score. The box with the highest current score is taken from
+	// a heap; entries made stale by a decay are skipped
+	std::vector<float> scores(pred_scores);
+	std::priority_queue<std::pair<float, int>> heap;
+
+	for (int i = 0; i < n; i++) {
+
+		heap.push(std::make_pair(scores[i], -i));
+	}
+
+	while (!heap.empty()) {
+
+		std::pair<float, int> top = heap.top();
+		heap.pop();
+
+		// ties are broken by index, as in hard NMS
+		int i = -top.second;
+
+		if (done[i] || top.first != scores[i]) {
+
+			continue;
+		}
+
+		if (scores[i] < min_score) {
+
+			break;
+		}
+
+		done[i] = 1;
+		kept_idxs.push_back(i);
+		kept_scores.push_back(scores[i]);
+
+		forNeighbours(i, [&](int j) {
+
+			if (done[j]) {
+
+				return;
+			}
+
+			float iou = intersectionOverUnion(pred_boxes[i], pred_boxes[j]);
+
+			if (iou > 0) {
+
+				scores[j] *= std::exp(-iou * iou / soft_sigma);
+				heap.push(std::make_pair(scores[j], -j));
+			}
+		});
+	}
+}
+
+
+void Detector_Utils::getMaxResponseIOU(const std::vector<cv::Rect>& rects, const cv::Rect& gt_box, float &max_iou, int &max_i) {
 
 	max_iou = 0;
 	max_i = 0;
@@ -1,4 +1,7 @@
+#pragma once
+
 #include <iostream>
+#include <map>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
@@ -13,6 +16,15 @@ class Detector_Utils {
 
 public:
 
+	// CLAHE settings of processPatches and processImage (clip limit, tiles per side)
+	static const int CLAHE_CLIP_LIMIT = 40;
+	static const int CLAHE_GRID_SIZE = 8;
+
+	// proposals computed on each image by the dataset preparation, and negative patches taken among them
+	static const int DATASET_MAX_PROPOSALS = 2000;
+	static const int DATASET_NEGATIVES = 4;
+
+
 	/*
 	* Function to load files from a specified directory. 
 	* 
@@ -23,7 +35,7 @@ public:
 	* @return int						Retuns -1 if file loading encountered errors or if there were not files
 	*									having the specified formats in the given directory. Returns 0 otherwise.
 	*/
-	static int loadFiles(cv::String path, std::vector<cv::String> pattern, std::vector<cv::String> &filenames);
+	static int loadFiles(const cv::String& path, const std::vector<cv::String>& pattern, std::vector<cv::String> &filenames);
 
 	
 	/*
@@ -35,7 +47,7 @@ public:
 	* 
 	* @return cv::String				Image name.
 	*/
-	static cv::String getImageName(cv::String filename, cv::String dir_path, cv::String ext);
+	static cv::String getImageName(const cv::String& filename, const cv::String& dir_path, const cv::String& ext);
 
 	
 	/*
@@ -48,7 +60,7 @@ public:
 	* 
 	* @return std::vector<cv::Rect>		Returns vector of rects corresponding to ground truth boxes.
 	*/
-	static std::vector<cv::Rect> getGroundTruth(cv::String filename);
+	static std::vector<cv::Rect> getGroundTruth(const cv::String& filename);
 
 	
 	/*
@@ -65,23 +77,46 @@ public:
 	
 	/*
 	* Function to extract patches from a given image.
+	* Patches are views on the image (no pixel is copied), valid as long as the image is.
 	* 
 	* @param rects			Rectangles which represent the patches contours.
 	* @param image			Image to crop.
 	* @param &patches		Patches cropped from the given image.
 	*/
-	static void getPatches(std::vector<cv::Rect> rects, cv::Mat image, std::vector<cv::Mat>& patches);
+	static void getPatches(const std::vector<cv::Rect>& rects, const cv::Mat& image, std::vector<cv::Mat>& patches);
 
 
 	/*
 	* Function to process patches.
-	* Converts to grayscale and applies CLAHE equalization.
+	* Converts to grayscale (unless already grayscale) and applies CLAHE equalization.
+	* Processed patches are new buffers, the image the patches are cropped from is left untouched.
 	* 
 	* @param &patches		Patches to process.
 	*/
 	static void processPatches(std::vector<cv::Mat>& patches);
 
 
+	/*
+	* Function to extract and process patches from a grayscale image, converted once for all its patches.
+	* Gives the same result as getPatches followed by processPatches on the BGR image.
+	* 
+	* @param gray			Grayscale image.
+	* @param rects			Rectangles which represent the patches contours.
+	* @param &patches		Processed patches.
+	*/
+	static void processPatches(const cv::Mat& gray, const std::vector<cv::Rect>& rects, std::vector<cv::Mat>& patches);
+
+
+	/*
+	* Function to process a whole image the same way patches are processed.
+	* Converts to grayscale (unless already grayscale) and applies CLAHE equalization.
+	* 
+	* @param image			Image to process.
+	* @param &processed		Processed image.
+	*/
+	static void processImage(const cv::Mat& image, cv::Mat& processed);
+
+
 	/*
 	* Function to save the image patches to a specified path.
 	* 
@@ -89,21 +124,99 @@ public:
 	* @param image_name		Name of the image the provided patches are created from. Used to give a unique name to each patch.
 	* @param patches_path	Path for the saved patches.
 	*/
-	static void savePatches(std::vector<cv::Mat> patches, cv::String image_name, cv::String patches_path);
+	static void savePatches(const std::vector<cv::Mat>& patches, const cv::String& image_name, const cv::String& patches_path);
+
+
+	/*
+	* Function to get the path a patch is saved to by savePatches.
+	*
+	* @param patches_path	Path for the saved patches.
+	* @param image_name		Name of the image the patch is created from.
+	* @param i				Index of the patch among the patches of the image.
+	*
+	* @return cv::String	Path of the patch.
+	*/
+	static cv::String getPatchPath(const cv::String& patches_path, const cv::String& image_name, int i);
+
+
+	/*
+	* Function to get the path of the file listing the region of each patch in its image (see savePatchRegions).
+	*
+	* @param patches_path	Path for the saved patches.
+	*
+	* @return cv::String	Path of the file of the regions.
+	*/
+	static cv::String getPatchRegionsPath(const cv::String& patches_path);
+
+
+	/*
+	* Function to save the region each patch was cropped from, one line per patch: name (without extension), x, y,
+	* width and height.
+	*
+	* @param filename		Path of the file (see getPatchRegionsPath).
+	* @param names			Names of the patches (e.g. image0001_0).
+	* @param rects			Region of each patch in its image.
+	*
+	* @return bool			Returns false if the file could not be written.
+	*/
+	static bool savePatchRegions(const cv::String& filename, const std::vector<cv::String>& names, const std::vector<cv::Rect>& rects);
+
+
+	/*
+	* Function to load the regions saved with savePatchRegions.
+	*
+	* @param filename		Path of the file.
+	* @param &regions		Region of each patch, by name of the patch.
+	*
+	* @return bool			Returns false if the file could not be read.
+	*/
+	static bool loadPatchRegions(const cv::String& filename, std::map<cv::String, cv::Rect>& regions);
 
 
 	/*
 	* Function to run selective search algorithm on a image and get up to a given number of proposed regions.
+	* The cost of selective search grows quickly with the number of pixels, so the image can be downscaled before
+	* segmentation: regions are then mapped back to the coordinates of the original image. Only regions with an area
+	* greater than 1000 pixels (in the original image) are returned.
 	* 
 	* @param image			Image on which selective search is run.
 	* @param ss				Pointer to a selective seach segmentation object.
 	* @param max_n			Maximum number of proposals to return.
+	* @param max_side		If greater than 0, the image is downscaled so that its longest side is at most max_side pixels.
+	* @param scale			Scale factor applied to the image before segmentation (at most 1).
+	*						If max_side is also given, the smaller of the two scale factors is used.
 	* 
 	* @return std::vector<cv::Rect> Returns a vector containing up to max_n regions extracted from the provided image
 	*								using selective search segmentation.
 	*/
-	static std::vector<cv::Rect> getProposals(cv::Mat image,
-											cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentation> ss, int max_n);
+	static std::vector<cv::Rect> getProposals(const cv::Mat& image,
+											const cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentation>& ss, int max_n,
+											int max_side = 0, double scale = 1.0);
+
+
+	/*
+	* Function to compute the scale factor getProposals applies to an image before segmentation.
+	* 
+	* @param size			Size of the image.
+	* @param max_side		If greater than 0, maximum length of the longest side of the downscaled image.
+	* @param scale			Requested scale factor.
+	* 
+	* @return double		Scale factor, in (0, 1].
+	*/
+	static double getProposalsScale(cv::Size size, int max_side, double scale);
+
+
+	/*
+	* Function to describe the parameters getProposals runs with, used to key cached proposals (see Proposal_Cache).
+	* It must change whenever getProposals would return different regions for the same image.
+	* 
+	* @param max_n			Maximum number of proposals to return.
+	* @param max_side		Maximum length of the longest side of the segmented image (0: no limit).
+	* @param scale			Scale factor applied to the image before segmentation.
+	* 
+	* @return cv::String	Description of the parameters.
+	*/
+	static cv::String getProposalsKey(int max_n, int max_side = 0, double scale = 1.0);
 
 
 	/*
@@ -117,6 +230,30 @@ public:
 	*/
 	static float intersectionOverUnion(cv::Rect rect1, cv::Rect rect2);
 
+
+	/*
+	* Function to compute a percentile of a set of values (e.g. latencies), with the nearest rank method: the smallest
+	* value such that a fraction p of the values is lower or equal.
+	*
+	* @param values			Values (copied, since they are partially sorted).
+	* @param p				Percentile, between 0 and 1.
+	*
+	* @return double		Value at the given percentile (0 if there is no value).
+	*/
+	static double percentile(std::vector<double> values, double p);
+
+
+	/*
+	* Function to select the negative patches of an image: the first proposals which do not overlap the ground truth.
+	*
+	* @param proposals		Proposed regions, in the order of the proposal engine.
+	* @param ground_truth	Ground truth boxes of the image.
+	* @param max_n			Maximum number of negatives.
+	* @param &negatives		Selected regions.
+	*/
+	static void getNegativeRects(const std::vector<cv::Rect>& proposals, const std::vector<cv::Rect>& ground_truth, int max_n,
+								std::vector<cv::Rect>& negatives);
+
 	
 	/*
 	* Function to apply non-maxima suppression to a set of bounding boxes, without prediction confidence values.
@@ -129,7 +266,29 @@ public:
 	* @param threshold		Threshold value for the non-maxima suppression. If overlap between two boxes is greater than such value, 
 	*						one of the two is suppressed.
 	*/
-	static void nonMaximaSuppression(std::vector<cv::Rect> pred_boxes, std::vector<cv::Rect>& final_boxes, float threshold);
+	static void nonMaximaSuppression(const std::vector<cv::Rect>& pred_boxes, std::vector<cv::Rect>& final_boxes, float threshold);
+
+
+	/*
+	* Function to apply non-maxima suppression to a set of bounding boxes with prediction confidence values.
+	* Boxes are visited in decreasing order of score, and each kept box suppresses the boxes with lower score
+	* overlapping it by more than threshold. Boxes are bucketed in a spatial grid, so only boxes close to each other
+	* are compared.
+	* With soft-NMS (soft_sigma > 0), the boxes overlapping a kept box are not suppressed: their score is multiplied
+	* by exp(-iou^2 / soft_sigma), and boxes whose score falls below min_score are dropped.
+	* 
+	* @param pred_boxes		Set of all the bounding boxes obtained for an image.
+	* @param pred_scores	Score of each box (the higher, the more confident).
+	* @param &kept_idxs		Index in pred_boxes of the kept boxes, in the order they are kept.
+	* @param &kept_scores	Score of each kept box (decayed by soft-NMS).
+	* @param threshold		Threshold value for the non-maxima suppression. If overlap between two boxes is greater than such value, 
+	*						the one with lower score is suppressed. Not used by soft-NMS.
+	* @param soft_sigma		If greater than 0, soft-NMS is applied with the given Gaussian decay.
+	* @param min_score		Minimum score of the boxes kept by soft-NMS.
+	*/
+	static void nonMaximaSuppression(const std::vector<cv::Rect>& pred_boxes, const std::vector<float>& pred_scores,
+									std::vector<int>& kept_idxs, std::vector<float>& kept_scores, float threshold,
+									float soft_sigma = 0.0f, float min_score = 0.0f);
 
 
 	/*
@@ -140,8 +299,12 @@ public:
 	* @param &max_iou		Maximum intersection over union obtained for the provided ground truth box.
 	* @param &max_i			Index of the box which gives the maximum intersection over union.
 	*/
-	static void getMaxResponseIOU(std::vector<cv::Rect> rects, cv::Rect gt_box, float &max_iou, int &max_i);
+	static void getMaxResponseIOU(const std::vector<cv::Rect>& rects, const cv::Rect& gt_box, float &max_iou, int &max_i);
+
+private:
 
+	// CLAHE object used by processPatches and processImage, one per thread
+	static cv::CLAHE& getCLAHE();
 };
 
 
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+#include "Detector_Utils.h"
+#include "Edge_Density_Generator.h"
+#include "Trace.h"
+
+namespace {
+
+	// number of edge pixels inside a rectangle, from the integral image of the edge map
+	inline int sumRect(const cv::Mat& integral, const cv::Rect& rect) {
+
+		return integral.at<int>(rect.y, rect.x) + integral.at<int>(rect.y + rect.height, rect.x + rect.width)
+			- integral.at<int>(rect.y, rect.x + rect.width) - integral.at<int>(rect.y + rect.height, rect.x);
+	}
+}
+
+
+Edge_Density_Generator::Edge_Density_Generator(int max_n, int max_side, double scale, int min_side, double scale_step,
+											double stride) : max_n(max_n), max_side(max_side), scale(scale), min_side(min_side),
+	scale_step(scale_step), stride(stride) {
+
+}
+
+
+void Edge_Density_Generator::generate(const cv::Mat& image, std::vector<cv::Rect>& proposals) const {
+
+	TRACE_SCOPE("edge_density_proposals");
+
+	proposals.clear();
+
+	// detect edges on a (possibly downscaled) grayscale copy of the image
+	double factor = Detector_Utils::getProposalsScale(image.size(), max_side, scale);
+	cv::Mat gray, edges, integral;
+
+	cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+
+	if (factor < 1.0) {
+
+		cv::resize(gray, gray, cv::Size(), factor, factor, cv::INTER_AREA);
+	}
+
+	cv::Canny(gray, edges, 50, 150);
+	cv::threshold(edges, edges, 0, 1, cv::THRESH_BINARY);
+	cv::integral(edges, integral, CV_32S);
+
+	cv::Rect image_rect(0, 0, gray.cols, gray.rows);
+
+	std::vector<cv::Size> sizes;
+	getWindowSizes(gray.size(), std::max(cvRound(min_side * factor), 8), scale_step, sizes);
+
+	// windows which score higher than their neighbours, with their score
+	std::vector<std::pair<float, cv::Rect>> candidates;
+
+	for (int k = 0; k < sizes.size(); k++) {
+
+		const cv::Size& size = sizes[k];
+		int step_x = std::max(cvRound(size.width * stride), 1);
+		int step_y = std::max(cvRound(size.height * stride), 1);
+		int n_x = (gray.cols - size.width) / step_x + 1;
+		int n_y = (gray.rows - size.height) / step_y + 1;
+
+		// score every window of this size
+		cv::Mat scores(n_y, n_x, CV_32F);
+
+		for (int j = 0; j < n_y; j++) {
+
+			float* row = scores.ptr<float>(j);
+
+			for (int i = 0; i < n_x; i++) {
+
+				cv::Rect window(i * step_x, j * step_y, size.width, size.height);
+
+				// surrounding ring, a quarter of the window size on each side
+				int pad_x = size.width / 4;
+				int pad_y = size.height / 4;
+				cv::Rect outer = cv::Rect(window.x - pad_x, window.y - pad_y, window.width + 2 * pad_x,
+										window.height + 2 * pad_y) & image_rect;
+
+				int inner_edges = sumRect(integral, window);
+				int ring_edges = sumRect(integral, outer) - inner_edges;
+				int ring_area = outer.area() - window.area();
+
+				float inner_density = (float)inner_edges / window.area();
+				float ring_density = ring_area > 0 ? (float)ring_edges / ring_area : 0.0f;
+
+				row[i] = inner_density - ring_density;
+			}
+		}
+
+		// keep the local maxima
+		for (int j = 0; j < n_y; j++) {
+
+			for (int i = 0; i < n_x; i++) {
+
+				float score = scores.at<float>(j, i);
+				bool maximum = score > 0;
+
+				for (int dj = -1; dj <= 1 && maximum; dj++) {
+
+					for (int di = -1; di <= 1 && maximum; di++) {
+
+						int nj = j + dj, ni = i + di;
+
+						if ((dj || di) && nj >= 0 && nj < n_y && ni >= 0 && ni < n_x && scores.at<float>(nj, ni) > score) {
+
+							maximum = false;
+						}
+					}
+				}
+
+				if (maximum) {
+
+					candidates.push_back(std::make_pair(score, cv::Rect(i * step_x, j * step_y, size.width, size.height)));
+				}
+			}
+		}
+	}
+
+	// best windows first
+	std::stable_sort(candidates.begin(), candidates.end(),
+		[](const std::pair<float, cv::Rect>& a, const std::pair<float, cv::Rect>& b) { return a.first > b.first; });
+
+	cv::Rect original_rect(0, 0, image.cols, image.rows);
+
+	for (int k = 0; k < candidates.size() && proposals.size() < max_n; k++) {
+
+		cv::Rect rect = candidates[k].second;
+
+		if (factor < 1.0) {
+
+			// map the window back to the original image
+			int x1 = cvFloor(rect.x / factor);
+			int y1 = cvFloor(rect.y / factor);
+			int x2 = cvCeil(rect.br().x / factor);
+			int y2 = cvCeil(rect.br().y / factor);
+
+			rect = cv::Rect(x1, y1, x2 - x1, y2 - y1) & original_rect;
+		}
+
+		// consider only windows with significative area (in the original image)
+		if (rect.area() > 1000) {
+
+			proposals.push_back(rect);
+		}
+	}
+}
+
+
+cv::String Edge_Density_Generator::getKey() const {
+
+	return cv::format("edges;max_n=%d;max_side=%d;scale=%g;min_side=%d;scale_step=%g;stride=%g", max_n, max_side, scale,
+					min_side, scale_step, stride);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Proposal_Generator.h"
+
+/*
+* Proposal generator ranking sliding windows by a cheap objectness score based on edges.
+*
+* Edges are detected once per image (Canny, optionally on a downscaled copy) and accumulated in an integral image,
+* so the number of edge pixels inside any window costs four lookups. The score of a window is its edge density minus
+* the edge density of the ring surrounding it: boats are richer in edges than the water or sky around them.
+* Only windows scoring higher than their neighbours (same size, adjacent positions) are kept, and the best max_n are
+* proposed.
+*/
+
+class Edge_Density_Generator : public Proposal_Generator {
+
+public:
+
+	/*
+	* Constructor.
+	*
+	* @param max_n			Maximum number of proposals per image.
+	* @param max_side		If greater than 0, edges are detected on a copy of the image whose longest side is at most
+	*						max_side pixels.
+	* @param scale			Scale factor applied to images before detecting edges.
+	* @param min_side		Shortest side (in pixels of the original image) of the smallest windows.
+	* @param scale_step		Ratio between the sizes of consecutive pyramid levels.
+	* @param stride			Step between two windows, as a fraction of the window size.
+	*/
+	Edge_Density_Generator(int max_n, int max_side = 0, double scale = 1.0, int min_side = 48, double scale_step = 1.25,
+						double stride = 0.25);
+
+	void generate(const cv::Mat& image, std::vector<cv::Rect>& proposals) const override;
+
+	cv::String getKey() const override;
+
+private:
+
+	int max_n;
+	int max_side;
+	double scale;
+	int min_side;
+	double scale_step;
+	double stride;
+};
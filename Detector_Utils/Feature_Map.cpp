@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Feature_Map.h"
+
+bool Feature_Map::parse(const cv::String& name, Type& type) {
+
+	if (name == "none") {
+
+		type = NONE;
+	}
+	else if (name == "hellinger") {
+
+		type = HELLINGER;
+	}
+	else if (name == "chi2") {
+
+		type = CHI2;
+	}
+	else {
+
+		return false;
+	}
+
+	return true;
+}
+
+
+cv::String Feature_Map::getName(Type type) {
+
+	switch (type) {
+
+	case HELLINGER:
+		return "hellinger";
+	case CHI2:
+		return "chi2";
+	default:
+		return "none";
+	}
+}
+
+
+int Feature_Map::getMappedSize(int dims, Type type, int order) {
+
+	return type == CHI2 ? dims * (2 * order + 1) : dims;
+}
+
+
+void Feature_Map::apply(const cv::Mat& samples, cv::Mat& mapped, Type type, int order) {
+
+	CV_Assert(samples.empty() || samples.type() == CV_32F);
+
+	if (type == NONE) {
+
+		mapped = samples;
+		return;
+	}
+
+	if (type == HELLINGER) {
+
+		cv::sqrt(samples, mapped);
+		return;
+	}
+
+	// chi-squared homogeneous kernel map
+	// the spectrum of the chi-squared kernel is kappa(lambda) = sech(pi * lambda); it is sampled with period L
+	// (the value suggested by VLFeat for the given order), giving for each bin x > 0
+	// psi_0(x) = sqrt(x L kappa(0))
+	// psi_2j-1(x) = sqrt(2 x L kappa(jL)) cos(jL log x),  psi_2j(x) = sqrt(2 x L kappa(jL)) sin(jL log x)
+	const double pi = 3.14159265358979323846;
+	double period = 2 * pi / (5.86 * std::sqrt((double)order) + 3.65);
+
+	std::vector<double> scale(order + 1);
+
+	for (int j = 0; j <= order; j++) {
+
+		double kappa = 1.0 / std::cosh(pi * j * period);
+		scale[j] = (j == 0 ? 1.0 : 2.0) * period * kappa;
+	}
+
+	// keep a reference to the input, in case mapped and samples are the same matrix
+	cv::Mat input = samples;
+	int width = 2 * order + 1;
+	mapped.create(input.rows, input.cols * width, CV_32F);
+
+	for (int i = 0; i < input.rows; i++) {
+
+		const float* in = input.ptr<float>(i);
+		float* out = mapped.ptr<float>(i);
+
+		for (int k = 0; k < input.cols; k++, out += width) {
+
+			double x = in[k];
+
+			if (x <= 0) {
+
+				std::fill(out, out + width, 0.0f);
+				continue;
+			}
+
+			double log_x = std::log(x);
+			out[0] = (float)std::sqrt(x * scale[0]);
+
+			for (int j = 1; j <= order; j++) {
+
+				double magnitude = std::sqrt(x * scale[j]);
+				out[2 * j - 1] = (float)(magnitude * std::cos(j * period * log_x));
+				out[2 * j] = (float)(magnitude * std::sin(j * period * log_x));
+			}
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+/*
+* Class of static functions implementing explicit feature maps for bag of words histograms.
+*
+* An explicit feature map psi approximates an additive kernel with a dot product, K(x, y) ~ psi(x).psi(y), so that
+* a linear SVM trained on mapped histograms behaves like a kernel SVM, while prediction costs a single dot product.
+*
+* - HELLINGER: psi(x) = sqrt(x), exact map of the Hellinger (Bhattacharyya) kernel sum_i sqrt(x_i * y_i).
+* - CHI2: homogeneous kernel map of the chi-squared kernel sum_i 2 x_i y_i / (x_i + y_i) (Vedaldi and Zisserman,
+*   "Efficient additive kernels via explicit feature maps", PAMI 2012). Each bin is mapped to 2 * order + 1 values.
+*/
+
+class Feature_Map {
+
+public:
+
+	enum Type { NONE, HELLINGER, CHI2 };
+
+
+	/*
+	* Function to parse the name of a feature map.
+	*
+	* @param name			Name of the feature map (none, hellinger or chi2).
+	* @param &type			Parsed feature map.
+	*
+	* @return bool			Returns false if name is not a known feature map.
+	*/
+	static bool parse(const cv::String& name, Type& type);
+
+
+	/*
+	* @param type			Feature map.
+	*
+	* @return cv::String	Name of the feature map.
+	*/
+	static cv::String getName(Type type);
+
+
+	/*
+	* Function to compute the size of mapped samples.
+	*
+	* @param dims			Size of the samples to map.
+	* @param type			Feature map.
+	* @param order			Approximation order of the chi-squared map.
+	*
+	* @return int			Size of the mapped samples.
+	*/
+	static int getMappedSize(int dims, Type type, int order = 1);
+
+
+	/*
+	* Function to map a set of (non-negative) samples.
+	*
+	* @param samples		CV_32F samples, one per row.
+	* @param &mapped		CV_32F mapped samples, one per row. For NONE, it shares data with samples.
+	* @param type			Feature map.
+	* @param order			Approximation order of the chi-squared map.
+	*/
+	static void apply(const cv::Mat& samples, cv::Mat& mapped, Type type, int order = 1);
+};
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include "Keypoint_Map.h"
+
+Keypoint_Map::Keypoint_Map(int cell_size) : cell_size(std::max(cell_size, 1)), grid_cols(0), grid_rows(0) {
+
+}
+
+
+void Keypoint_Map::build(const std::vector<cv::KeyPoint>& keypoints, const std::vector<int>& words, cv::Size image_size) {
+
+	CV_Assert(keypoints.size() == words.size());
+
+	grid_cols = std::max((image_size.width + cell_size - 1) / cell_size, 1);
+	grid_rows = std::max((image_size.height + cell_size - 1) / cell_size, 1);
+
+	int n_cells = grid_cols * grid_rows;
+	std::vector<int> cells(keypoints.size());
+
+	// counting sort of the keypoints according to the cell they fall in
+	cell_start.assign(n_cells + 1, 0);
+
+	for (size_t i = 0; i < keypoints.size(); i++) {
+
+		int x = std::min(std::max(cvFloor(keypoints[i].pt.x), 0), image_size.width - 1);
+		int y = std::min(std::max(cvFloor(keypoints[i].pt.y), 0), image_size.height - 1);
+
+		cells[i] = (y / cell_size) * grid_cols + x / cell_size;
+		cell_start[cells[i] + 1]++;
+	}
+
+	for (int c = 0; c < n_cells; c++) {
+
+		cell_start[c + 1] += cell_start[c];
+	}
+
+	points.resize(keypoints.size());
+	point_words.resize(keypoints.size());
+	std::vector<int> next(cell_start.begin(), cell_start.end() - 1);
+
+	for (size_t i = 0; i < keypoints.size(); i++) {
+
+		int pos = next[cells[i]]++;
+		points[pos] = cv::Point(cvFloor(keypoints[i].pt.x), cvFloor(keypoints[i].pt.y));
+		point_words[pos] = words[i];
+	}
+}
+
+
+void Keypoint_Map::getWords(cv::Rect rect, std::vector<int>& words) const {
+
+	getWords(rect, cv::Rect(), words);
+}
+
+
+void Keypoint_Map::getWords(cv::Rect rect, cv::Rect skip_cells, std::vector<int>& words) const {
+
+	words.clear();
+
+	if (rect.width <= 0 || rect.height <= 0 || points.empty()) {
+
+		return;
+	}
+
+	// range of cells overlapped by the rectangle
+	int c0 = std::max(rect.x / cell_size, 0);
+	int r0 = std::max(rect.y / cell_size, 0);
+	int c1 = std::min((rect.x + rect.width - 1) / cell_size, grid_cols - 1);
+	int r1 = std::min((rect.y + rect.height - 1) / cell_size, grid_rows - 1);
+
+	for (int r = r0; r <= r1; r++) {
+
+		for (int c = c0; c <= c1; c++) {
+
+			if (skip_cells.contains(cv::Point(c, r))) {
+
+				continue;
+			}
+
+			int cell = r * grid_cols + c;
+
+			for (int k = cell_start[cell]; k < cell_start[cell + 1]; k++) {
+
+				if (rect.contains(points[k])) {
+
+					words.push_back(point_words[k]);
+				}
+			}
+		}
+	}
+}
+
+
+int Keypoint_Map::computeHistogram(cv::Rect rect, int n_words, cv::Mat& histogram) const {
+
+	std::vector<int> words;
+	getWords(rect, words);
+
+	if (words.empty()) {
+
+		histogram.release();
+		return 0;
+	}
+
+	histogram = cv::Mat::zeros(1, n_words, CV_32F);
+	float* bins = histogram.ptr<float>();
+
+	for (size_t i = 0; i < words.size(); i++) {
+
+		bins[words[i]] += 1.0f;
+	}
+
+	// normalize by the number of keypoints, as cv::BOWImgDescriptorExtractor does
+	histogram /= (double)words.size();
+
+	return (int)words.size();
+}
+
+
+int Keypoint_Map::size() const {
+
+	return (int)points.size();
+}
+
+
+int Keypoint_Map::getCellSize() const {
+
+	return cell_size;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+
+/*
+* Spatial index of the keypoints detected on a whole image.
+*
+* Each keypoint is stored together with the id of the visual word it has been assigned to. Keypoints are
+* bucketed in a regular grid of square cells, so that the keypoints falling inside a given rectangle can be
+* retrieved visiting only the cells the rectangle overlaps.
+* This allows to compute SIFT descriptors (and codeword assignments) once per image and then build the
+* bag-of-words histogram of every proposed region querying the index.
+*/
+
+class Keypoint_Map {
+
+public:
+
+	/*
+	* Constructor.
+	*
+	* @param cell_size		Side (in pixels) of the grid cells used to bucket the keypoints.
+	*/
+	Keypoint_Map(int cell_size = 32);
+
+
+	/*
+	* Function to build the index from the keypoints detected on an image.
+	*
+	* @param keypoints		Keypoints detected on the image.
+	* @param words			Visual word assigned to each keypoint (words[i] is the codeword of keypoints[i]).
+	* @param image_size		Size of the image the keypoints were detected on.
+	*/
+	void build(const std::vector<cv::KeyPoint>& keypoints, const std::vector<int>& words, cv::Size image_size);
+
+
+	/*
+	* Function to collect the visual words of the keypoints falling inside a rectangle.
+	* A keypoint belongs to the rectangle if the pixel containing its location does.
+	*
+	* @param rect			Query rectangle (image coordinates).
+	* @param &words			Visual words of the keypoints inside rect.
+	*/
+	void getWords(cv::Rect rect, std::vector<int>& words) const;
+
+
+	/*
+	* Function to collect the visual words of the keypoints falling inside a rectangle, skipping a block of
+	* grid cells whose keypoints are accounted for elsewhere (e.g. by a summed-area table).
+	*
+	* @param rect			Query rectangle (image coordinates).
+	* @param skip_cells		Block of cells to skip, in cell units (column, row, number of columns, number of rows).
+	* @param &words			Visual words of the keypoints inside rect and outside skip_cells.
+	*/
+	void getWords(cv::Rect rect, cv::Rect skip_cells, std::vector<int>& words) const;
+
+
+	/*
+	* Function to compute the bag of words descriptor of a rectangle, i.e. the normalized histogram of the
+	* visual words of the keypoints falling inside it. Gives the same kind of descriptor computed by
+	* cv::BOWImgDescriptorExtractor on the SIFT descriptors of a patch.
+	*
+	* @param rect			Query rectangle (image coordinates).
+	* @param n_words		Number of codewords of the vocabulary.
+	* @param &histogram		1 x n_words CV_32F normalized histogram. Released if no keypoint falls inside rect.
+	*
+	* @return int			Number of keypoints inside rect.
+	*/
+	int computeHistogram(cv::Rect rect, int n_words, cv::Mat& histogram) const;
+
+
+	/*
+	* @return int			Number of indexed keypoints.
+	*/
+	int size() const;
+
+
+	/*
+	* @return int			Side (in pixels) of the grid cells.
+	*/
+	int getCellSize() const;
+
+private:
+
+	// side of the grid cells
+	int cell_size;
+
+	// number of grid columns and rows
+	int grid_cols;
+	int grid_rows;
+
+	// keypoints of cell c are points[cell_start[c]] ... points[cell_start[c + 1] - 1]
+	std::vector<int> cell_start;
+
+	// pixel locations of the keypoints, sorted by cell
+	std::vector<cv::Point> points;
+
+	// visual words of the keypoints, sorted by cell
+	std::vector<int> point_words;
+};
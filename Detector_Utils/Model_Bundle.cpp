@@ -0,0 +1,269 @@
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "Detector_Utils.h"
+#include "Model_Bundle.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MODEL_BUNDLE_MMAP
+#endif
+
+namespace {
+
+	const char MAGIC[4] = { 'B', 'O', 'W', 'B' };
+	const uint32_t VERSION = 1;
+	const uint64_t ALIGNMENT = 64;
+
+	const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+	const uint64_t FNV_PRIME = 1099511628211ULL;
+
+	// header of a bundle, followed by the arrays at the given offsets
+	struct Bundle_Header {
+
+		char magic[4];
+		uint32_t version;
+		double gamma;
+		double rho;
+		double clahe_clip_limit;
+		uint64_t vocabulary_offset;
+		uint64_t sv_offset;
+		uint64_t alpha_offset;
+		uint64_t file_size;
+		uint64_t payload_hash;
+		int32_t kernel_type;
+		int32_t feature_map;
+		int32_t vocabulary_rows;
+		int32_t vocabulary_cols;
+		int32_t sv_rows;
+		int32_t sv_cols;
+		float positive_label;
+		float negative_label;
+		int32_t clahe_grid_size;
+		int32_t reserved;
+	};
+
+	uint64_t fnv1a(const void* data, size_t size, uint64_t hash) {
+
+		const unsigned char* bytes = (const unsigned char*)data;
+
+		for (size_t i = 0; i < size; i++) {
+
+			hash ^= bytes[i];
+			hash *= FNV_PRIME;
+		}
+
+		return hash;
+	}
+
+	uint64_t align(uint64_t offset) {
+
+		return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+
+	// check that an array of rows x cols floats lies inside the file
+	bool checkArray(uint64_t offset, int32_t rows, int32_t cols, uint64_t size) {
+
+		return rows >= 0 && cols >= 0 && offset % ALIGNMENT == 0 && offset <= size &&
+			(uint64_t)rows * cols * sizeof(float) <= size - offset;
+	}
+}
+
+
+Model_Bundle::Model_Bundle() : clahe_clip_limit(Detector_Utils::CLAHE_CLIP_LIMIT), clahe_grid_size(Detector_Utils::CLAHE_GRID_SIZE) {
+
+}
+
+
+bool Model_Bundle::set(const cv::Mat& vocabulary, const Batch_SVM& svm) {
+
+	int kernel_type;
+	double gamma, rho;
+	cv::Mat support_vectors, alpha;
+
+	if (vocabulary.empty() || !svm.getDecisionFunction(kernel_type, gamma, rho, support_vectors, alpha)) {
+
+		return false;
+	}
+
+	vocabulary.convertTo(this->vocabulary, CV_32F);
+	this->svm = svm;
+	clahe_clip_limit = Detector_Utils::CLAHE_CLIP_LIMIT;
+	clahe_grid_size = Detector_Utils::CLAHE_GRID_SIZE;
+
+	return true;
+}
+
+
+bool Model_Bundle::load(const cv::String& filename) {
+
+	std::string data;
+	const char* bytes = 0;
+	uint64_t size = 0;
+
+#ifdef MODEL_BUNDLE_MMAP
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd < 0) {
+
+		return false;
+	}
+
+	struct stat st;
+	void* mapped = MAP_FAILED;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+
+		mapped = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+
+	close(fd);
+
+	if (mapped == MAP_FAILED) {
+
+		return false;
+	}
+
+	bytes = (const char*)mapped;
+	size = st.st_size;
+#else
+	std::ifstream file(filename, std::ios::binary);
+
+	if (!file.is_open()) {
+
+		return false;
+	}
+
+	data.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	bytes = data.data();
+	size = data.size();
+#endif
+
+	Bundle_Header header;
+	bool valid = size >= sizeof(header);
+
+	if (valid) {
+
+		std::memcpy(&header, bytes, sizeof(header));
+
+		valid = !std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) && header.version == VERSION && header.file_size == size &&
+			(header.kernel_type == cv::ml::SVM::RBF || header.kernel_type == cv::ml::SVM::LINEAR) &&
+			header.feature_map >= Feature_Map::NONE && header.feature_map <= Feature_Map::CHI2 &&
+			header.vocabulary_rows > 0 && header.sv_rows > 0 &&
+			checkArray(header.vocabulary_offset, header.vocabulary_rows, header.vocabulary_cols, size) &&
+			checkArray(header.sv_offset, header.sv_rows, header.sv_cols, size) &&
+			checkArray(header.alpha_offset, header.sv_rows, 1, size) &&
+			header.vocabulary_offset >= sizeof(header) &&
+			fnv1a(bytes + header.vocabulary_offset, size - header.vocabulary_offset, FNV_OFFSET) == header.payload_hash;
+	}
+
+	if (valid) {
+
+		// arrays are copied out of the mapping, which is released below
+		cv::Mat(header.vocabulary_rows, header.vocabulary_cols, CV_32F, (void*)(bytes + header.vocabulary_offset)).copyTo(vocabulary);
+
+		cv::Mat support_vectors(header.sv_rows, header.sv_cols, CV_32F, (void*)(bytes + header.sv_offset));
+		cv::Mat alpha(header.sv_rows, 1, CV_32F, (void*)(bytes + header.alpha_offset));
+
+		svm.setDecisionFunction(header.kernel_type, header.gamma, header.rho, support_vectors, alpha,
+							header.positive_label, header.negative_label, (Feature_Map::Type)header.feature_map);
+
+		clahe_clip_limit = header.clahe_clip_limit;
+		clahe_grid_size = header.clahe_grid_size;
+	}
+
+#ifdef MODEL_BUNDLE_MMAP
+	munmap((void*)bytes, size);
+#endif
+
+	return valid;
+}
+
+
+bool Model_Bundle::save(const cv::String& filename) const {
+
+	int kernel_type;
+	double gamma, rho;
+	cv::Mat support_vectors, alpha;
+
+	if (vocabulary.empty() || !svm.getDecisionFunction(kernel_type, gamma, rho, support_vectors, alpha)) {
+
+		return false;
+	}
+
+	// arrays are stored contiguously, one after the other at aligned offsets
+	cv::Mat arrays[3] = { vocabulary.clone(), support_vectors.clone(), alpha.clone() };
+
+	Bundle_Header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.gamma = gamma;
+	header.rho = rho;
+	header.clahe_clip_limit = clahe_clip_limit;
+	header.kernel_type = kernel_type;
+	header.feature_map = svm.getFeatureMap();
+	header.vocabulary_rows = vocabulary.rows;
+	header.vocabulary_cols = vocabulary.cols;
+	header.sv_rows = support_vectors.rows;
+	header.sv_cols = support_vectors.cols;
+	header.positive_label = svm.getLabel(false);
+	header.negative_label = svm.getLabel(true);
+	header.clahe_grid_size = clahe_grid_size;
+
+	uint64_t* offsets[3] = { &header.vocabulary_offset, &header.sv_offset, &header.alpha_offset };
+	uint64_t offset = sizeof(header);
+
+	for (int i = 0; i < 3; i++) {
+
+		*offsets[i] = align(offset);
+		offset = *offsets[i] + arrays[i].total() * sizeof(float);
+	}
+
+	header.file_size = offset;
+
+	// payload, padding included, hashed as it is written
+	std::string payload(header.file_size - header.vocabulary_offset, '\0');
+
+	for (int i = 0; i < 3; i++) {
+
+		std::memcpy(&payload[*offsets[i] - header.vocabulary_offset], arrays[i].ptr(), arrays[i].total() * sizeof(float));
+	}
+
+	header.payload_hash = fnv1a(payload.data(), payload.size(), FNV_OFFSET);
+
+	std::ofstream file(filename, std::ios::binary);
+
+	if (!file.is_open()) {
+
+		return false;
+	}
+
+	std::string padding(header.vocabulary_offset - sizeof(header), '\0');
+	file.write((const char*)&header, sizeof(header));
+	file.write(padding.data(), padding.size());
+	file.write(payload.data(), payload.size());
+
+	return file.good();
+}
+
+
+const cv::Mat& Model_Bundle::getVocabulary() const {
+
+	return vocabulary;
+}
+
+
+const Batch_SVM& Model_Bundle::getSVM() const {
+
+	return svm;
+}
+
+
+bool Model_Bundle::matchesPreprocessing() const {
+
+	return clahe_clip_limit == Detector_Utils::CLAHE_CLIP_LIMIT && clahe_grid_size == Detector_Utils::CLAHE_GRID_SIZE;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+#include "Batch_SVM.h"
+
+/*
+* Single binary file holding everything the detector needs to classify proposals: vocabulary of visual words,
+* decision function of the SVM (kernel, gamma, rho, support vectors, coefficients, labels), feature map and
+* preprocessing settings (CLAHE clip limit and grid size the model was trained with).
+*
+* Parsing vocabulary.yml and svm.yml with cv::FileStorage takes seconds, as every number is stored as text.
+* A bundle is written by the training program next to the YAML files and read through a memory mapping where
+* available, so loading it costs little more than copying its arrays:
+*
+* - header: magic "BOWB", format version, scalar parameters, offset of each array, file size and FNV-1a hash of the
+*   arrays (native byte order)
+* - payload: vocabulary (rows x cols CV_32F), support vectors (rows x cols CV_32F), coefficients (rows CV_32F), each
+*   starting at a 64-byte aligned offset
+*
+* Only models evaluated by Batch_SVM as a blocked matrix computation (two classes, RBF or linear kernel) can be bundled.
+*/
+
+class Model_Bundle {
+
+public:
+
+	/*
+	* Constructor of an empty bundle.
+	*/
+	Model_Bundle();
+
+
+	/*
+	* Function to set the content of the bundle.
+	*
+	* @param vocabulary		Vocabulary of visual words, one per row.
+	* @param svm			Trained classifier.
+	*
+	* @return bool			Returns false if the decision function of svm cannot be bundled.
+	*/
+	bool set(const cv::Mat& vocabulary, const Batch_SVM& svm);
+
+
+	/*
+	* Function to load a bundle written by save.
+	*
+	* @param filename		Path to the bundle file.
+	*
+	* @return bool			Returns false if the file could not be read or is not a valid bundle.
+	*/
+	bool load(const cv::String& filename);
+
+
+	/*
+	* Function to save the bundle.
+	*
+	* @param filename		Path to the bundle file.
+	*
+	* @return bool			Returns false if the file could not be written.
+	*/
+	bool save(const cv::String& filename) const;
+
+
+	/*
+	* @return cv::Mat		Vocabulary of visual words, one per row.
+	*/
+	const cv::Mat& getVocabulary() const;
+
+
+	/*
+	* @return Batch_SVM		Trained classifier.
+	*/
+	const Batch_SVM& getSVM() const;
+
+
+	/*
+	* @return bool			Returns true if the CLAHE settings the model was trained with are the ones used by
+	*						Detector_Utils::processPatches and Detector_Utils::processImage.
+	*/
+	bool matchesPreprocessing() const;
+
+private:
+
+	cv::Mat vocabulary;
+	Batch_SVM svm;
+
+	// preprocessing settings the model was trained with
+	double clahe_clip_limit;
+	int clahe_grid_size;
+};
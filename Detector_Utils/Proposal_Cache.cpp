@@ -0,0 +1,235 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <opencv2/core/utils/filesystem.hpp>
+#include "Proposal_Cache.h"
+#include "Trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PROPOSAL_CACHE_MMAP
+#elif defined(_WIN32)
+#include <process.h>
+#endif
+
+namespace {
+
+	// id of the running process, so that runs sharing a cache directory never write the same temporary file
+	long getProcessId() {
+
+#if defined(PROPOSAL_CACHE_MMAP)
+		return (long)getpid();
+#elif defined(_WIN32)
+		return (long)_getpid();
+#else
+		return 0;
+#endif
+	}
+
+	const char MAGIC[4] = { 'B', 'P', 'R', 'C' };
+	const uint32_t VERSION = 1;
+
+	const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+	const uint64_t FNV_PRIME = 1099511628211ULL;
+
+	// header of a cache entry, followed by count rects stored as 4 int32 each
+	struct Entry_Header {
+
+		char magic[4];
+		uint32_t version;
+		uint64_t image_hash;
+		uint64_t params_hash;
+		uint32_t count;
+		uint32_t reserved;
+	};
+
+	uint64_t fnv1a(const void* data, size_t size, uint64_t hash) {
+
+		const unsigned char* bytes = (const unsigned char*)data;
+
+		for (size_t i = 0; i < size; i++) {
+
+			hash ^= bytes[i];
+			hash *= FNV_PRIME;
+		}
+
+		return hash;
+	}
+
+	// validate an entry read from disk and copy its rects
+	bool parseEntry(const char* data, size_t size, uint64_t image_hash, uint64_t params_hash, std::vector<cv::Rect>& proposals) {
+
+		if (size < sizeof(Entry_Header)) {
+
+			return false;
+		}
+
+		Entry_Header header;
+		std::memcpy(&header, data, sizeof(header));
+
+		if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION ||
+			header.image_hash != image_hash || header.params_hash != params_hash ||
+			size != sizeof(Entry_Header) + (size_t)header.count * 4 * sizeof(int32_t)) {
+
+			return false;
+		}
+
+		const int32_t* values = (const int32_t*)(data + sizeof(Entry_Header));
+		proposals.resize(header.count);
+
+		for (uint32_t i = 0; i < header.count; i++, values += 4) {
+
+			proposals[i] = cv::Rect(values[0], values[1], values[2], values[3]);
+		}
+
+		return true;
+	}
+}
+
+
+Proposal_Cache::Proposal_Cache(const cv::String& directory) : directory(directory) {
+
+	cv::utils::fs::createDirectories(directory);
+}
+
+
+bool Proposal_Cache::load(uint64_t image_hash, const cv::String& params_key, std::vector<cv::Rect>& proposals) const {
+
+	TRACE_SCOPE("proposal_cache_load");
+
+	uint64_t params_hash = hashString(params_key);
+	cv::String path = getEntryPath(image_hash, params_hash);
+
+#ifdef PROPOSAL_CACHE_MMAP
+	int fd = open(path.c_str(), O_RDONLY);
+
+	if (fd < 0) {
+
+		return false;
+	}
+
+	struct stat st;
+	bool found = false;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+
+		void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (data != MAP_FAILED) {
+
+			found = parseEntry((const char*)data, st.st_size, image_hash, params_hash, proposals);
+			munmap(data, st.st_size);
+		}
+	}
+
+	close(fd);
+	return found;
+#else
+	std::ifstream file(path, std::ios::binary);
+
+	if (!file.is_open()) {
+
+		return false;
+	}
+
+	std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	return parseEntry(data.data(), data.size(), image_hash, params_hash, proposals);
+#endif
+}
+
+
+bool Proposal_Cache::store(uint64_t image_hash, const cv::String& params_key, const std::vector<cv::Rect>& proposals) const {
+
+	TRACE_SCOPE("proposal_cache_store");
+
+	Entry_Header header;
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.image_hash = image_hash;
+	header.params_hash = hashString(params_key);
+	header.count = (uint32_t)proposals.size();
+	header.reserved = 0;
+
+	std::vector<int32_t> values;
+	values.reserve(proposals.size() * 4);
+
+	for (int i = 0; i < proposals.size(); i++) {
+
+		values.push_back(proposals[i].x);
+		values.push_back(proposals[i].y);
+		values.push_back(proposals[i].width);
+		values.push_back(proposals[i].height);
+	}
+
+	// write to a temporary file, unique to this process and thread, then move it in place
+	cv::String path = getEntryPath(header.image_hash, header.params_hash);
+	std::ostringstream tmp_path;
+	tmp_path << path << ".tmp" << getProcessId() << "_" << std::hash<std::thread::id>()(std::this_thread::get_id());
+
+	{
+		std::ofstream file(tmp_path.str(), std::ios::binary);
+
+		if (!file.is_open()) {
+
+			return false;
+		}
+
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)values.data(), values.size() * sizeof(int32_t));
+
+		if (!file.good()) {
+
+			file.close();
+			std::remove(tmp_path.str().c_str());
+			return false;
+		}
+	}
+
+	if (std::rename(tmp_path.str().c_str(), path.c_str())) {
+
+		std::remove(tmp_path.str().c_str());
+		return false;
+	}
+
+	return true;
+}
+
+
+uint64_t Proposal_Cache::hashImage(const cv::Mat& image) {
+
+	TRACE_SCOPE("proposal_cache_hash");
+
+	int header[3] = { image.rows, image.cols, image.type() };
+	uint64_t hash = fnv1a(header, sizeof(header), FNV_OFFSET);
+
+	// rows are hashed one at a time, images may not be continuous (e.g. ROIs)
+	size_t row_size = image.cols * image.elemSize();
+
+	for (int i = 0; i < image.rows; i++) {
+
+		hash = fnv1a(image.ptr(i), row_size, hash);
+	}
+
+	return hash;
+}
+
+
+uint64_t Proposal_Cache::hashString(const cv::String& key) {
+
+	return fnv1a(key.data(), key.size(), FNV_OFFSET);
+}
+
+
+cv::String Proposal_Cache::getEntryPath(uint64_t image_hash, uint64_t params_hash) const {
+
+	char name[64];
+	std::snprintf(name, sizeof(name), "%016llx_%016llx.bin", (unsigned long long)image_hash, (unsigned long long)params_hash);
+
+	return directory + "/" + name;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/*
+* Persistent on-disk cache of the regions proposed on an image.
+*
+* Entries are keyed by a hash of the image content (FNV-1a over size, type and pixels) and by a hash of a string
+* describing the proposal parameters (see Detector_Utils::getProposalsKey), so that an entry is never used for a
+* different image or for proposals computed with different parameters. Each entry is a small binary file named
+* after the two hashes:
+*
+* - header: magic "BPRC", format version, image hash, parameters hash, number of rects (32 bytes, native byte order)
+* - payload: x, y, width, height of each rect as 32-bit integers
+*
+* The layout is fixed-size and aligned, so entries are read through a memory mapping where available.
+* Entries are written to a temporary file and renamed, so concurrent readers and writers never see partial entries.
+* Methods are const and keep no state besides the directory, so a Proposal_Cache can be shared by several threads.
+*/
+
+class Proposal_Cache {
+
+public:
+
+	/*
+	* Constructor.
+	*
+	* @param directory		Directory containing the cache entries. It is created if it does not exist.
+	*/
+	Proposal_Cache(const cv::String& directory);
+
+
+	/*
+	* Function to read the proposals of an image from the cache.
+	*
+	* @param image_hash		Hash of the image (see hashImage), computed once for load and, on a miss, store.
+	* @param params_key		Description of the parameters the proposals are computed with.
+	* @param &proposals		Cached proposals.
+	*
+	* @return bool			Returns false if there is no valid entry for the image and the parameters.
+	*/
+	bool load(uint64_t image_hash, const cv::String& params_key, std::vector<cv::Rect>& proposals) const;
+
+
+	/*
+	* Function to store the proposals of an image in the cache.
+	*
+	* @param image_hash		Hash of the image (see hashImage).
+	* @param params_key		Description of the parameters the proposals are computed with.
+	* @param proposals		Proposals to store.
+	*
+	* @return bool			Returns false if the entry could not be written.
+	*/
+	bool store(uint64_t image_hash, const cv::String& params_key, const std::vector<cv::Rect>& proposals) const;
+
+
+	/*
+	* Function to compute the FNV-1a hash of the content of an image (size, type and pixels).
+	*
+	* @param image			Image.
+	*
+	* @return uint64_t		Hash of the image.
+	*/
+	static uint64_t hashImage(const cv::Mat& image);
+
+
+	/*
+	* Function to compute the FNV-1a hash of a string.
+	*
+	* @param key			String.
+	*
+	* @return uint64_t		Hash of the string.
+	*/
+	static uint64_t hashString(const cv::String& key);
+
+private:
+
+	cv::String getEntryPath(uint64_t image_hash, uint64_t params_hash) const;
+
+	cv::String directory;
+};
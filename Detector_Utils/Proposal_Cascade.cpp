@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <opencv2/imgproc.hpp>
+#include "Proposal_Cascade.h"
+#include "Trace.h"
+
+namespace {
+
+	const char* FEATURE_NAMES[Proposal_Cascade::N_FEATURES] = { "edge_density_min", "gradient_energy_min", "stddev_min" };
+
+	// sum of the values inside a rectangle, from an integral image
+	template <typename T>
+	inline double sumRect(const cv::Mat& integral, const cv::Rect& rect) {
+
+		return (double)integral.at<T>(rect.y, rect.x) + integral.at<T>(rect.y + rect.height, rect.x + rect.width)
+			- integral.at<T>(rect.y, rect.x + rect.width) - integral.at<T>(rect.y + rect.height, rect.x);
+	}
+}
+
+
+Proposal_Cascade::Proposal_Cascade() : linear_threshold(-std::numeric_limits<float>::max()) {
+
+	std::fill(thresholds, thresholds + N_FEATURES, -std::numeric_limits<float>::max());
+}
+
+
+bool Proposal_Cascade::load(const cv::String& filename) {
+
+	try {
+
+		cv::FileStorage fs(filename, cv::FileStorage::READ);
+
+		if (!fs.isOpened()) {
+
+			return false;
+		}
+
+		for (int k = 0; k < N_FEATURES; k++) {
+
+			cv::read(fs[FEATURE_NAMES[k]], thresholds[k], -std::numeric_limits<float>::max());
+		}
+
+		cv::read(fs["linear_model"], linear_model_file, "");
+		cv::read(fs["linear_threshold"], linear_threshold, -std::numeric_limits<float>::max());
+	}
+	catch (const cv::Exception&) {
+
+		return false;
+	}
+
+	if (linear_model_file.empty()) {
+
+		return true;
+	}
+
+	// the linear model is stored next to the cascade file
+	size_t separator = filename.find_last_of("/\\");
+	cv::String directory = separator == cv::String::npos ? "." : filename.substr(0, separator);
+
+	return linear_svm.load(directory + "/" + linear_model_file);
+}
+
+
+void Proposal_Cascade::save(const cv::String& filename) const {
+
+	cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+
+	for (int k = 0; k < N_FEATURES; k++) {
+
+		fs << FEATURE_NAMES[k] << thresholds[k];
+	}
+
+	fs << "linear_model" << linear_model_file;
+	fs << "linear_threshold" << linear_threshold;
+}
+
+
+void Proposal_Cascade::computeFeatures(const cv::Mat& processed, const std::vector<cv::Rect>& rects, cv::Mat& features) {
+
+	cv::Mat gray = processed;
+
+	if (gray.channels() == 3) {
+
+		cv::cvtColor(processed, gray, cv::COLOR_BGR2GRAY);
+	}
+
+	// integral images: edge pixels, squared gradient magnitude, intensity and squared intensity
+	cv::Mat edges, edge_sum;
+	cv::Canny(gray, edges, 50, 150);
+	cv::threshold(edges, edges, 0, 1, cv::THRESH_BINARY);
+	cv::integral(edges, edge_sum, CV_32S);
+
+	cv::Mat dx, dy, energy, energy_sum;
+	cv::Sobel(gray, dx, CV_32F, 1, 0);
+	cv::Sobel(gray, dy, CV_32F, 0, 1);
+	energy = dx.mul(dx) + dy.mul(dy);
+	cv::integral(energy, energy_sum, CV_64F);
+
+	cv::Mat sum, sq_sum;
+	cv::integral(gray, sum, sq_sum, CV_64F, CV_64F);
+
+	cv::Rect image_rect(0, 0, gray.cols, gray.rows);
+	features.create((int)rects.size(), N_FEATURES, CV_32F);
+
+	for (int i = 0; i < rects.size(); i++) {
+
+		cv::Rect rect = rects[i] & image_rect;
+		float* row = features.ptr<float>(i);
+
+		if (rect.area() == 0) {
+
+			std::fill(row, row + N_FEATURES, 0.0f);
+			continue;
+		}
+
+		double area = rect.area();
+		double mean = sumRect<double>(sum, rect) / area;
+		double variance = sumRect<double>(sq_sum, rect) / area - mean * mean;
+
+		row[EDGE_DENSITY] = (float)(sumRect<int>(edge_sum, rect) / area);
+		row[GRADIENT_ENERGY] = (float)std::sqrt(std::max(sumRect<double>(energy_sum, rect) / area, 0.0));
+		row[STDDEV] = (float)std::sqrt(std::max(variance, 0.0));
+	}
+}
+
+
+double Proposal_Cascade::calibrate(const cv::Mat& positive_features, double target_recall) {
+
+	CV_Assert(positive_features.empty() || (positive_features.cols == N_FEATURES && positive_features.type() == CV_32F));
+
+	int n = positive_features.rows;
+
+	if (n == 0) {
+
+		return 1.0;
+	}
+
+	// sorted values of each feature
+	std::vector<std::vector<float>> sorted(N_FEATURES, std::vector<float>(n));
+
+	for (int k = 0; k < N_FEATURES; k++) {
+
+		for (int i = 0; i < n; i++) {
+
+			sorted[k][i] = positive_features.at<float>(i, k);
+		}
+
+		std::sort(sorted[k].begin(), sorted[k].end());
+	}
+
+	// the recall decreases with the quantile used as threshold: find the highest quantile reaching target_recall
+	auto setQuantile = [&](double q) {
+
+		int idx = std::min((int)(q * (n - 1)), n - 1);
+
+		for (int k = 0; k < N_FEATURES; k++) {
+
+			thresholds[k] = sorted[k][idx];
+		}
+	};
+
+	auto recall = [&]() {
+
+		std::vector<int> passed;
+		filter(positive_features, passed);
+		return (double)passed.size() / n;
+	};
+
+	double low = 0.0, high = std::max(1.0 - target_recall, 0.0);
+	setQuantile(high);
+
+	if (recall() < target_recall) {
+
+		for (int iter = 0; iter < 30; iter++) {
+
+			double mid = 0.5 * (low + high);
+			setQuantile(mid);
+
+			if (recall() >= target_recall) {
+
+				low = mid;
+			}
+			else {
+
+				high = mid;
+			}
+		}
+
+		setQuantile(low);
+	}
+
+	return recall();
+}
+
+
+double Proposal_Cascade::calibrateLinear(const cv::String& model_file, const Batch_SVM& svm, const cv::Mat& positive_samples,
+										double target_recall) {
+
+	linear_model_file = model_file;
+	linear_svm = svm;
+	linear_threshold = -std::numeric_limits<float>::max();
+
+	if (positive_samples.empty()) {
+
+		return 1.0;
+	}
+
+	cv::Mat scores;
+	getLinearScores(positive_samples, scores);
+
+	std::vector<float> sorted(scores.begin<float>(), scores.end<float>());
+	std::sort(sorted.begin(), sorted.end());
+
+	// the positives scoring lower than the threshold are rejected
+	int n = (int)sorted.size();
+	int rejected = std::min(std::max((int)std::floor((1.0 - target_recall) * n), 0), n - 1);
+	linear_threshold = sorted[rejected];
+
+	std::vector<int> passed;
+	filterLinear(positive_samples, passed);
+
+	return (double)passed.size() / n;
+}
+
+
+void Proposal_Cascade::filter(const cv::Mat& features, std::vector<int>& passed) const {
+
+	passed.clear();
+
+	for (int i = 0; i < features.rows; i++) {
+
+		const float* row = features.ptr<float>(i);
+		bool pass = true;
+
+		for (int k = 0; k < N_FEATURES && pass; k++) {
+
+			pass = row[k] >= thresholds[k];
+		}
+
+		if (pass) {
+
+			passed.push_back(i);
+		}
+	}
+}
+
+
+void Proposal_Cascade::filterLinear(const cv::Mat& samples, std::vector<int>& passed) const {
+
+	passed.clear();
+
+	if (!hasLinearStage()) {
+
+		for (int i = 0; i < samples.rows; i++) {
+
+			passed.push_back(i);
+		}
+
+		return;
+	}
+
+	cv::Mat scores;
+	getLinearScores(samples, scores);
+
+	for (int i = 0; i < samples.rows; i++) {
+
+		if (scores.at<float>(i) >= linear_threshold) {
+
+			passed.push_back(i);
+		}
+	}
+}
+
+
+void Proposal_Cascade::filterProposals(const cv::Mat& processed, std::vector<cv::Rect>& proposals) const {
+
+	TRACE_SCOPE("cascade");
+
+	cv::Mat features;
+	computeFeatures(processed, proposals, features);
+
+	std::vector<int> passed;
+	filter(features, passed);
+	TRACE_COUNT("cascade_rejected", (int64_t)(proposals.size() - passed.size()));
+
+	for (int i = 0; i < passed.size(); i++) {
+
+		proposals[i] = proposals[passed[i]];
+	}
+
+	proposals.resize(passed.size());
+}
+
+
+void Proposal_Cascade::filterSamples(cv::Mat& samples, std::vector<int>& sample_proposals) const {
+
+	if (!hasLinearStage() || samples.empty()) {
+
+		return;
+	}
+
+	std::vector<int> passed;
+	filterLinear(samples, passed);
+
+	cv::Mat kept(passed.size(), samples.cols, samples.type());
+
+	for (int i = 0; i < passed.size(); i++) {
+
+		samples.row(passed[i]).copyTo(kept.row(i));
+		sample_proposals[i] = sample_proposals[passed[i]];
+	}
+
+	samples = kept;
+	sample_proposals.resize(passed.size());
+}
+
+
+bool Proposal_Cascade::hasLinearStage() const {
+
+	return !linear_svm.empty();
+}
+
+
+void Proposal_Cascade::getLinearScores(const cv::Mat& samples, cv::Mat& scores) const {
+
+	cv::Mat labels;
+	linear_svm.predict(samples, labels, scores);
+
+	// decision values are positive for the first class label: flip them if it is not the boat class (1)
+	if (linear_svm.getLabel(false) != 1) {
+
+		scores = -scores;
+	}
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include "Batch_SVM.h"
+
+/*
+* Rejection cascade run on the proposed regions of an image before the expensive classifier (SIFT + BOW + SVM).
+*
+* - First stage: three features computed in constant time per region from integral images of the processed image
+*   (grayscale + CLAHE): edge density (fraction of Canny edge pixels), gradient energy (root mean square of the Sobel
+*   gradient magnitude) and standard deviation of the intensity. Sky, water and quay regions are flat, so a region is
+*   rejected if any of its features is lower than the corresponding threshold.
+* - Second stage (optional): a linear SVM evaluated on the bag of words descriptor of the regions that passed the first
+*   stage; regions whose score is lower than a threshold are not fed to the final (RBF) SVM.
+*
+* Thresholds are calibrated by the training program on the positive patches, so that a target fraction of them
+* passes each stage (calibrate, calibrateLinear). First stage features of the training patches are computed as for a
+* proposal, on the processed image the patch was cropped from (Detector_Utils::processImage) and not on the patch, which
+* is equalized on its own and has systematically higher contrast.
+*
+* Methods used by the detector are const, so a Proposal_Cascade can be shared by several threads.
+*/
+
+class Proposal_Cascade {
+
+public:
+
+	enum Feature { EDGE_DENSITY, GRADIENT_ENERGY, STDDEV, N_FEATURES };
+
+
+	/*
+	* Constructor of a cascade which rejects nothing.
+	*/
+	Proposal_Cascade();
+
+
+	/*
+	* Function to load a cascade saved with save. The linear model, if any, is loaded from the same directory.
+	*
+	* @param filename		Path to the cascade file.
+	*
+	* @return bool			Returns false if the cascade could not be loaded.
+	*/
+	bool load(const cv::String& filename);
+
+
+	/*
+	* Function to save the cascade. The linear model is not saved, only its file name.
+	*
+	* @param filename		Path to the cascade file.
+	*/
+	void save(const cv::String& filename) const;
+
+
+	/*
+	* Function to compute the first stage features of a set of regions of an image.
+	*
+	* @param processed		Processed image (grayscale + CLAHE, or BGR which is converted to grayscale).
+	* @param rects			Regions.
+	* @param &features		N x N_FEATURES CV_32F features, one row per region.
+	*/
+	static void computeFeatures(const cv::Mat& processed, const std::vector<cv::Rect>& rects, cv::Mat& features);
+
+
+	/*
+	* Function to set the thresholds of the first stage so that at least target_recall of the given positive samples
+	* pass it. Each threshold is the same quantile of the corresponding feature of the positives.
+	*
+	* @param positive_features	Features of positive samples, one row per sample.
+	* @param target_recall		Fraction of the positive samples that must pass the first stage.
+	*
+	* @return double			Fraction of the positive samples passing the first stage.
+	*/
+	double calibrate(const cv::Mat& positive_features, double target_recall);
+
+
+	/*
+	* Function to set the linear stage and its threshold, so that at least target_recall of the given positive
+	* samples pass it.
+	*
+	* @param model_file			File name of the linear model (relative to the directory of the cascade file).
+	* @param svm				Linear model.
+	* @param positive_samples	Bag of words descriptors of positive samples, one per row.
+	* @param target_recall		Fraction of the positive samples that must pass the linear stage.
+	*
+	* @return double			Fraction of the positive samples passing the linear stage.
+	*/
+	double calibrateLinear(const cv::String& model_file, const Batch_SVM& svm, const cv::Mat& positive_samples, double target_recall);
+
+
+	/*
+	* Function to test which samples pass the first stage.
+	*
+	* @param features		Features of the samples, one row per sample.
+	* @param &passed		Index of the samples passing the stage.
+	*/
+	void filter(const cv::Mat& features, std::vector<int>& passed) const;
+
+
+	/*
+	* Function to test which samples pass the linear stage (all of them if there is no linear stage).
+	*
+	* @param samples		Bag of words descriptors, one per row.
+	* @param &passed		Index of the samples passing the stage.
+	*/
+	void filterLinear(const cv::Mat& samples, std::vector<int>& passed) const;
+
+
+	/*
+	* Function to remove the proposals rejected by the first stage.
+	*
+	* @param processed		Processed image (grayscale + CLAHE).
+	* @param &proposals		Proposed regions, the rejected ones are removed.
+	*/
+	void filterProposals(const cv::Mat& processed, std::vector<cv::Rect>& proposals) const;
+
+
+	/*
+	* Function to remove the descriptors rejected by the linear stage.
+	*
+	* @param &samples			Bag of words descriptors, one per row; the rejected ones are removed.
+	* @param &sample_proposals	Index of the proposal described by each row of samples, updated accordingly.
+	*/
+	void filterSamples(cv::Mat& samples, std::vector<int>& sample_proposals) const;
+
+
+	/*
+	* @return bool			Returns true if the cascade has a linear stage.
+	*/
+	bool hasLinearStage() const;
+
+private:
+
+	// linear scores of the samples, the higher the more likely to be a boat
+	void getLinearScores(const cv::Mat& samples, cv::Mat& scores) const;
+
+	float thresholds[N_FEATURES];
+
+	cv::String linear_model_file;
+	Batch_SVM linear_svm;
+	float linear_threshold;
+};
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <opencv2/features2d.hpp>
+#include <opencv2/imgproc.hpp>
+#include "Proposal_Classifier.h"
+#include "Detector_Utils.h"
+#include "Keypoint_Map.h"
+#include "Word_Integral_Image.h"
+#include "Trace.h"
+
+bool Proposal_Classifier::parseMode(const cv::String& name, BOW_Mode& mode) {
+
+	if (name == "patch") {
+
+		mode = BOW_PATCH;
+	}
+	else if (name == "image") {
+
+		mode = BOW_IMAGE;
+	}
+	else if (name == "integral") {
+
+		mode = BOW_INTEGRAL;
+	}
+	else {
+
+		return false;
+	}
+
+	return true;
+}
+
+
+Proposal_Classifier::Proposal_Classifier(const cv::Mat& vocabulary, const Batch_SVM& svm, BOW_Mode mode, int n_workers)
+	: svm(svm), mode(mode), n_workers(std::max(n_workers, 1)) {
+
+	extractor.setVocabulary(vocabulary);
+}
+
+
+void Proposal_Classifier::describe(const cv::Mat& image, const std::vector<cv::Rect>& proposals, const std::vector<cv::Mat>& patches,
+								cv::Mat& samples, std::vector<int>& sample_proposals) const {
+
+	TRACE_SCOPE("describe");
+
+	int n = (int)proposals.size();
+
+	// one slot per proposal, so that results do not depend on how proposals are split among workers
+	std::vector<cv::Mat> histograms(n);
+
+	// each worker gets a contiguous block of proposals
+	double n_stripes = std::max(std::min(n_workers, n), 1);
+
+	if (mode == BOW_PATCH) {
+
+		CV_Assert(patches.size() == proposals.size());
+
+		cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& range) {
+
+			TRACE_SCOPE("describe_patches");
+
+			// per-worker SIFT detector and bag of words extractor state
+			cv::Ptr<cv::SIFT> detector = cv::SIFT::create();
+			BOW_Extractor worker_extractor = extractor;
+			std::vector<cv::KeyPoint> keypoints;
+			cv::Mat descriptors;
+
+			for (int j = range.start; j < range.end; j++) {
+
+				// detect SIFT keypoints and compute descriptors
+				detector->detectAndCompute(patches[j], cv::Mat(), keypoints, descriptors);
+
+				if (!descriptors.empty()) {
+
+					// compute bag of words descriptor for the patch
+					worker_extractor.compute(descriptors, histograms[j]);
+				}
+			}
+		}, n_stripes);
+	}
+	else {
+
+		// process the whole image the same way patches are processed
+		cv::Mat processed_image;
+		Detector_Utils::processImage(image, processed_image);
+
+		// detect SIFT keypoints and compute descriptors once for the whole image
+		cv::Ptr<cv::SIFT> detector = cv::SIFT::create();
+		std::vector<cv::KeyPoint> keypoints;
+		cv::Mat descriptors;
+		detector->detectAndCompute(processed_image, cv::Mat(), keypoints, descriptors);
+
+		if (descriptors.empty()) {
+
+			keypoints.clear();
+		}
+
+		// assign each keypoint to its visual word
+		std::vector<int> words;
+		extractor.assign(descriptors, words);
+
+		Keypoint_Map keypoint_map;
+		Word_Integral_Image word_integral(extractor.descriptorSize());
+
+		if (mode == BOW_IMAGE) {
+
+			// index keypoints so that the ones inside each proposal can be retrieved quickly
+			keypoint_map.build(keypoints, words, image.size());
+		}
+		else {
+
+			// build per-word summed-area tables
+			word_integral.build(keypoints, words, image.size());
+		}
+
+		cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& range) {
+
+			TRACE_SCOPE("read_histograms");
+
+			for (int j = range.start; j < range.end; j++) {
+
+				// proposals without keypoints are left without descriptor
+				if (mode == BOW_IMAGE) {
+
+					keypoint_map.computeHistogram(proposals[j], extractor.descriptorSize(), histograms[j]);
+				}
+				else {
+
+					word_integral.computeHistogram(proposals[j], histograms[j]);
+				}
+			}
+		}, n_stripes);
+	}
+
+	// gather descriptors in proposal order
+	int n_samples = 0;
+
+	for (int j = 0; j < n; j++) {
+
+		n_samples += histograms[j].empty() ? 0 : 1;
+	}
+
+	TRACE_COUNT("proposals_without_descriptor", n - n_samples);
+	samples.create(n_samples, extractor.descriptorSize(), CV_32F);
+	sample_proposals.clear();
+
+	for (int j = 0; j < n; j++) {
+
+		if (!histograms[j].empty()) {
+
+			histograms[j].copyTo(samples.row((int)sample_proposals.size()));
+			sample_proposals.push_back(j);
+		}
+	}
+}
+
+
+void Proposal_Classifier::classify(const cv::Mat& samples, const std::vector<int>& sample_proposals, const std::vector<cv::Rect>& proposals,
+								std::vector<cv::Rect>& pred_boxes, std::vector<float>& pred_scores) const {
+
+	TRACE_SCOPE("classify");
+
+	pred_boxes.clear();
+	pred_scores.clear();
+
+	if (samples.empty()) {
+
+		return;
+	}
+
+	// classify all the patches at once
+	cv::Mat responses, decision_values;
+	svm.predict(samples, responses, decision_values);
+
+	// boats (label 1) get positive scores
+	float sign = svm.getLabel(false) == 1 ? 1.0f : -1.0f;
+
+	for (int k = 0; k < sample_proposals.size(); k++) {
+
+		// if patch is classified as boat:
+		if (responses.at<float>(k) == 1) {
+
+			// the k-th sample is obtained from the proposed region sample_proposals[k]
+			pred_boxes.push_back(proposals[sample_proposals[k]]);
+			pred_scores.push_back(sign * decision_values.at<float>(k));
+		}
+	}
+
+	TRACE_COUNT("positives_before_nms", (int64_t)pred_boxes.size());
+}
+
+
+void Proposal_Classifier::detect(const cv::Mat& image, const std::vector<cv::Rect>& proposals,
+								std::vector<cv::Rect>& pred_boxes, std::vector<float>& pred_scores) const {
+
+	std::vector<cv::Mat> patches;
+
+	if (mode == BOW_PATCH) {
+
+		// extract patches from image and process them as the patches used for training
+		cv::Mat gray;
+		cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+		Detector_Utils::processPatches(gray, proposals, patches);
+	}
+
+	cv::Mat samples;
+	std::vector<int> sample_proposals;
+	describe(image, proposals, patches, samples, sample_proposals);
+	classify(samples, sample_proposals, proposals, pred_boxes, pred_scores);
+}
+
+
+bool Proposal_Classifier::usesPatches() const {
+
+	return mode == BOW_PATCH;
+}
+
+
+int Proposal_Classifier::getWorkers() const {
+
+	return n_workers;
+}
+
+
+const BOW_Extractor& Proposal_Classifier::getExtractor() const {
+
+	return extractor;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include "BOW_Extractor.h"
+#include "Batch_SVM.h"
+
+/*
+* Classification of the regions proposed on an image: bag of words description + SVM.
+*
+* Bag of words descriptors can be computed in three ways:
+* - BOW_PATCH: SIFT descriptors are computed on each processed patch (grayscale + CLAHE), as done for training.
+* - BOW_IMAGE: SIFT descriptors are computed once on the whole processed image; keypoints are assigned to their visual
+*   words and indexed in a Keypoint_Map, the histogram of a proposal is built from the keypoints inside its rectangle.
+* - BOW_INTEGRAL: as BOW_IMAGE, but histograms are read from per-word summed-area tables (Word_Integral_Image).
+*
+* Proposals are described in parallel by a configurable number of workers. Each worker owns its SIFT detector and
+* bag of words extractor; results are stored per proposal, so the output does not depend on the number of workers.
+* All descriptors of an image are then classified at once by a Batch_SVM.
+*
+* Methods are const and keep no per-image state, so a Proposal_Classifier can be shared by several threads.
+*/
+
+class Proposal_Classifier {
+
+public:
+
+	enum BOW_Mode { BOW_PATCH, BOW_IMAGE, BOW_INTEGRAL };
+
+
+	/*
+	* Function to parse the name of a bag of words mode.
+	*
+	* @param name			Name of the mode (patch, image or integral).
+	* @param &mode			Parsed mode.
+	*
+	* @return bool			Returns false if name is not a known mode.
+	*/
+	static bool parseMode(const cv::String& name, BOW_Mode& mode);
+
+
+	/*
+	* Constructor.
+	*
+	* @param vocabulary		Vocabulary of visual words.
+	* @param svm			Trained classifier.
+	* @param mode			How bag of words descriptors are computed.
+	* @param n_workers		Number of workers describing proposals in parallel.
+	*/
+	Proposal_Classifier(const cv::Mat& vocabulary, const Batch_SVM& svm, BOW_Mode mode = BOW_PATCH, int n_workers = 1);
+
+
+	/*
+	* Function to compute the bag of words descriptors of the proposed regions of an image.
+	* Proposals without keypoints have no descriptor.
+	*
+	* @param image				Image (BGR, or grayscale to skip the conversion).
+	* @param proposals			Proposed regions.
+	* @param patches			Processed patches (see Detector_Utils::processPatches), one per proposal.
+	*							Only used in BOW_PATCH mode.
+	* @param &samples			Bag of words descriptors, one per row.
+	* @param &sample_proposals	Index of the proposal described by each row of samples.
+	*/
+	void describe(const cv::Mat& image, const std::vector<cv::Rect>& proposals, const std::vector<cv::Mat>& patches,
+				cv::Mat& samples, std::vector<int>& sample_proposals) const;
+
+
+	/*
+	* Function to classify bag of words descriptors and collect the regions classified as boats.
+	*
+	* @param samples			Bag of words descriptors, one per row.
+	* @param sample_proposals	Index of the proposal described by each row of samples.
+	* @param proposals			Proposed regions.
+	* @param &pred_boxes		Regions classified as boats, in proposal order.
+	* @param &pred_scores		SVM score of each box in pred_boxes (the higher, the more confident).
+	*/
+	void classify(const cv::Mat& samples, const std::vector<int>& sample_proposals, const std::vector<cv::Rect>& proposals,
+				std::vector<cv::Rect>& pred_boxes, std::vector<float>& pred_scores) const;
+
+
+	/*
+	* Function to run description and classification on the proposed regions of an image.
+	*
+	* @param image				Image (BGR).
+	* @param proposals			Proposed regions.
+	* @param &pred_boxes		Regions classified as boats, in proposal order.
+	* @param &pred_scores		SVM score of each box in pred_boxes (the higher, the more confident).
+	*/
+	void detect(const cv::Mat& image, const std::vector<cv::Rect>& proposals,
+				std::vector<cv::Rect>& pred_boxes, std::vector<float>& pred_scores) const;
+
+
+	/*
+	* @return bool			Returns true if descriptors are computed on processed patches (BOW_PATCH).
+	*/
+	bool usesPatches() const;
+
+
+	/*
+	* @return int			Number of workers.
+	*/
+	int getWorkers() const;
+
+
+	/*
+	* @return BOW_Extractor	Bag of words extractor.
+	*/
+	const BOW_Extractor& getExtractor() const;
+
+private:
+
+	BOW_Extractor extractor;
+	Batch_SVM svm;
+	BOW_Mode mode;
+	int n_workers;
+};
@@ -0,0 +1,51 @@
+#include <algorithm>
+#include "Proposal_Generator.h"
+#include "Selective_Search_Generator.h"
+#include "Sliding_Window_Generator.h"
+#include "Edge_Density_Generator.h"
+
+cv::Ptr<Proposal_Generator> Proposal_Generator::create(const cv::String& name, int max_n, int max_side, double scale) {
+
+	if (name == "selective") {
+
+		return cv::makePtr<Selective_Search_Generator>(max_n, max_side, scale);
+	}
+	else if (name == "sliding") {
+
+		return cv::makePtr<Sliding_Window_Generator>(max_n);
+	}
+	else if (name == "edges") {
+
+		return cv::makePtr<Edge_Density_Generator>(max_n, max_side, scale);
+	}
+
+	return cv::Ptr<Proposal_Generator>();
+}
+
+
+void Proposal_Generator::getWindowSizes(cv::Size image_size, int min_side, double scale_step, std::vector<cv::Size>& sizes) {
+
+	CV_Assert(min_side > 0 && scale_step > 1.0);
+
+	sizes.clear();
+
+	// aspect ratios (width / height) of the windows
+	const double aspects[] = { 1.0, 2.0, 0.5 };
+
+	for (double side = min_side; side <= std::min(image_size.width, image_size.height); side *= scale_step) {
+
+		for (double aspect : aspects) {
+
+			cv::Size size = aspect >= 1.0 ? cv::Size(cvRound(side * aspect), cvRound(side))
+										: cv::Size(cvRound(side), cvRound(side / aspect));
+
+			if (size.width <= image_size.width && size.height <= image_size.height) {
+
+				sizes.push_back(size);
+			}
+		}
+	}
+
+	// larger windows first
+	std::stable_sort(sizes.begin(), sizes.end(), [](const cv::Size& a, const cv::Size& b) { return a.area() > b.area(); });
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+/*
+* Interface of the engines proposing the regions of an image that may contain a boat.
+*
+* Available backends (see create):
+* - selective: selective search segmentation (Selective_Search_Generator), the most accurate and the slowest.
+* - sliding: multi-scale sliding window (Sliding_Window_Generator), no image analysis at all.
+* - edges: sliding windows ranked by an edge density objectness score (Edge_Density_Generator).
+*
+* Generators keep no per-image state, so a single generator can be shared by several threads.
+*/
+
+class Proposal_Generator {
+
+public:
+
+	virtual ~Proposal_Generator() {}
+
+
+	/*
+	* Function to create a proposal generator.
+	*
+	* @param name			Name of the backend (selective, sliding or edges).
+	* @param max_n			Maximum number of proposals per image.
+	* @param max_side		If greater than 0, images are downscaled so that their longest side is at most max_side
+	*						pixels before being analyzed (selective and edges).
+	* @param scale			Scale factor applied to images before being analyzed (selective and edges).
+	*
+	* @return cv::Ptr<Proposal_Generator>	Generator, empty if name is not a known backend.
+	*/
+	static cv::Ptr<Proposal_Generator> create(const cv::String& name, int max_n, int max_side = 0, double scale = 1.0);
+
+
+	/*
+	* Function to propose regions of an image.
+	*
+	* @param image			Image (BGR).
+	* @param &proposals		Proposed regions, in the coordinates of image, with an area greater than 1000 pixels.
+	*/
+	virtual void generate(const cv::Mat& image, std::vector<cv::Rect>& proposals) const = 0;
+
+
+	/*
+	* Function to describe the backend and its parameters, used to key cached proposals (see Proposal_Cache).
+	*
+	* @return cv::String	Description of the backend and of its parameters.
+	*/
+	virtual cv::String getKey() const = 0;
+
+
+	/*
+	* @return bool			Returns true if the proposals of an image also depend on the calls made before (e.g. on
+	*						a random state shared by the whole process), so that runs reproduce each other only if
+	*						images are processed in the same order, one at a time.
+	*/
+	virtual bool dependsOnCallOrder() const {
+
+		return false;
+	}
+
+protected:
+
+	/*
+	* Function to get the sizes of the windows slid over an image: square, wide (2:1) and tall (1:2) windows whose
+	* shortest side grows geometrically from min_side, as long as they fit in the image. Larger windows come first.
+	*
+	* @param image_size		Size of the image.
+	* @param min_side		Shortest side of the smallest windows.
+	* @param scale_step		Ratio between the sizes of consecutive levels (greater than 1).
+	* @param &sizes			Window sizes.
+	*/
+	static void getWindowSizes(cv::Size image_size, int min_side, double scale_step, std::vector<cv::Size>& sizes);
+};
@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+#include <opencv2/ml.hpp>
+#include "SVM_Grid_Search.h"
+#include "Trace.h"
+
+namespace {
+
+	// values of a logarithmic grid, enumerated as cv::ml::SVM::trainAuto does
+	std::vector<double> getGridValues(const cv::ml::ParamGrid& grid) {
+
+		std::vector<double> values;
+
+		for (double value = grid.minVal; value < grid.maxVal; value *= grid.logStep) {
+
+			values.push_back(value);
+		}
+
+		return values;
+	}
+
+	// finer grid around a value, spanning one step of the original grid
+	std::vector<double> getFinerValues(double center, double log_step) {
+
+		std::vector<double> values;
+
+		for (int k = -2; k <= 2; k++) {
+
+			values.push_back(center * std::pow(log_step, k / 4.0));
+		}
+
+		return values;
+	}
+}
+
+
+SVM_Grid_Search::SVM_Grid_Search(int k_fold, bool refine, uint64_t seed) : k_fold(k_fold), refine(refine), seed(seed) {
+
+	CV_Assert(k_fold >= 2);
+}
+
+
+SVM_Grid_Search::Result SVM_Grid_Search::search(const cv::Mat& samples, const cv::Mat& labels, int kernel) const {
+
+	TRACE_SCOPE("svm_grid_search");
+
+	CV_Assert(samples.type() == CV_32F && labels.total() == (size_t)samples.rows);
+	CV_Assert(kernel == cv::ml::SVM::RBF || kernel == cv::ml::SVM::LINEAR);
+
+	int n = samples.rows;
+
+	// the class with the larger label is the positive one
+	cv::Mat int_labels;
+	labels.reshape(1, n).convertTo(int_labels, CV_32S);
+
+	double min_label, max_label;
+	cv::minMaxLoc(int_labels, &min_label, &max_label);
+	CV_Assert(min_label != max_label);
+
+	std::vector<float> y(n);
+
+	for (int i = 0; i < n; i++) {
+
+		y[i] = int_labels.at<int>(i) == (int)max_label ? 1.0f : -1.0f;
+	}
+
+	// stratified folds: samples of each class are shuffled and dealt to the folds in turn
+	std::vector<int> order(n);
+	std::iota(order.begin(), order.end(), 0);
+
+	cv::RNG rng(seed);
+
+	for (int i = n - 1; i > 0; i--) {
+
+		std::swap(order[i], order[rng.uniform(0, i + 1)]);
+	}
+
+	std::vector<int> folds(n);
+	int dealt[2] = { 0, 0 };
+
+	for (int i = 0; i < n; i++) {
+
+		int c = y[order[i]] > 0 ? 1 : 0;
+		folds[order[i]] = dealt[c]++ % k_fold;
+	}
+
+	// dot products of all the pairs of samples, turned into squared distances for the RBF kernel
+	cv::Mat cache;
+	cv::gemm(samples, samples, 1, cv::noArray(), 0, cache, cv::GEMM_2_T);
+
+	if (kernel == cv::ml::SVM::RBF) {
+
+		std::vector<float> norms(n);
+
+		for (int i = 0; i < n; i++) {
+
+			norms[i] = cache.at<float>(i, i);
+		}
+
+		cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& range) {
+
+			for (int i = range.start; i < range.end; i++) {
+
+				float* row = cache.ptr<float>(i);
+
+				for (int j = 0; j < n; j++) {
+
+					row[j] = std::max(norms[i] + norms[j] - 2 * row[j], 0.0f);
+				}
+			}
+		});
+	}
+
+	cv::ml::ParamGrid c_grid = cv::ml::SVM::getDefaultGrid(cv::ml::SVM::C);
+	cv::ml::ParamGrid gamma_grid = cv::ml::SVM::getDefaultGrid(cv::ml::SVM::GAMMA);
+
+	std::vector<double> Cs = getGridValues(c_grid);
+
+	// gamma is not used by the linear kernel
+	std::vector<double> gammas = kernel == cv::ml::SVM::RBF ? getGridValues(gamma_grid) : std::vector<double>(1, 1.0);
+
+	Result best = { Cs[0], gammas[0], DBL_MAX };
+
+	for (int pass = 0; pass < (refine ? 2 : 1); pass++) {
+
+		if (pass == 1) {
+
+			Cs = getFinerValues(best.C, c_grid.logStep);
+
+			if (kernel == cv::ml::SVM::RBF) {
+
+				gammas = getFinerValues(best.gamma, gamma_grid.logStep);
+			}
+		}
+
+		std::vector<double> errors;
+		evaluate(cache, y, folds, kernel, gammas, Cs, errors);
+
+		for (int g = 0; g < gammas.size(); g++) {
+
+			for (int c = 0; c < Cs.size(); c++) {
+
+				if (errors[g * Cs.size() + c] < best.error) {
+
+					best = { Cs[c], gammas[g], errors[g * Cs.size() + c] };
+				}
+			}
+		}
+	}
+
+	return best;
+}
+
+
+void SVM_Grid_Search::evaluate(const cv::Mat& cache, const std::vector<float>& y, const std::vector<int>& folds, int kernel,
+							const std::vector<double>& gammas, const std::vector<double>& Cs, std::vector<double>& errors) const {
+
+	int n = cache.rows;
+	int n_tasks = (int)Cs.size() * k_fold;
+	errors.assign(gammas.size() * Cs.size(), 0.0);
+
+	cv::Mat K;
+
+	for (int g = 0; g < gammas.size(); g++) {
+
+		if (kernel == cv::ml::SVM::RBF) {
+
+			// K = exp(-gamma * squared distance), computed once for all the values of C and all the folds
+			K.create(n, n, CV_32F);
+
+			cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& range) {
+
+				cv::Mat rows = K.rowRange(range.start, range.end);
+				cache.rowRange(range.start, range.end).convertTo(rows, CV_32F, -gammas[g]);
+				cv::exp(rows, rows);
+			});
+		}
+		else {
+
+			K = cache;
+		}
+
+		// one task per value of C and fold
+		std::vector<int> task_errors(n_tasks, 0);
+
+		cv::parallel_for_(cv::Range(0, n_tasks), [&](const cv::Range& range) {
+
+			for (int task = range.start; task < range.end; task++) {
+
+				int fold = task % k_fold;
+				std::vector<int> train_idxs, test_idxs;
+
+				for (int i = 0; i < n; i++) {
+
+					(folds[i] == fold ? test_idxs : train_idxs).push_back(i);
+				}
+
+				std::vector<double> alpha;
+				double rho = solve(K, y, train_idxs, Cs[task / k_fold], alpha);
+
+				// decision function on the held-out samples
+				std::vector<double> decision(test_idxs.size(), -rho);
+
+				for (int a = 0; a < train_idxs.size(); a++) {
+
+					if (alpha[a] > 0) {
+
+						const float* Ka = K.ptr<float>(train_idxs[a]);
+						double coef = alpha[a] * y[train_idxs[a]];
+
+						for (int t = 0; t < test_idxs.size(); t++) {
+
+							decision[t] += coef * Ka[test_idxs[t]];
+						}
+					}
+				}
+
+				for (int t = 0; t < test_idxs.size(); t++) {
+
+					task_errors[task] += (decision[t] > 0) != (y[test_idxs[t]] > 0);
+				}
+			}
+		}, n_tasks);
+
+		for (int task = 0; task < n_tasks; task++) {
+
+			errors[g * Cs.size() + task / k_fold] += (double)task_errors[task] / n;
+		}
+	}
+}
+
+
+double SVM_Grid_Search::solve(const cv::Mat& K, const std::vector<float>& y, const std::vector<int>& idxs, double C, std::vector<double>& alpha) {
+
+	const double eps = 1e-3;
+	const double tau = 1e-12;
+
+	int m = (int)idxs.size();
+	std::vector<float> ys(m);
+	std::vector<float> diagonal(m);
+
+	for (int a = 0; a < m; a++) {
+
+		ys[a] = y[idxs[a]];
+		diagonal[a] = K.at<float>(idxs[a], idxs[a]);
+	}
+
+	// gradient of the dual objective 1/2 alpha' Q alpha - sum(alpha), Q_ab = y_a y_b K_ab
+	alpha.assign(m, 0.0);
+	std::vector<double> G(m, -1.0);
+
+	int max_iterations = std::max(10000000, 100 * m);
+
+	for (int iteration = 0; iteration < max_iterations; iteration++) {
+
+		// working set selection using second order information (Fan, Chen and Lin, 2005)
+		double Gmax = -DBL_MAX;
+		int i = -1;
+
+		for (int t = 0; t < m; t++) {
+
+			if (ys[t] > 0 ? alpha[t] < C : alpha[t] > 0) {
+
+				double value = -ys[t] * G[t];
+
+				if (value >= Gmax) {
+
+					Gmax = value;
+					i = t;
+				}
+			}
+		}
+
+		if (i < 0) {
+
+			break;
+		}
+
+		const float* Ki = K.ptr<float>(idxs[i]);
+		double Gmax2 = -DBL_MAX;
+		double min_objective = DBL_MAX;
+		int j = -1;
+
+		for (int t = 0; t < m; t++) {
+
+			if (ys[t] > 0 ? alpha[t] > 0 : alpha[t] < C) {
+
+				double value = ys[t] * G[t];
+				double grad_diff = Gmax + value;
+				Gmax2 = std::max(Gmax2, value);
+
+				if (grad_diff > 0) {
+
+					double quad = diagonal[i] + diagonal[t] - 2.0 * Ki[idxs[t]];
+					double objective = -(grad_diff * grad_diff) / (quad > 0 ? quad : tau);
+
+					if (objective <= min_objective) {
+
+						min_objective = objective;
+						j = t;
+					}
+				}
+			}
+		}
+
+		if (Gmax + Gmax2 < eps || j < 0) {
+
+			break;
+		}
+
+		// analytic solution of the two-variable subproblem, clipped to the box [0, C]
+		const float* Kj = K.ptr<float>(idxs[j]);
+		double quad = diagonal[i] + diagonal[j] - 2.0 * Ki[idxs[j]];
+		quad = quad > 0 ? quad : tau;
+
+		double old_ai = alpha[i];
+		double old_aj = alpha[j];
+
+		if (ys[i] != ys[j]) {
+
+			double delta = (-G[i] - G[j]) / quad;
+			double diff = alpha[i] - alpha[j];
+			alpha[i] += delta;
+			alpha[j] += delta;
+
+			if (diff > 0 && alpha[j] < 0) {
+
+				alpha[j] = 0;
+				alpha[i] = diff;
+			}
+			else if (diff <= 0 && alpha[i] < 0) {
+
+				alpha[i] = 0;
+				alpha[j] = -diff;
+			}
+
+			if (diff > 0 && alpha[i] > C) {
+
+				alpha[i] = C;
+				alpha[j] = C - diff;
+			}
+			else if (diff <= 0 && alpha[j] > C) {
+
+				alpha[j] = C;
+				alpha[i] = C + diff;
+			}
+		}
+		else {
+
+			double delta = (G[i] - G[j]) / quad;
+			double sum = alpha[i] + alpha[j];
+			alpha[i] -= delta;
+			alpha[j] += delta;
+
+			if (sum > C && alpha[i] > C) {
+
+				alpha[i] = C;
+				alpha[j] = sum - C;
+			}
+			else if (sum <= C && alpha[j] < 0) {
+
+				alpha[j] = 0;
+				alpha[i] = sum;
+			}
+
+			if (sum > C && alpha[j] > C) {
+
+				alpha[j] = C;
+				alpha[i] = sum - C;
+			}
+			else if (sum <= C && alpha[i] < 0) {
+
+				alpha[i] = 0;
+				alpha[j] = sum;
+			}
+		}
+
+		double delta_i = (alpha[i] - old_ai) * ys[i];
+		double delta_j = (alpha[j] - old_aj) * ys[j];
+
+		for (int t = 0; t < m; t++) {
+
+			G[t] += ys[t] * (delta_i * Ki[idxs[t]] + delta_j * Kj[idxs[t]]);
+		}
+	}
+
+	// rho: mean of y G over the free support vectors, or middle of the feasible interval if there are none
+	double upper = DBL_MAX, lower = -DBL_MAX, sum_free = 0;
+	int n_free = 0;
+
+	for (int t = 0; t < m; t++) {
+
+		double yG = ys[t] * G[t];
+
+		if (alpha[t] >= C) {
+
+			if (ys[t] < 0) {
+
+				upper = std::min(upper, yG);
+			}
+			else {
+
+				lower = std::max(lower, yG);
+			}
+		}
+		else if (alpha[t] <= 0) {
+
+			if (ys[t] > 0) {
+
+				upper = std::min(upper, yG);
+			}
+			else {
+
+				lower = std::max(lower, yG);
+			}
+		}
+		else {
+
+			n_free++;
+			sum_free += yG;
+		}
+	}
+
+	return n_free > 0 ? sum_free / n_free : (upper + lower) / 2;
+}
+
+
+size_t SVM_Grid_Search::getCacheSize(int n_samples) {
+
+	// distances and kernel of the current gamma
+	return 2 * (size_t)n_samples * n_samples * sizeof(float);
+}
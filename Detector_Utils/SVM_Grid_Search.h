@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/*
+* Cross-validated search of the parameters of a C-SVC (C, and gamma for the RBF kernel), a faster replacement of
+* cv::ml::SVM::trainAuto.
+*
+* trainAuto trains one model per grid point and fold, one after the other, and evaluates the kernel from scratch in
+* each of them. Here the squared Euclidean distances between all the samples (or their dot products, for the linear
+* kernel) are computed once with a matrix product and kept in memory: the RBF kernel matrix of each gamma is then a
+* single elementwise exp, shared by all the values of C and all the folds, which are trained concurrently by an SMO
+* solver (LIBSVM working set selection) reading the cached kernel.
+*
+* The grids are the default grids of cv::ml::SVM and folds are stratified with a fixed seed, so that the search does not
+* depend on the number of threads. Optionally, the search is refined with a finer grid around the best point
+* (coarse-to-fine). The chosen parameters are meant to train the final cv::ml::SVM on all the samples.
+*
+* The cache takes two n x n float matrices, see getCacheSize.
+*/
+
+class SVM_Grid_Search {
+
+public:
+
+	/*
+	* Parameters chosen by the search.
+	*/
+	struct Result {
+
+		double C;
+		double gamma;
+
+		// fraction of misclassified held-out samples
+		double error;
+	};
+
+
+	/*
+	* Constructor.
+	*
+	* @param k_fold			Number of cross validation folds.
+	* @param refine			If true, refine the search with a finer grid around the best point of the default grid.
+	* @param seed			Seed of the split in folds.
+	*/
+	SVM_Grid_Search(int k_fold = 10, bool refine = false, uint64_t seed = 12345);
+
+
+	/*
+	* Function to search the parameters of a C-SVC.
+	*
+	* @param samples		Samples (CV_32F, one per row), already mapped if a feature map is used.
+	* @param labels			Labels of the samples (CV_32S, two classes).
+	* @param kernel			cv::ml::SVM::RBF or cv::ml::SVM::LINEAR (gamma is not searched).
+	*
+	* @return Result		Parameters with the lowest cross validation error (the first ones among equals).
+	*/
+	Result search(const cv::Mat& samples, const cv::Mat& labels, int kernel) const;
+
+
+	/*
+	* @param n_samples		Number of samples.
+	*
+	* @return size_t		Memory taken by the kernel cache (bytes).
+	*/
+	static size_t getCacheSize(int n_samples);
+
+private:
+
+	// cross validation error of each grid point (gammas x Cs, in this order) on the cached distances (or dot products)
+	void evaluate(const cv::Mat& cache, const std::vector<float>& y, const std::vector<int>& folds, int kernel,
+				const std::vector<double>& gammas, const std::vector<double>& Cs, std::vector<double>& errors) const;
+
+	// dual solution of a C-SVC on a subset of the samples, returns rho of the decision function sum(alpha_i y_i K_i) - rho
+	static double solve(const cv::Mat& K, const std::vector<float>& y, const std::vector<int>& idxs, double C, std::vector<double>& alpha);
+
+	int k_fold;
+	bool refine;
+	uint64_t seed;
+};
@@ -0,0 +1,29 @@
+#include <opencv2/ximgproc/segmentation.hpp>
+#include "Detector_Utils.h"
+#include "Selective_Search_Generator.h"
+
+Selective_Search_Generator::Selective_Search_Generator(int max_n, int max_side, double scale) : max_n(max_n), max_side(max_side), scale(scale) {
+
+}
+
+
+void Selective_Search_Generator::generate(const cv::Mat& image, std::vector<cv::Rect>& proposals) const {
+
+	// create Selective Search Segmentation object 
+	cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentation> ss;
+	ss = cv::ximgproc::segmentation::createSelectiveSearchSegmentation();
+
+	proposals = Detector_Utils::getProposals(image, ss, max_n, max_side, scale);
+}
+
+
+bool Selective_Search_Generator::dependsOnCallOrder() const {
+
+	return true;
+}
+
+
+cv::String Selective_Search_Generator::getKey() const {
+
+	return Detector_Utils::getProposalsKey(max_n, max_side, scale);
+}
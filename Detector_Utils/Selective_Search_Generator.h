@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Proposal_Generator.h"
+
+/*
+* Proposal generator running selective search segmentation (fast mode) through Detector_Utils::getProposals.
+* A segmentation object is created for each image, so the generator can be shared by several threads.
+*
+* Selective search ranks its regions with the C library rand(), whose state is shared by the whole process: the set of
+* regions of an image is always the same, but their order (hence which ones are kept) depends on the calls made before.
+*/
+
+class Selective_Search_Generator : public Proposal_Generator {
+
+public:
+
+	/*
+	* Constructor.
+	*
+	* @param max_n			Maximum number of proposals per image.
+	* @param max_side		If greater than 0, images are downscaled so that their longest side is at most max_side pixels.
+	* @param scale			Scale factor applied to images before segmentation.
+	*/
+	Selective_Search_Generator(int max_n, int max_side = 0, double scale = 1.0);
+
+	void generate(const cv::Mat& image, std::vector<cv::Rect>& proposals) const override;
+
+	cv::String getKey() const override;
+
+	bool dependsOnCallOrder() const override;
+
+private:
+
+	int max_n;
+	int max_side;
+	double scale;
+};
@@ -0,0 +1,49 @@
+#include <algorithm>
+#include "Sliding_Window_Generator.h"
+#include "Trace.h"
+
+Sliding_Window_Generator::Sliding_Window_Generator(int max_n, int min_side, double scale_step, double stride) : max_n(max_n),
+	min_side(min_side), scale_step(scale_step), stride(stride) {
+
+}
+
+
+void Sliding_Window_Generator::generate(const cv::Mat& image, std::vector<cv::Rect>& proposals) const {
+
+	TRACE_SCOPE("sliding_window_proposals");
+
+	proposals.clear();
+
+	std::vector<cv::Size> sizes;
+	getWindowSizes(image.size(), min_side, scale_step, sizes);
+
+	for (int k = 0; k < sizes.size(); k++) {
+
+		const cv::Size& size = sizes[k];
+		int step_x = std::max(cvRound(size.width * stride), 1);
+		int step_y = std::max(cvRound(size.height * stride), 1);
+
+		for (int y = 0; y + size.height <= image.rows; y += step_y) {
+
+			for (int x = 0; x + size.width <= image.cols; x += step_x) {
+
+				if (proposals.size() >= max_n) {
+
+					return;
+				}
+
+				// consider only windows with significative area
+				if (size.area() > 1000) {
+
+					proposals.push_back(cv::Rect(x, y, size.width, size.height));
+				}
+			}
+		}
+	}
+}
+
+
+cv::String Sliding_Window_Generator::getKey() const {
+
+	return cv::format("sliding;max_n=%d;min_side=%d;scale_step=%g;stride=%g", max_n, min_side, scale_step, stride);
+}
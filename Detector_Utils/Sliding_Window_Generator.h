@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Proposal_Generator.h"
+
+/*
+* Proposal generator sliding windows of several sizes and aspect ratios over an image, the same as sliding a fixed
+* window over an image pyramid. The image content is not analyzed, so proposals cost nothing to compute; recall
+* depends on how densely windows are placed. Larger windows are proposed first, so when the number of windows exceeds
+* max_n the smallest ones are dropped.
+*/
+
+class Sliding_Window_Generator : public Proposal_Generator {
+
+public:
+
+	/*
+	* Constructor.
+	*
+	* @param max_n			Maximum number of proposals per image.
+	* @param min_side		Shortest side (in pixels) of the smallest windows.
+	* @param scale_step		Ratio between the sizes of consecutive pyramid levels.
+	* @param stride			Step between two windows, as a fraction of the window size.
+	*/
+	Sliding_Window_Generator(int max_n, int min_side = 48, double scale_step = 1.5, double stride = 0.5);
+
+	void generate(const cv::Mat& image, std::vector<cv::Rect>& proposals) const override;
+
+	cv::String getKey() const override;
+
+private:
+
+	int max_n;
+	int min_side;
+	double scale_step;
+	double stride;
+};
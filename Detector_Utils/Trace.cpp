@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define TRACE_RUSAGE
+#endif
+
+namespace {
+
+	// timed scope
+	struct Event {
+
+		const char* name;
+		int64_t start_us;
+		int64_t end_us;
+	};
+
+	// counter update, with the running total
+	struct Counter_Event {
+
+		const char* name;
+		int64_t time_us;
+		int64_t total;
+	};
+
+	// events of a thread, only appended to by that thread
+	struct Thread_Buffer {
+
+		int tid;
+		std::vector<Event> events;
+	};
+
+	std::atomic<bool> running(false);
+	std::atomic<int> generation(0);
+	cv::String trace_file;
+
+	// buffers of all the threads that recorded a scope, guarded by mutex (only taken when a thread records its first scope)
+	std::mutex mutex;
+	std::vector<std::unique_ptr<Thread_Buffer>> buffers;
+
+	// counters are updated a few times per image, a lock is cheap enough
+	std::mutex counter_mutex;
+	std::map<cv::String, int64_t> counters;
+	std::vector<Counter_Event> counter_events;
+
+	const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+	Thread_Buffer& getBuffer() {
+
+		thread_local Thread_Buffer* buffer = 0;
+		thread_local int buffer_generation = -1;
+
+		if (!buffer || buffer_generation != generation) {
+
+			std::lock_guard<std::mutex> lock(mutex);
+			buffers.emplace_back(new Thread_Buffer());
+			buffer = buffers.back().get();
+			buffer->tid = (int)buffers.size();
+			buffer_generation = generation;
+		}
+
+		return *buffer;
+	}
+
+	// json string with quotes and backslashes escaped
+	std::string quote(const char* text) {
+
+		std::string quoted = "\"";
+
+		for (const char* c = text; *c; c++) {
+
+			if (*c == '"' || *c == '\\') {
+
+				quoted += '\\';
+			}
+
+			quoted += *c;
+		}
+
+		return quoted + "\"";
+	}
+}
+
+
+void Trace::start(const cv::String& filename) {
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::lock_guard<std::mutex> counter_lock(counter_mutex);
+
+	// buffers of a previous run are dropped, threads register again
+	buffers.clear();
+	generation++;
+	counters.clear();
+	counter_events.clear();
+	trace_file = filename;
+	running = true;
+}
+
+
+bool Trace::finish(std::ostream& out) {
+
+	running = false;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::lock_guard<std::mutex> counter_lock(counter_mutex);
+
+	bool written = true;
+
+	if (!trace_file.empty()) {
+
+		std::ofstream file(trace_file);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool first = true;
+
+		for (int b = 0; b < buffers.size(); b++) {
+
+			const std::vector<Event>& events = buffers[b]->events;
+
+			for (int i = 0; i < events.size(); i++) {
+
+				file << (first ? "" : ",") << "\n{\"name\":" << quote(events[i].name) << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffers[b]->tid;
+				file << ",\"ts\":" << events[i].start_us << ",\"dur\":" << events[i].end_us - events[i].start_us << "}";
+				first = false;
+			}
+		}
+
+		for (int i = 0; i < counter_events.size(); i++) {
+
+			file << (first ? "" : ",") << "\n{\"name\":" << quote(counter_events[i].name) << ",\"ph\":\"C\",\"pid\":1";
+			file << ",\"ts\":" << counter_events[i].time_us << ",\"args\":{\"value\":" << counter_events[i].total << "}}";
+			first = false;
+		}
+
+		file << "\n]}" << std::endl;
+		written = file.good();
+	}
+
+	// aggregate scopes by name
+	struct Summary {
+
+		int64_t calls = 0;
+		int64_t total_us = 0;
+		int64_t max_us = 0;
+	};
+
+	std::map<cv::String, Summary> scopes;
+
+	for (int b = 0; b < buffers.size(); b++) {
+
+		const std::vector<Event>& events = buffers[b]->events;
+
+		for (int i = 0; i < events.size(); i++) {
+
+			Summary& summary = scopes[events[i].name];
+			int64_t duration = events[i].end_us - events[i].start_us;
+			summary.calls++;
+			summary.total_us += duration;
+			summary.max_us = std::max(summary.max_us, duration);
+		}
+	}
+
+	out << cv::format("%-28s %10s %12s %10s %10s", "scope", "calls", "total ms", "mean ms", "max ms") << std::endl;
+
+	for (std::map<cv::String, Summary>::const_iterator it = scopes.begin(); it != scopes.end(); it++) {
+
+		out << cv::format("%-28s %10lld %12.2f %10.3f %10.3f", it->first.c_str(), (long long)it->second.calls, it->second.total_us / 1000.0,
+			it->second.total_us / 1000.0 / it->second.calls, it->second.max_us / 1000.0) << std::endl;
+	}
+
+	for (std::map<cv::String, int64_t>::const_iterator it = counters.begin(); it != counters.end(); it++) {
+
+		out << cv::format("%-28s %10lld", it->first.c_str(), (long long)it->second) << std::endl;
+	}
+
+	out << cv::format("%-28s %10.1f MB", "peak resident memory", getPeakMemory()) << std::endl;
+	out << (written ? "" : "Error occurred while writing the trace file " + trace_file + ".\n");
+
+	return written;
+}
+
+
+void Trace::record(const char* name, int64_t start_us, int64_t end_us) {
+
+	if (running) {
+
+		getBuffer().events.push_back({ name, start_us, end_us });
+	}
+}
+
+
+void Trace::count(const char* name, int64_t value) {
+
+	if (!running) {
+
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(counter_mutex);
+	int64_t& total = counters[name];
+	total += value;
+	counter_events.push_back({ name, now(), total });
+}
+
+
+int64_t Trace::now() {
+
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+
+double Trace::getPeakMemory() {
+
+#ifdef TRACE_RUSAGE
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+
+#ifdef __APPLE__
+		// bytes on macOS
+		return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+		// kilobytes on Linux
+		return usage.ru_maxrss / 1024.0;
+#endif
+	}
+#endif
+
+	return 0.0;
+}
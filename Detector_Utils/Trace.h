@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <opencv2/core.hpp>
+
+/*
+* Lightweight instrumentation of the hot paths: scoped timers, counters and memory high-water mark.
+*
+* Instrumentation points use the macros below, which are compiled out unless BOAT_DETECTOR_TRACE is defined
+* (CMake option BOAT_DETECTOR_TRACE), so that a normal build has no overhead at all:
+*
+* - TRACE_SCOPE("name"): times the enclosing scope.
+* - TRACE_COUNT("name", value): adds value to a counter (e.g. proposals generated, boxes kept by NMS).
+* - TRACE_START(filename), TRACE_FINISH(out): start tracing, then write the trace file (if filename is not empty) and
+*   a summary table to out.
+*
+* Each thread appends its timed scopes to its own buffer, so that recording a scope takes no lock. The trace file is a
+* Chrome trace (JSON, "X" events for scopes and "C" events for counters) that can be opened with chrome://tracing or
+* Perfetto. The summary lists, for each scope, how many times it ran and its total, mean and maximum duration, the
+* totals of the counters and the peak resident memory of the process.
+*/
+
+#ifdef BOAT_DETECTOR_TRACE
+#define TRACE_ENABLED 1
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) Trace_Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_COUNT(name, value) Trace::count(name, value)
+#define TRACE_START(filename) Trace::start(filename)
+#define TRACE_FINISH(out) Trace::finish(out)
+#else
+#define TRACE_ENABLED 0
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_COUNT(name, value) ((void)0)
+#define TRACE_START(filename) ((void)0)
+#define TRACE_FINISH(out) ((void)0)
+#endif
+
+class Trace {
+
+public:
+
+	/*
+	* Function to start recording. Scopes and counters recorded before are discarded.
+	*
+	* @param filename		Path to the Chrome trace file written by finish (empty: summary only).
+	*/
+	static void start(const cv::String& filename);
+
+
+	/*
+	* Function to stop recording, write the trace file and a summary table.
+	* Threads recording scopes must have terminated.
+	*
+	* @param &out			Stream the summary is written to.
+	*
+	* @return bool			Returns false if the trace file could not be written.
+	*/
+	static bool finish(std::ostream& out);
+
+
+	/*
+	* Function to record a timed scope of the calling thread.
+	*
+	* @param name			Name of the scope (a string literal, it is not copied).
+	* @param start_us		Start time (us, see now).
+	* @param end_us			End time (us).
+	*/
+	static void record(const char* name, int64_t start_us, int64_t end_us);
+
+
+	/*
+	* Function to add a value to a counter.
+	*
+	* @param name			Name of the counter (a string literal, it is not copied).
+	* @param value			Value to add.
+	*/
+	static void count(const char* name, int64_t value);
+
+
+	/*
+	* @return int64_t		Time elapsed since the start of the process (us, monotonic clock).
+	*/
+	static int64_t now();
+
+
+	/*
+	* @return double		Peak resident memory of the process (MB), 0 if not available.
+	*/
+	static double getPeakMemory();
+};
+
+
+/*
+* Timer recording the lifetime of a scope, see TRACE_SCOPE.
+*/
+
+class Trace_Scope {
+
+public:
+
+	/*
+	* Constructor.
+	*
+	* @param name			Name of the scope (a string literal).
+	*/
+	Trace_Scope(const char* name) : name(name), start_us(Trace::now()) {
+
+	}
+
+
+	~Trace_Scope() {
+
+		Trace::record(name, start_us, Trace::now());
+	}
+
+private:
+
+	const char* name;
+	int64_t start_us;
+};
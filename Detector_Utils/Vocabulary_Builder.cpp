@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <cfloat>
+#include <numeric>
+#include "Vocabulary_Builder.h"
+#include "BOW_Extractor.h"
+#include "Trace.h"
+
+namespace {
+
+	float squaredDistance(const float* a, const float* b, int dims) {
+
+		float sum = 0;
+
+		for (int d = 0; d < dims; d++) {
+
+			float diff = a[d] - b[d];
+			sum += diff * diff;
+		}
+
+		return sum;
+	}
+
+	// a few blocks per thread
+	double getStripes(int n) {
+
+		return std::max(std::min(4 * cv::getNumThreads(), n), 1);
+	}
+}
+
+
+Vocabulary_Builder::Vocabulary_Builder(int n_words, int sample_size, int batch_size, int max_iterations, uint64_t seed)
+	: n_words(n_words), sample_size(sample_size), batch_size(batch_size), max_iterations(max_iterations), patience(20),
+	tolerance(1e-4), rng(seed), n_sampled(0), n_seen(0), iterations(0), inertia(0) {
+
+	CV_Assert(n_words > 0 && sample_size >= n_words && batch_size > 0);
+}
+
+
+void Vocabulary_Builder::setEarlyStopping(int patience, double tolerance) {
+
+	this->patience = patience;
+	this->tolerance = tolerance;
+}
+
+
+void Vocabulary_Builder::add(const cv::Mat& descriptors) {
+
+	if (descriptors.empty()) {
+
+		return;
+	}
+
+	CV_Assert(descriptors.type() == CV_32F);
+
+	if (sample.empty()) {
+
+		sample.create(sample_size, descriptors.cols, CV_32F);
+	}
+
+	CV_Assert(descriptors.cols == sample.cols);
+
+	for (int i = 0; i < descriptors.rows; i++) {
+
+		n_seen++;
+		int slot = -1;
+
+		if (n_sampled < sample_size) {
+
+			slot = n_sampled++;
+		}
+		else {
+
+			// the i-th descriptor seen replaces a random one of the sample with probability sample_size / i
+			int64_t j = (int64_t)(rng.uniform(0.0, 1.0) * n_seen);
+			slot = j < sample_size ? (int)j : -1;
+		}
+
+		if (slot >= 0) {
+
+			descriptors.row(i).copyTo(sample.row(slot));
+		}
+	}
+}
+
+
+bool Vocabulary_Builder::build(cv::Mat& vocabulary) {
+
+	iterations = 0;
+	inertia = 0;
+
+	if (n_sampled < n_words) {
+
+		return false;
+	}
+
+	cv::Mat samples = sample.rowRange(0, n_sampled);
+	int dims = samples.cols;
+
+	// variance of the descriptors (mean squared distance to their mean), the scale of the tolerance
+	std::vector<double> mean(dims, 0.0);
+
+	for (int i = 0; i < n_sampled; i++) {
+
+		const float* row = samples.ptr<float>(i);
+
+		for (int d = 0; d < dims; d++) {
+
+			mean[d] += row[d];
+		}
+	}
+
+	double variance = 0;
+
+	for (int i = 0; i < n_sampled; i++) {
+
+		const float* row = samples.ptr<float>(i);
+
+		for (int d = 0; d < dims; d++) {
+
+			double diff = row[d] - mean[d] / n_sampled;
+			variance += diff * diff;
+		}
+	}
+
+	variance /= n_sampled;
+
+	// k-means++ seeding on a random subset of the sample
+	int n_seed = std::min(n_sampled, std::max(10 * n_words, 20000));
+	std::vector<int> idxs(n_sampled);
+	std::iota(idxs.begin(), idxs.end(), 0);
+
+	cv::Mat seed_samples(n_seed, dims, CV_32F);
+
+	for (int i = 0; i < n_seed; i++) {
+
+		std::swap(idxs[i], idxs[i + rng.uniform(0, n_sampled - i)]);
+		samples.row(idxs[i]).copyTo(seed_samples.row(i));
+	}
+
+	cv::Mat centers;
+	seedCenters(seed_samples, centers);
+
+	// mini-batch k-means
+	int n_batch = std::min(batch_size, n_sampled);
+	cv::Mat batch(n_batch, dims, CV_32F);
+	cv::Mat previous;
+	std::vector<int64_t> counts(n_words, 0);
+	std::vector<int> words;
+	std::vector<float> distances;
+
+	// smoothing factor of the batch inertia, about one pass over the sample
+	double alpha = std::min(1.0, 2.0 * n_batch / (n_sampled + 1));
+	double smoothed = -1, best = DBL_MAX;
+	int no_improvement = 0;
+
+	while (iterations < max_iterations) {
+
+		for (int i = 0; i < n_batch; i++) {
+
+			samples.row(rng.uniform(0, n_sampled)).copyTo(batch.row(i));
+		}
+
+		assign(batch, centers, words, distances);
+		iterations++;
+
+		// each codeword moves towards its descriptors, with a learning rate 1 / (number of descriptors it received)
+		centers.copyTo(previous);
+		double batch_inertia = 0;
+
+		for (int i = 0; i < n_batch; i++) {
+
+			int c = words[i];
+			float eta = 1.0f / ++counts[c];
+			float* center = centers.ptr<float>(c);
+			const float* x = batch.ptr<float>(i);
+
+			for (int d = 0; d < dims; d++) {
+
+				center[d] += eta * (x[d] - center[d]);
+			}
+
+			batch_inertia += distances[i];
+		}
+
+		batch_inertia /= n_batch;
+
+		float max_move = 0;
+
+		for (int c = 0; c < n_words; c++) {
+
+			max_move = std::max(max_move, squaredDistance(previous.ptr<float>(c), centers.ptr<float>(c), dims));
+		}
+
+		// during the first pass over the sample, codewords which never received a descriptor move to a random one
+		if (iterations % 10 == 0 && (int64_t)iterations * n_batch <= n_sampled) {
+
+			for (int c = 0; c < n_words; c++) {
+
+				if (counts[c] == 0) {
+
+					samples.row(rng.uniform(0, n_sampled)).copyTo(centers.row(c));
+				}
+			}
+		}
+
+		// early stopping
+		smoothed = smoothed < 0 ? batch_inertia : (1 - alpha) * smoothed + alpha * batch_inertia;
+
+		if (smoothed < best) {
+
+			best = smoothed;
+			no_improvement = 0;
+		}
+		else {
+
+			no_improvement++;
+		}
+
+		if ((patience > 0 && no_improvement >= patience) || (tolerance > 0 && max_move <= tolerance * variance)) {
+
+			break;
+		}
+	}
+
+	// inertia of the vocabulary on the whole sample
+	assign(samples, centers, words, distances);
+
+	for (int i = 0; i < n_sampled; i++) {
+
+		inertia += distances[i];
+	}
+
+	inertia /= n_sampled;
+	vocabulary = centers;
+
+	return true;
+}
+
+
+void Vocabulary_Builder::seedCenters(const cv::Mat& samples, cv::Mat& centers) {
+
+	TRACE_SCOPE("kmeans_seeding");
+
+	int n = samples.rows;
+	int dims = samples.cols;
+	centers.create(n_words, dims, CV_32F);
+
+	// squared distance of each sample to its nearest center
+	std::vector<float> min_distances(n, FLT_MAX);
+	samples.row(rng.uniform(0, n)).copyTo(centers.row(0));
+
+	for (int c = 1; c < n_words; c++) {
+
+		const float* last = centers.ptr<float>(c - 1);
+
+		cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& range) {
+
+			for (int i = range.start; i < range.end; i++) {
+
+				min_distances[i] = std::min(min_distances[i], squaredDistance(samples.ptr<float>(i), last, dims));
+			}
+		}, getStripes(n));
+
+		// next center drawn with probability proportional to the squared distance to the nearest center
+		double total = 0;
+
+		for (int i = 0; i < n; i++) {
+
+			total += min_distances[i];
+		}
+
+		double target = rng.uniform(0.0, 1.0) * total;
+		double cumulative = 0;
+		int next = n - 1;
+
+		for (int i = 0; i < n; i++) {
+
+			cumulative += min_distances[i];
+
+			if (cumulative > target) {
+
+				next = i;
+				break;
+			}
+		}
+
+		samples.row(next).copyTo(centers.row(c));
+	}
+}
+
+
+void Vocabulary_Builder::assign(const cv::Mat& samples, const cv::Mat& centers, std::vector<int>& words, std::vector<float>& distances) {
+
+	TRACE_SCOPE("kmeans_assign");
+
+	int n = samples.rows;
+	int dims = samples.cols;
+	words.resize(n);
+	distances.resize(n);
+
+	BOW_Extractor extractor;
+	extractor.setVocabulary(centers);
+
+	cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& range) {
+
+		std::vector<int> block_words;
+		extractor.assign(samples.rowRange(range.start, range.end), block_words);
+
+		for (int i = range.start; i < range.end; i++) {
+
+			words[i] = block_words[i - range.start];
+			distances[i] = squaredDistance(samples.ptr<float>(i), centers.ptr<float>(words[i]), dims);
+		}
+	}, getStripes(n));
+}
+
+
+int64_t Vocabulary_Builder::getSeen() const {
+
+	return n_seen;
+}
+
+
+int Vocabulary_Builder::getSampled() const {
+
+	return n_sampled;
+}
+
+
+int Vocabulary_Builder::getIterations() const {
+
+	return iterations;
+}
+
+
+double Vocabulary_Builder::getInertia() const {
+
+	return inertia;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+
+/*
+* Visual vocabulary builder based on mini-batch k-means, with bounded memory.
+*
+* Descriptors are streamed to add, one patch (or any block of rows) at a time; only a uniform random sample of at most
+* sample_size of them is kept (reservoir sampling), so memory does not grow with the size of the dataset. build then:
+*
+* - seeds the codewords with k-means++ on a subset of the sample;
+* - refines them with mini-batch k-means (Sculley, 2010): at each iteration a batch is drawn from the sample, each
+*   descriptor is assigned to its nearest codeword (in parallel, with the vectorized search of BOW_Extractor) and each
+*   codeword moves towards its descriptors with a learning rate decreasing with the number of descriptors it received;
+* - stops early when the smoothed batch inertia (mean squared distance of the descriptors to their codeword) has not
+*   improved for a number of iterations, or when codewords barely move.
+*
+* Codewords that receive no descriptor in the first iterations are moved to random descriptors of the sample.
+* All random choices come from a seeded generator, so the vocabulary only depends on the descriptors, their order and
+* the parameters, not on the number of threads.
+*/
+
+class Vocabulary_Builder {
+
+public:
+
+	/*
+	* Constructor.
+	*
+	* @param n_words		Number of codewords.
+	* @param sample_size	Maximum number of descriptors kept in memory.
+	* @param batch_size		Number of descriptors of each mini-batch.
+	* @param max_iterations	Maximum number of mini-batches.
+	* @param seed			Seed of the random generator.
+	*/
+	Vocabulary_Builder(int n_words = 300, int sample_size = 100000, int batch_size = 2048, int max_iterations = 1000, uint64_t seed = 12345);
+
+
+	/*
+	* Function to set the early stopping criteria.
+	*
+	* @param patience		Number of iterations without improvement of the smoothed inertia after which building stops
+	*						(0: disabled).
+	* @param tolerance		Building stops when the largest squared move of a codeword in an iteration is below this
+	*						fraction of the variance of the descriptors (0: disabled).
+	*/
+	void setEarlyStopping(int patience, double tolerance);
+
+
+	/*
+	* Function to add descriptors to the sample the vocabulary is built from.
+	*
+	* @param descriptors	Descriptors (CV_32F, one per row, all with the same size).
+	*/
+	void add(const cv::Mat& descriptors);
+
+
+	/*
+	* Function to build the vocabulary from the sampled descriptors.
+	*
+	* @param &vocabulary	n_words x descriptor size CV_32F matrix, one codeword per row.
+	*
+	* @return bool			Returns false if fewer descriptors than codewords were added.
+	*/
+	bool build(cv::Mat& vocabulary);
+
+
+	/*
+	* @return int64_t		Number of descriptors added.
+	*/
+	int64_t getSeen() const;
+
+
+	/*
+	* @return int			Number of descriptors kept in the sample.
+	*/
+	int getSampled() const;
+
+
+	/*
+	* @return int			Number of mini-batch iterations run by the last build.
+	*/
+	int getIterations() const;
+
+
+	/*
+	* @return double		Mean squared distance of the sampled descriptors to their nearest codeword, after the last build.
+	*/
+	double getInertia() const;
+
+private:
+
+	// k-means++ seeding on the first n rows of samples
+	void seedCenters(const cv::Mat& samples, cv::Mat& centers);
+
+	// nearest codeword of each row, and its squared distance, computed in parallel
+	static void assign(const cv::Mat& samples, const cv::Mat& centers, std::vector<int>& words, std::vector<float>& distances);
+
+	int n_words;
+	int sample_size;
+	int batch_size;
+	int max_iterations;
+	int patience;
+	double tolerance;
+
+	cv::RNG rng;
+
+	// reservoir of descriptors, first n_sampled rows are valid
+	cv::Mat sample;
+	int n_sampled;
+	int64_t n_seen;
+
+	int iterations;
+	double inertia;
+};
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include "Word_Integral_Image.h"
+
+Word_Integral_Image::Word_Integral_Image(int n_words, size_t max_entries, int min_cell_size)
+	: n_words(n_words), max_entries(max_entries), min_cell_size(std::max(min_cell_size, 1)),
+	  cell_size(0), grid_cols(0), grid_rows(0) {
+
+}
+
+
+void Word_Integral_Image::build(const std::vector<cv::KeyPoint>& keypoints, const std::vector<int>& words, cv::Size image_size) {
+
+	CV_Assert(keypoints.size() == words.size());
+
+	// choose the finest grid whose table fits in the memory budget
+	cell_size = min_cell_size;
+
+	while (true) {
+
+		grid_cols = std::max((image_size.width + cell_size - 1) / cell_size, 1);
+		grid_rows = std::max((image_size.height + cell_size - 1) / cell_size, 1);
+
+		size_t entries = (size_t)(grid_cols + 1) * (grid_rows + 1) * n_words;
+
+		if (entries <= max_entries || (grid_cols == 1 && grid_rows == 1)) {
+
+			break;
+		}
+
+		cell_size *= 2;
+	}
+
+	int stride = (grid_cols + 1) * n_words;
+	table.assign((size_t)(grid_rows + 1) * stride, 0);
+
+	// count keypoints of each word in each cell (stored shifted by one row and one column)
+	for (size_t i = 0; i < keypoints.size(); i++) {
+
+		int x = std::min(std::max(cvFloor(keypoints[i].pt.x), 0), image_size.width - 1);
+		int y = std::min(std::max(cvFloor(keypoints[i].pt.y), 0), image_size.height - 1);
+
+		int r = y / cell_size + 1;
+		int c = x / cell_size + 1;
+		table[(size_t)r * stride + c * n_words + words[i]]++;
+	}
+
+	// summed-area table: S(r, c) = count(r, c) + S(r - 1, c) + S(r, c - 1) - S(r - 1, c - 1)
+	for (int r = 1; r <= grid_rows; r++) {
+
+		int* row = &table[(size_t)r * stride];
+		const int* prev = &table[(size_t)(r - 1) * stride];
+
+		for (int c = 1; c <= grid_cols; c++) {
+
+			int* cur = row + c * n_words;
+			const int* left = row + (c - 1) * n_words;
+			const int* up = prev + c * n_words;
+			const int* up_left = prev + (c - 1) * n_words;
+
+			for (int w = 0; w < n_words; w++) {
+
+				cur[w] += up[w] + left[w] - up_left[w];
+			}
+		}
+	}
+
+	// keypoints on the same grid, for the cells partially covered by a query
+	border = Keypoint_Map(cell_size);
+	border.build(keypoints, words, image_size);
+}
+
+
+int Word_Integral_Image::computeHistogram(cv::Rect rect, cv::Mat& histogram) const {
+
+	if (table.empty()) {
+
+		histogram.release();
+		return 0;
+	}
+
+	histogram.create(1, n_words, CV_32F);
+	float* bins = histogram.ptr<float>();
+	int count = 0;
+
+	// block of cells fully covered by the rectangle
+	int c0 = std::max((rect.x + cell_size - 1) / cell_size, 0);
+	int r0 = std::max((rect.y + cell_size - 1) / cell_size, 0);
+	int c1 = std::min(std::max(rect.x + rect.width, 0) / cell_size, grid_cols);
+	int r1 = std::min(std::max(rect.y + rect.height, 0) / cell_size, grid_rows);
+
+	cv::Rect inner;
+
+	if (c1 > c0 && r1 > r0) {
+
+		inner = cv::Rect(c0, r0, c1 - c0, r1 - r0);
+
+		// four lookups per word
+		int stride = (grid_cols + 1) * n_words;
+		const int* a = &table[(size_t)r1 * stride + c1 * n_words];
+		const int* b = &table[(size_t)r0 * stride + c1 * n_words];
+		const int* c = &table[(size_t)r1 * stride + c0 * n_words];
+		const int* d = &table[(size_t)r0 * stride + c0 * n_words];
+
+		for (int w = 0; w < n_words; w++) {
+
+			int n = a[w] - b[w] - c[w] + d[w];
+			bins[w] = (float)n;
+			count += n;
+		}
+	}
+	else {
+
+		std::fill(bins, bins + n_words, 0.0f);
+	}
+
+	// keypoints lying in the cells only partially covered by the rectangle
+	std::vector<int> words;
+	border.getWords(rect, inner, words);
+
+	for (size_t i = 0; i < words.size(); i++) {
+
+		bins[words[i]] += 1.0f;
+	}
+
+	count += (int)words.size();
+
+	if (count == 0) {
+
+		histogram.release();
+		return 0;
+	}
+
+	// normalize by the number of keypoints, as cv::BOWImgDescriptorExtractor does
+	histogram /= (double)count;
+
+	return count;
+}
+
+
+int Word_Integral_Image::getCellSize() const {
+
+	return cell_size;
+}
+
+
+size_t Word_Integral_Image::memoryUsage() const {
+
+	return table.size() * sizeof(int);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/features2d.hpp>
+#include "Keypoint_Map.h"
+
+/*
+* Integral "visual-word image": a summed-area table of keypoint counts for every codeword of the vocabulary.
+*
+* Given the keypoints of an image, each one assigned to its visual word, it allows to compute the bag of words
+* descriptor of any rectangle with four lookups per word, independently of how many keypoints the rectangle holds.
+*
+* To keep memory bounded on large images the table is not built at pixel resolution: the image is divided in square
+* cells and counts are accumulated per cell. The side of the cells is the smallest power of two for which the table
+* fits in the given budget. Keypoints lying in the cells only partially covered by a query rectangle are retrieved
+* from a Keypoint_Map built on the same grid, so the histograms are exact (the same given by Keypoint_Map).
+*
+* The table is stored word-minor: the n_words counts of a grid corner are contiguous, so the four lookups of a query
+* are four contiguous rows which are combined in a single pass.
+*/
+
+class Word_Integral_Image {
+
+public:
+
+	/*
+	* Constructor.
+	*
+	* @param n_words		Number of codewords of the vocabulary.
+	* @param max_entries	Maximum number of counters of the summed-area table (memory budget, 4 bytes each).
+	* @param min_cell_size	Smallest side (in pixels) of the grid cells.
+	*/
+	Word_Integral_Image(int n_words, size_t max_entries = 1 << 22, int min_cell_size = 4);
+
+
+	/*
+	* Function to build the summed-area tables from the keypoints detected on an image.
+	*
+	* @param keypoints		Keypoints detected on the image.
+	* @param words			Visual word assigned to each keypoint (words[i] is the codeword of keypoints[i]).
+	* @param image_size		Size of the image the keypoints were detected on.
+	*/
+	void build(const std::vector<cv::KeyPoint>& keypoints, const std::vector<int>& words, cv::Size image_size);
+
+
+	/*
+	* Function to compute the bag of words descriptor of a rectangle, i.e. the normalized histogram of the
+	* visual words of the keypoints falling inside it.
+	*
+	* @param rect			Query rectangle (image coordinates).
+	* @param &histogram		1 x n_words CV_32F normalized histogram. Released if no keypoint falls inside rect.
+	*
+	* @return int			Number of keypoints inside rect.
+	*/
+	int computeHistogram(cv::Rect rect, cv::Mat& histogram) const;
+
+
+	/*
+	* @return int			Side (in pixels) of the grid cells chosen for the last built image.
+	*/
+	int getCellSize() const;
+
+
+	/*
+	* @return size_t		Memory (in bytes) used by the summed-area table.
+	*/
+	size_t memoryUsage() const;
+
+private:
+
+	int n_words;
+	size_t max_entries;
+	int min_cell_size;
+
+	// side of the grid cells and number of grid columns and rows
+	int cell_size;
+	int grid_cols;
+	int grid_rows;
+
+	// (grid_rows + 1) x (grid_cols + 1) x n_words counters: table[(r * (grid_cols + 1) + c) * n_words + w] is the number
+	// of keypoints assigned to word w lying in the cells above row r and left of column c
+	std::vector<int> table;
+
+	// keypoints indexed on the same grid, used for the cells partially covered by a query
+	Keypoint_Map border;
+};
@@ -3,8 +3,17 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/core/utils/filesystem.hpp>
 #include <opencv2/ximgproc/segmentation.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include "Bounded_Queue.h"
 #include "Detector_Utils.h"
+#include "Proposal_Cache.h"
+#include "Proposal_Generator.h"
+#include "Trace.h"
 
 /*
 * Program that prepares the dataset needed to train the classifier for boat detection.
@@ -15,23 +24,73 @@
 * Negative patches are built using a subset of the images classified as positive. Running the selective search segmentation,
 * we extract regions from each image and we use as negative patches the regions that have an intersection over union with each image's ground truth equal 
 * to zero. We will generate up to 4 patches for each image.
+* 
+* With option -proposal_cache, selective search proposals are read from (and stored to) the same cache directory used
+* by the boat detector, so that segmentation runs only once per image.
+* Regions are proposed by selective search unless another backend is chosen (option -proposals, see Proposal_Generator).
+*
+* Images are processed in parallel by a configurable number of workers (option -threads), while other threads encode
+* and write the patches (option -writers). Patches are named after their image, so the dataset is the same as the one
+* built by a single worker.
+* Selective search ranks its regions with the C library rand(), so its proposals depend on the images segmented before:
+* in that case workers generate (or load) proposals one image at a time, in image order, as a single worker would.
+* The region of each patch in its image is saved next to the patches (see Detector_Utils::savePatchRegions).
 */
 
 
 int main(int argc, char** argv) {
 
-	if (argc < 3) {
+	const cv::String keys =
+		"{help h usage ?    |       | print this message }"
+		"{@boat_path        |       | path to the images used to build positive samples }"
+		"{@annotations_path |       | path to the annotation files }"
+		"{proposals         | selective | proposal backend: selective, sliding or edges }"
+		"{proposal_cache    |       | directory of the cache of proposals }"
+		"{threads           | 0     | number of workers processing images in parallel (0: number of CPUs) }"
+		"{writers           | 2     | number of threads encoding and writing patches }"
+		"{trace             |       | Chrome trace file written at the end of the run (builds with BOAT_DETECTOR_TRACE only) }";
+
+	cv::CommandLineParser parser(argc, argv, keys);
+
+	if (parser.has("help") || !parser.has("@annotations_path")) {
 		
 		std::cout << "Some command line arguments are missing." << std::endl;
 		std::cout << "Pass as arguments: path to images used to build positive samples and ";
 		std::cout << "path to the annotation files." << std::endl;
+		parser.printMessage();
+		return -1;
+	}
+
+	const cv::String BOAT_PATH = parser.get<cv::String>("@boat_path");
+	const cv::String ANNOTATIONS_PATH = parser.get<cv::String>("@annotations_path");
+	const cv::String PROPOSALS = parser.get<cv::String>("proposals");
+	const cv::String PROPOSAL_CACHE = parser.get<cv::String>("proposal_cache");
+	const cv::String TRACE = parser.get<cv::String>("trace");
+	int THREADS = parser.get<int>("threads");
+	const int WRITERS = std::max(parser.get<int>("writers"), 1);
+
+	// patches waiting to be written
+	const int QUEUE_DEPTH = 64;
+
+	if (THREADS <= 0) {
+
+		THREADS = cv::getNumberOfCPUs();
+	}
+
+	cv::Ptr<Proposal_Generator> generator = Proposal_Generator::create(PROPOSALS, Detector_Utils::DATASET_MAX_PROPOSALS);
+
+	if (generator.empty()) {
+
+		std::cout << "Unknown proposal backend " << PROPOSALS << ". Use selective, sliding or edges." << std::endl;
 		return -1;
 	}
 
-	const cv::String BOAT_PATH = argv[1];
-	const cv::String ANNOTATIONS_PATH = argv[2];
+	if (!TRACE.empty() && !TRACE_ENABLED) {
+
+		std::cout << "Tracing is not compiled in, build with -DBOAT_DETECTOR_TRACE=ON to write " << TRACE << "." << std::endl;
+	}
 
-	//*********************************** POSITIVE SAMPLES ************************************//
+	TRACE_START(TRACE);
 
 	// Load annotation files
 
@@ -45,100 +104,234 @@ int main(int argc, char** argv) {
 		std::cout << "Error occurred while loading annotations files." << std::endl;
 		return -1;
 	}
-		
-	std::cout << "Generating positive examples..." << std::endl;
+
+	std::cout << "Generating positive and negative examples (" << THREADS << " workers, " << WRITERS << " writers)..." << std::endl;
 
 	// create directory in which positive examples are going to be saved
 	const cv::String BOAT_PATCHES_DIR = "../../BOATS";
 	cv::utils::fs::createDirectory(BOAT_PATCHES_DIR);
 	const cv::String BOAT_PATCHES_PATH = BOAT_PATCHES_DIR + "/";
-	
-	std::vector<cv::String> image_name;
-	std::vector<std::vector<cv::Rect>> ground_truth(filenames.size());
-	std::vector<cv::Mat> images;
-	std::vector<cv::Mat> patches;
 
-	for (int i = 0; i < filenames.size(); i++) {
+	// create directory in which negative examples are going to be saved
+	const cv::String NONBOAT_PATCHES_DIR = "../../NONBOATS";
+	cv::utils::fs::createDirectory(NONBOAT_PATCHES_DIR);
+	const cv::String NONBOAT_PATCHES_PATH = NONBOAT_PATCHES_DIR + "/";
 
-		std::cout << "Processing " << filenames[i] << " ..." << std::endl;
+	// proposals computed on previous runs (of this program or of the detector) are read from the cache, if any
+	cv::Ptr<Proposal_Cache> proposal_cache;
+	const cv::String PROPOSALS_KEY = generator->getKey();
 
-		// extract the "name" of each image (e.g. image0001)
-		image_name.push_back(Detector_Utils::getImageName(filenames[i], ANNOTATIONS_PATH, ".txt"));
+	if (!PROPOSAL_CACHE.empty()) {
 
-		// build the path to the image corresponding to the current annotation file
-		cv::String image_path = BOAT_PATH + image_name[i] + ".png";
+		proposal_cache = cv::makePtr<Proposal_Cache>(PROPOSAL_CACHE);
+	}
 
-		// read in image
-		cv::Mat image = cv::imread(image_path);
-		images.push_back(image);
+	// patches are encoded and written by their own threads, so that PNG encoding overlaps with segmentation.
+	// each patch is named after its image and its index in the image, so the output does not depend on the order
+	// images are processed in
+	Bounded_Queue<std::pair<cv::String, cv::Mat>> written(QUEUE_DEPTH);
+	std::vector<std::thread> writers;
 
-		// parse annotation file and get ground truth boxes
-		ground_truth[i] = Detector_Utils::getGroundTruth(filenames[i]);
+	for (int t = 0; t < WRITERS; t++) {
 
-		// extract boat patches according to ground truth
-		Detector_Utils::getPatches(ground_truth[i], image, patches);
+		writers.push_back(std::thread([&written]() {
 
-		// process boat patches (grayscale + CLAHE equalization)
-		Detector_Utils::processPatches(patches);
+			std::pair<cv::String, cv::Mat> item;
 
-		// save boat patches to the desired path
-		Detector_Utils::savePatches(patches, image_name[i], BOAT_PATCHES_PATH);
+			while (written.pop(item)) {
+
+				cv::imwrite(item.first, item.second);
+			}
+		}));
 	}
 
-	std::cout << "Positive examples generated!!" << std::endl;
+	// each worker takes the next image, builds its positive patches and, for one image out of two, its negative patches
+	std::atomic<int> next_image(0);
+	std::atomic<int> n_failed(0);
+	std::mutex print_mutex;
+	std::vector<std::thread> workers;
 
-	//******************************** NEGATIVE SAMPLES ************************************//
+	// region of the patches of each image, saved next to the patches once all the images are processed
+	std::vector<cv::String> image_names(filenames.size());
+	std::vector<std::vector<cv::Rect>> boat_regions(filenames.size());
+	std::vector<std::vector<cv::Rect>> nonboat_regions(filenames.size());
 
-	// run selective search on positive images and use as negatives the patches that have an intersection over union
-	// with positive patches which is equal to zero 
+	// when proposals depend on the calls made before, negative images take their turn to get proposals in image order
+	const bool ORDERED_PROPOSALS = generator->dependsOnCallOrder();
+	std::mutex turn_mutex;
+	std::condition_variable turn_changed;
+	int proposal_turn = 0;
 
-	std::vector<cv::Rect> proposals;
-	std::vector<cv::Rect> neg_rects;
+	auto waitTurn = [&](int i) {
 
-	// create directory in which negative examples are going to be saved
-	const cv::String NONBOAT_PATCHES_DIR = "../../NONBOATS";
-	cv::utils::fs::createDirectory(NONBOAT_PATCHES_DIR);
-	const cv::String NONBOAT_PATCHES_PATH = NONBOAT_PATCHES_DIR + "/";
+		if (ORDERED_PROPOSALS) {
 
-	cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentation> ss;
-	ss = cv::ximgproc::segmentation::createSelectiveSearchSegmentation();
+			std::unique_lock<std::mutex> lock(turn_mutex);
+			turn_changed.wait(lock, [&]() { return proposal_turn == i; });
+		}
+	};
 
-	for (int i = 0; i < images.size(); i+=2) {
+	auto passTurn = [&](int i) {
 
-		std::cout << "Processing image " << filenames[i] << "..." << std::endl;
+		if (ORDERED_PROPOSALS) {
 
-		proposals = Detector_Utils::getProposals(images[i], ss, 2000);
-		
-		neg_rects.clear();
-		int count = 0;
+			{
+				std::lock_guard<std::mutex> lock(turn_mutex);
+				proposal_turn = i + 2;
+			}
+			turn_changed.notify_all();
+		}
+	};
+
+	for (int t = 0; t < THREADS; t++) {
+
+		workers.push_back(std::thread([&]() {
+
+			std::vector<cv::Mat> patches;
+			std::vector<cv::Rect> proposals;
+			std::vector<cv::Rect> neg_rects;
+
+			for (int i = next_image++; i < filenames.size(); i = next_image++) {
+
+				// extract the "name" of each image (e.g. image0001)
+				cv::String image_name = Detector_Utils::getImageName(filenames[i], ANNOTATIONS_PATH, ".txt");
+
+				{
+					std::lock_guard<std::mutex> lock(print_mutex);
+					std::cout << "Processing " << filenames[i] << " ..." << std::endl;
+				}
+
+				// read in the image corresponding to the current annotation file
+				cv::Mat image = cv::imread(BOAT_PATH + image_name + ".png");
+
+				if (image.empty()) {
+
+					std::lock_guard<std::mutex> lock(print_mutex);
+					std::cout << "Error occurred while reading image " << image_name << "." << std::endl;
+					n_failed++;
+
+					if (i % 2 == 0) {
 
-		for (int j = 0; count < 4 && j < proposals.size(); j++) {
-			
-			bool negative = true;
+						waitTurn(i);
+						passTurn(i);
+					}
+					continue;
+				}
+
+				// parse annotation file and get ground truth boxes
+				std::vector<cv::Rect> ground_truth = Detector_Utils::getGroundTruth(filenames[i]);
+				image_names[i] = image_name;
+				boat_regions[i] = ground_truth;
+
+				cv::Mat gray;
+				cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+
+				//*********************************** POSITIVE SAMPLES ************************************//
+
+				{
+					TRACE_SCOPE("positive_patches");
+
+					// extract boat patches according to ground truth and process them (grayscale + CLAHE equalization)
+					Detector_Utils::processPatches(gray, ground_truth, patches);
+				}
+
+				// save boat patches to the desired path
+				for (int j = 0; j < patches.size(); j++) {
+
+					written.push(std::make_pair(Detector_Utils::getPatchPath(BOAT_PATCHES_PATH, image_name, j), patches[j]));
+				}
+
+				//******************************** NEGATIVE SAMPLES ************************************//
 
-			//proposals that do not overlap with ground_truth are negatives
-			for (int k = 0; k < ground_truth[i].size(); k++) {
+				// run selective search on a subset of the positive images and use as negatives the patches that have
+				// an intersection over union with positive patches which is equal to zero
+				if (i % 2 != 0) {
 
-				float iou = Detector_Utils::intersectionOverUnion(proposals[j], ground_truth[i][k]);
+					continue;
+				}
+
+				{
+					TRACE_SCOPE("negative_patches");
+
+					waitTurn(i);
+
+					// the image is hashed once, for the lookup and (on a miss) for the new entry
+					uint64_t image_hash = proposal_cache ? Proposal_Cache::hashImage(image) : 0;
+
+					if (!proposal_cache || !proposal_cache->load(image_hash, PROPOSALS_KEY, proposals)) {
+
+						generator->generate(image, proposals);
+						TRACE_COUNT("proposals_generated", (int64_t)proposals.size());
 
-				if (iou > 0) {
+						if (proposal_cache) {
 
-					negative = false;
-					break;
+							proposal_cache->store(image_hash, PROPOSALS_KEY, proposals);
+						}
+					}
+
+					passTurn(i);
+
+					// up to 4 negatives per image
+					Detector_Utils::getNegativeRects(proposals, ground_truth, Detector_Utils::DATASET_NEGATIVES, neg_rects);
+					nonboat_regions[i] = neg_rects;
+
+					// process negative patches
+					Detector_Utils::processPatches(gray, neg_rects, patches);
+					TRACE_COUNT("negative_patches", (int64_t)neg_rects.size());
+				}
+
+				// save negative patches
+				for (int j = 0; j < patches.size(); j++) {
+
+					written.push(std::make_pair(Detector_Utils::getPatchPath(NONBOAT_PATCHES_PATH, image_name, j), patches[j]));
 				}
 			}
+		}));
+	}
+
+	for (int t = 0; t < workers.size(); t++) {
+
+		workers[t].join();
+	}
+
+	// writers drain the queue before stopping
+	written.close();
+
+	for (int t = 0; t < writers.size(); t++) {
+
+		writers[t].join();
+	}
+
+	// the training program locates each patch in its image from these files (rejection cascade calibration)
+	auto saveRegions = [&](const cv::String& patches_path, const std::vector<std::vector<cv::Rect>>& regions) {
+
+		std::vector<cv::String> names;
+		std::vector<cv::Rect> rects;
 
-			if (negative) {
-			
-				neg_rects.push_back(proposals[j]);
-				count++;
+		for (int i = 0; i < regions.size(); i++) {
+
+			for (int j = 0; j < regions[i].size(); j++) {
+
+				names.push_back(image_names[i] + "_" + std::to_string(j));
+				rects.push_back(regions[i][j]);
 			}
 		}
-		
-		// process and save negative patches
-		Detector_Utils::getPatches(neg_rects, images[i], patches);
-		Detector_Utils::processPatches(patches);
-		Detector_Utils::savePatches(patches, image_name[i], NONBOAT_PATCHES_PATH);
+
+		if (!Detector_Utils::savePatchRegions(Detector_Utils::getPatchRegionsPath(patches_path), names, rects)) {
+
+			std::cout << "Error occurred while saving the regions of the patches in " << patches_path << "." << std::endl;
+		}
+	};
+
+	saveRegions(BOAT_PATCHES_PATH, boat_regions);
+	saveRegions(NONBOAT_PATCHES_PATH, nonboat_regions);
+
+	if (n_failed > 0) {
+
+		std::cout << n_failed << " images could not be read." << std::endl;
 	}
 
+	std::cout << "Positive and negative examples generated!!" << std::endl;
+
+	TRACE_FINISH(std::cout);
 }
\ No newline at end of file
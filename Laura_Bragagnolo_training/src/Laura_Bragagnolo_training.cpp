@@ -5,8 +5,433 @@
 #include <opencv2/core/utils/filesystem.hpp>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <map>
 #include <opencv2/ml.hpp>
 #include "Detector_Utils.h"
+#include "BOW_Extractor.h"
+#include "Batch_SVM.h"
+#include "Feature_Map.h"
+#include "Proposal_Cascade.h"
+#include "Model_Bundle.h"
+#include "Vocabulary_Builder.h"
+#include "SVM_Grid_Search.h"
+#include "Descriptor_Store.h"
+#include "Trace.h"
+
+/*
+* Function to train a C-SVC on a set of bag of words descriptors, tuning its parameters with 10-fold cross validation.
+*
+* @param samples		Bag of words descriptors, one per row.
+* @param labels			Labels of the descriptors.
+* @param kernel			SVM kernel (cv::ml::SVM::RBF or cv::ml::SVM::LINEAR).
+* @param feature_map	Explicit feature map applied to the descriptors before training.
+* @param *grid_search	If provided, parameters are searched with it instead of cv::ml::SVM::trainAuto.
+*
+* @return cv::Ptr<cv::ml::SVM>	Trained SVM.
+*/
+static cv::Ptr<cv::ml::SVM> trainSVM(const cv::Mat& samples, const cv::Mat& labels, int kernel, Feature_Map::Type feature_map,
+									const SVM_Grid_Search* grid_search) {
+
+	TRACE_SCOPE("svm_training");
+
+	cv::Mat mapped;
+	Feature_Map::apply(samples, mapped, feature_map);
+
+	cv::Ptr<cv::ml::SVM> svm = cv::ml::SVM::create();
+
+	cv::Ptr<cv::ml::TrainData> dataset = cv::ml::TrainData::create(mapped, cv::ml::SampleTypes::ROW_SAMPLE, labels);
+
+	// C-Support Vector Classification
+	// allows imperfect separation of classes, applying a penalty C on outliers
+	svm->setType(cv::ml::SVM::C_SVC);
+
+	// Radial Basis Function kernel, or linear kernel on mapped descriptors
+	svm->setKernel(kernel);
+
+	svm->setTermCriteria(cv::TermCriteria(cv::TermCriteria::MAX_ITER + cv::TermCriteria::EPS, 10000, 1e-6));
+
+	if (grid_search) {
+
+		// same grids and folds as trainAuto, but folds and values of C are evaluated concurrently on a cached kernel
+		SVM_Grid_Search::Result result = grid_search->search(mapped, labels, kernel);
+
+		std::cout << "Cross validation: C = " << result.C;
+		std::cout << (kernel == cv::ml::SVM::RBF ? ", gamma = " + std::to_string(result.gamma) : "");
+		std::cout << ", error " << 100.0 * result.error << "%" << std::endl;
+
+		// the final model is trained on all the samples with the chosen parameters
+		svm->setC(result.C);
+		svm->setGamma(result.gamma);
+		svm->train(dataset);
+
+		return svm;
+	}
+
+	// train SVM model tuning in an optimal way the different parameters. 
+	// this is done performing k-fold cross validation with k = 10 (default value) using a grid of standard values for each parameter.
+	// in the end, the model which performs better is chosen.
+	svm->trainAuto(dataset);
+
+	return svm;
+}
+
+
+// parameters of the SIFT descriptors computed by computeDescriptors (defaults of cv::SIFT::create, on color patches),
+// descriptors computed with other parameters are not read from the descriptor store
+static const cv::String SIFT_PARAMS = "sift features=0 octave_layers=3 contrast=0.04 edge=10 sigma=1.6 color";
+
+
+/*
+* Function to compute the SIFT descriptors of a range of patches in parallel.
+* Descriptors of the patches found in the store are read from it; the other patches are read and described by workers,
+* each one owning a SIFT detector and a contiguous block of patches, whose descriptors are written to their own slots,
+* so that results do not depend on how patches are split among workers. New descriptors are added to the store.
+*
+* @param files				Paths to the patches.
+* @param range				Range of patches to describe.
+* @param *store				Store of descriptors (if not provided, all the patches are described).
+* @param &descriptors		SIFT descriptors of each patch of the range (empty if no keypoint is found).
+* @param &missing			Index in the range of the patches described (not found in the store).
+*/
+static void computeDescriptors(const std::vector<cv::String>& files, const cv::Range& range, Descriptor_Store* store,
+							std::vector<cv::Mat>& descriptors, std::vector<int>& missing) {
+
+	descriptors.assign(range.size(), cv::Mat());
+	missing.clear();
+
+	for (int k = 0; k < range.size(); k++) {
+
+		if (!store || !store->find(files[range.start + k], descriptors[k])) {
+
+			missing.push_back(k);
+		}
+	}
+
+	int n = (int)missing.size();
+
+	// a few blocks per thread, since the number of keypoints (and the time) varies a lot among patches
+	double n_stripes = std::max(std::min(4 * cv::getNumThreads(), n), 1);
+
+	cv::parallel_for_(cv::Range(0, n), [&](const cv::Range& block) {
+
+		cv::Ptr<cv::SIFT> detector = cv::SIFT::create();
+		std::vector<cv::KeyPoint> keypoints;
+
+		for (int m = block.start; m < block.end; m++) {
+
+			TRACE_SCOPE("sift");
+
+			// patches are decoded only when they are described, and released right after
+			int k = missing[m];
+			cv::Mat patch = cv::imread(files[range.start + k]);
+
+			// detect sift features and compute descriptors
+			detector->detectAndCompute(patch, cv::Mat(), keypoints, descriptors[k]);
+		}
+	}, n_stripes);
+
+	if (store) {
+
+		for (int m = 0; m < n; m++) {
+
+			store->add(files[range.start + missing[m]], descriptors[missing[m]]);
+		}
+	}
+}
+
+
+/*
+* Function to describe a set of patches in batches, so that the descriptors of only one batch are in memory at a time.
+* The size of each batch is chosen so that its descriptors fit in the given memory, according to the memory taken per
+* patch by the previous batch. Descriptors read from the store are views of its mapping and take no memory of their own,
+* so only the descriptors computed by the batch are counted, and batches grow as more patches are found in the store.
+*
+* @param files				Paths to the patches.
+* @param *store				Store of descriptors (if not provided, all the patches are described).
+* @param budget				Memory allowed for the descriptors of a batch (bytes).
+* @param consume			Function called in patch order with the index of the first patch of each batch and the
+*							descriptors of its patches.
+*
+* @return int				Number of patches described (not found in the store).
+*/
+static int describeInBatches(const std::vector<cv::String>& files, Descriptor_Store* store, size_t budget,
+							std::function<void(int, const std::vector<cv::Mat>&)> consume) {
+
+	int n_described = 0;
+	int n_files = (int)files.size();
+
+	// bytes taken by the descriptors of a patch, estimated on the previous batch
+	double patch_bytes = 64 * 1024;
+	std::vector<cv::Mat> descriptors;
+	std::vector<int> described;
+
+	for (int first = 0; first < n_files; ) {
+
+		int n = (int)std::min<double>(std::max(budget / patch_bytes, 1.0), n_files - first);
+		computeDescriptors(files, cv::Range(first, first + n), store, descriptors, described);
+		n_described += (int)described.size();
+
+		// new descriptors are written to the store at each batch, so that they do not pile up in memory
+		if (store && !store->flush()) {
+
+			std::cout << "The descriptors could not be written to the descriptor store." << std::endl;
+		}
+
+		// only new descriptors take memory, the others are views of the store
+		size_t bytes = 0;
+
+		for (int m = 0; m < described.size(); m++) {
+
+			bytes += descriptors[described[m]].total() * descriptors[described[m]].elemSize();
+		}
+
+		patch_bytes = std::max(bytes / (double)n, 1024.0);
+
+		consume(first, descriptors);
+		first += n;
+	}
+
+	return n_described;
+}
+
+
+/*
+* Function to get the name of a file, without its directory and its extension.
+*
+* @param filename		Path to the file.
+*
+* @return cv::String	Name of the file.
+*/
+static cv::String getBaseName(const cv::String& filename) {
+
+	size_t separator = filename.find_last_of("/\\");
+	cv::String name = separator == cv::String::npos ? filename : filename.substr(separator + 1);
+
+	return name.substr(0, name.find_last_of('.'));
+}
+
+
+/*
+* Function to get the image a patch was cropped from, from the name given to the patch by the dataset preparation
+* (see Detector_Utils::getPatchPath).
+*
+* @param filename		Path to the patch.
+* @param &image_name	Name of the image (e.g. image0001).
+*
+* @return bool			Returns false if the name does not follow the naming of the dataset preparation.
+*/
+static bool getPatchImageName(const cv::String& filename, cv::String& image_name) {
+
+	cv::String name = getBaseName(filename);
+	size_t underscore = name.find_last_of('_');
+
+	if (underscore == cv::String::npos || underscore + 1 == name.size()) {
+
+		return false;
+	}
+
+	image_name = name.substr(0, underscore);
+
+	return true;
+}
+
+
+/*
+* Function to compute the first stage features of the rejection cascade of the patches as the detector computes them
+* on a proposal: on the whole processed image (Detector_Utils::processImage), in the region of the patch. The region of
+* each patch is read from the file the dataset preparation writes next to the patches (Detector_Utils::savePatchRegions),
+* so no proposal is computed again.
+*
+* A patch is located only if its region is listed and lies inside its image, otherwise (e.g. patches built by an older
+* dataset preparation) its features are not computed.
+*
+* @param files					Paths to the patches.
+* @param n_pos					Number of positive patches (the first ones).
+* @param boat_patches_path		Path to the positive patches.
+* @param nonboat_patches_path	Path to the negative patches.
+* @param images_path			Path to the images the patches were cropped from.
+* @param &features				N x Proposal_Cascade::N_FEATURES features, one row per patch.
+* @param &located				For each patch, 1 if it was located in its image and its features computed.
+*/
+static void computeCascadeFeatures(const std::vector<cv::String>& files, int n_pos, const cv::String& boat_patches_path,
+								const cv::String& nonboat_patches_path, const cv::String& images_path, cv::Mat& features,
+								std::vector<uchar>& located) {
+
+	features.create((int)files.size(), Proposal_Cascade::N_FEATURES, CV_32F);
+	features.setTo(0);
+	located.assign(files.size(), 0);
+
+	// positive and negative patches of an image share their names, so their regions are kept apart
+	std::map<cv::String, cv::Rect> boat_regions, nonboat_regions;
+	Detector_Utils::loadPatchRegions(Detector_Utils::getPatchRegionsPath(boat_patches_path), boat_regions);
+	Detector_Utils::loadPatchRegions(Detector_Utils::getPatchRegionsPath(nonboat_patches_path), nonboat_regions);
+
+	// patches of each image, with their region
+	std::map<cv::String, int> images;
+	std::vector<cv::String> image_names;
+	std::vector<std::vector<std::pair<int, cv::Rect>>> image_patches;
+
+	for (int i = 0; i < files.size(); i++) {
+
+		const std::map<cv::String, cv::Rect>& regions = i < n_pos ? boat_regions : nonboat_regions;
+		std::map<cv::String, cv::Rect>::const_iterator region = regions.find(getBaseName(files[i]));
+		cv::String image_name;
+
+		if (region == regions.end() || !getPatchImageName(files[i], image_name)) {
+
+			continue;
+		}
+
+		if (!images.count(image_name)) {
+
+			images[image_name] = (int)image_names.size();
+			image_names.push_back(image_name);
+			image_patches.push_back(std::vector<std::pair<int, cv::Rect>>());
+		}
+
+		image_patches[images[image_name]].push_back(std::make_pair(i, region->second));
+	}
+
+	cv::parallel_for_(cv::Range(0, (int)image_names.size()), [&](const cv::Range& range) {
+
+		cv::Mat processed, image_features;
+
+		for (int a = range.start; a < range.end; a++) {
+
+			// same path as in the dataset preparation
+			cv::Mat image = cv::imread(images_path + image_names[a] + ".png");
+
+			if (image.empty()) {
+
+				continue;
+			}
+
+			cv::Rect image_rect(0, 0, image.cols, image.rows);
+			std::vector<cv::Rect> rects;
+			std::vector<int> rect_patches;
+
+			for (int p = 0; p < image_patches[a].size(); p++) {
+
+				const cv::Rect& rect = image_patches[a][p].second;
+
+				if (rect.area() > 0 && (rect & image_rect) == rect) {
+
+					rects.push_back(rect);
+					rect_patches.push_back(image_patches[a][p].first);
+				}
+			}
+
+			Detector_Utils::processImage(image, processed);
+			Proposal_Cascade::computeFeatures(processed, rects, image_features);
+
+			for (int r = 0; r < rects.size(); r++) {
+
+				image_features.row(r).copyTo(features.row(rect_patches[r]));
+				located[rect_patches[r]] = 1;
+			}
+		}
+	});
+}
+
+
+/*
+* Function to split a labelled set of samples in a training set and a held-out set.
+* Samples are shuffled with a fixed seed, so that different runs use the same split.
+*
+* @param samples			Samples, one per row.
+* @param labels				Labels of the samples.
+* @param holdout			Fraction of samples to hold out.
+* @param &train_samples		Samples used for training.
+* @param &train_labels		Labels of the training samples.
+* @param &test_samples		Held-out samples.
+* @param &test_labels		Labels of the held-out samples.
+*/
+static void splitSamples(const cv::Mat& samples, const cv::Mat& labels, float holdout, cv::Mat& train_samples, cv::Mat& train_labels,
+						cv::Mat& test_samples, cv::Mat& test_labels) {
+
+	std::vector<int> idxs(samples.rows);
+
+	for (int i = 0; i < samples.rows; i++) {
+
+		idxs[i] = i;
+	}
+
+	cv::RNG rng(12345);
+	cv::randShuffle(idxs, 1, &rng);
+
+	int n_test = cvRound(samples.rows * holdout);
+
+	train_samples.release();
+	train_labels.release();
+	test_samples.release();
+	test_labels.release();
+
+	for (int i = 0; i < samples.rows; i++) {
+
+		if (i < n_test) {
+
+			test_samples.push_back(samples.row(idxs[i]));
+			test_labels.push_back(labels.row(idxs[i]));
+		}
+		else {
+
+			train_samples.push_back(samples.row(idxs[i]));
+			train_labels.push_back(labels.row(idxs[i]));
+		}
+	}
+}
+
+
+/*
+* Function to report accuracy and prediction time of a model on held-out samples.
+*
+* @param name			Name of the model.
+* @param model			Trained model.
+* @param samples		Held-out samples, one per row.
+* @param labels			Labels of the held-out samples.
+*/
+static void reportModel(const cv::String& name, const Batch_SVM& model, const cv::Mat& samples, const cv::Mat& labels) {
+
+	cv::Mat responses, decision_values;
+	cv::TickMeter batch_timer, single_timer;
+
+	// all held-out samples at once, as the detector does
+	batch_timer.start();
+	model.predict(samples, responses, decision_values);
+	batch_timer.stop();
+
+	// one sample at a time with cv::ml::SVM::predict
+	cv::Mat mapped;
+	Feature_Map::apply(samples, mapped, model.getFeatureMap());
+
+	single_timer.start();
+	for (int i = 0; i < mapped.rows; i++) {
+
+		model.getModel()->predict(mapped.row(i));
+	}
+	single_timer.stop();
+
+	int correct = 0;
+	cv::Mat expected;
+	labels.convertTo(expected, CV_32F);
+
+	for (int i = 0; i < samples.rows; i++) {
+
+		if (responses.at<float>(i) == expected.at<float>(i)) {
+
+			correct++;
+		}
+	}
+
+	int n = std::max(samples.rows, 1);
+
+	std::cout << name << ": accuracy " << 100.0 * correct / n << "%, ";
+	std::cout << model.getSupportVectorCount() << " support vectors, ";
+	std::cout << 1000.0 * batch_timer.getTimeMilli() / n << " us/sample batched, ";
+	std::cout << 1000.0 * single_timer.getTimeMilli() / n << " us/sample one by one" << std::endl;
+}
+
 
 /*
 * Program that performs the training of the boat detector (bag-of-words + SVM)
@@ -20,18 +445,139 @@
 * 
 * Finally, the labelled set of bag-of-words descriptors is fed to an SVM with a non-linear kernel (RBF), which will
 * come up with an hypothesis that classifies the data in two classes: boat (1) or non-boat (0).
+* Alternatively (option -classifier=linear), the descriptors are transformed with an explicit feature map and fed to a
+* linear SVM, whose prediction costs a single dot product.
+* 
+* With option -cascade_recall, the thresholds of the rejection cascade run by the detector before the classifier
+* (see Proposal_Cascade) are calibrated on the positive patches so that the given fraction of them passes each stage,
+* and the fraction of negative patches that would reach the final SVM is reported. First stage features are computed
+* on the images the patches were cropped from (option -images), in the regions the dataset preparation recorded for
+* the patches, as the detector computes them.
 */
 int main(int argc, char** argv) {
 
-	if (argc < 3) {
+	const cv::String keys =
+		"{help h usage ?    |       | print this message }"
+		"{@boat_patches     |       | path to the positive patches }"
+		"{@nonboat_patches  |       | path to the negative patches }"
+		"{classifier        | rbf   | rbf (kernel SVM) or linear (linear SVM on explicitly mapped descriptors, faster prediction) }"
+		"{feature_map       | auto  | feature map applied to the descriptors: none, hellinger or chi2 (auto: none for rbf, hellinger for linear) }"
+		"{holdout           | 0     | fraction of samples held out to report accuracy and prediction speed (0: train on all samples) }"
+		"{compare           | false | with holdout > 0, also train the other classifier on the same split and report both }"
+		"{cascade_recall    | 0     | if greater than 0, calibrate the rejection cascade (cascade.yml) to keep this fraction of positives }"
+		"{cascade_linear    | false | add to the cascade a linear SVM stage (cascade_linear.yml, next to cascade.yml) run before the rbf classifier }"
+		"{images            |       | with cascade_recall, path to the images the patches were cropped from }"
+		"{n_words           | 300   | number of visual words of the vocabulary }"
+		"{descriptor_store  | ../../descriptors | directory of the store of SIFT descriptors of the patches, reused by later runs (empty: temporary store removed at the end of the run) }"
+		"{memory_mb         | 2048  | memory budget of the descriptors of the patches (MB), which are described in batches }"
+		"{kmeans_sample     | 100000 | maximum number of SIFT descriptors kept in memory to build the vocabulary }"
+		"{kmeans_batch      | 2048  | number of descriptors of each mini-batch k-means iteration }"
+		"{kmeans_iterations | 1000  | maximum number of mini-batch k-means iterations (it stops earlier once converged) }"
+		"{svm_search        | opencv | parameter search of the SVM: opencv (trainAuto) or cached (parallel, on a cached kernel matrix) }"
+		"{svm_refine        | false | with svm_search=cached, refine the search with a finer grid around the best parameters }"
+		"{svm_cache_mb      | 4096  | maximum memory of the kernel cache of svm_search=cached (MB), trainAuto is used above }"
+		"{threads           | 0     | number of threads computing SIFT descriptors and searching SVM parameters (0: number of CPUs) }"
+		"{trace             |       | Chrome trace file written at the end of the training (builds with BOAT_DETECTOR_TRACE only) }";
+
+	cv::CommandLineParser parser(argc, argv, keys);
+
+	if (parser.has("help") || !parser.has("@nonboat_patches")) {
 
 		std::cout << "Command line arguments are missing." << std::endl;
 		std::cout << "Provide path to the positive patches and the path to the negative patches." << std::endl;
+		parser.printMessage();
+		return -1;
+	}
+
+	cv::String BOAT_PATCHES_PATH = parser.get<cv::String>("@boat_patches");
+	cv::String NONBOAT_PATCHES_PATH = parser.get<cv::String>("@nonboat_patches");
+	cv::String CLASSIFIER = parser.get<cv::String>("classifier");
+	cv::String FEATURE_MAP = parser.get<cv::String>("feature_map");
+	float HOLDOUT = parser.get<float>("holdout");
+	bool COMPARE = parser.get<bool>("compare");
+	double CASCADE_RECALL = parser.get<double>("cascade_recall");
+	bool CASCADE_LINEAR = parser.get<bool>("cascade_linear");
+	cv::String IMAGES_PATH = parser.get<cv::String>("images");
+	int N_WORDS = parser.get<int>("n_words");
+	cv::String DESCRIPTOR_STORE = parser.get<cv::String>("descriptor_store");
+	int MEMORY_MB = parser.get<int>("memory_mb");
+	int KMEANS_SAMPLE = parser.get<int>("kmeans_sample");
+	int KMEANS_BATCH = parser.get<int>("kmeans_batch");
+	int KMEANS_ITERATIONS = parser.get<int>("kmeans_iterations");
+	cv::String SVM_SEARCH = parser.get<cv::String>("svm_search");
+	bool SVM_REFINE = parser.get<bool>("svm_refine");
+	double SVM_CACHE_MB = parser.get<double>("svm_cache_mb");
+	int THREADS = parser.get<int>("threads");
+	cv::String TRACE = parser.get<cv::String>("trace");
+
+	if (CLASSIFIER != "rbf" && CLASSIFIER != "linear") {
+
+		std::cout << "Unknown classifier " << CLASSIFIER << ". Use rbf or linear." << std::endl;
+		return -1;
+	}
+
+	if (FEATURE_MAP == "auto") {
+
+		FEATURE_MAP = CLASSIFIER == "rbf" ? "none" : "hellinger";
+	}
+
+	Feature_Map::Type feature_map;
+
+	if (!Feature_Map::parse(FEATURE_MAP, feature_map)) {
+
+		std::cout << "Unknown feature map " << FEATURE_MAP << ". Use none, hellinger or chi2." << std::endl;
+		return -1;
+	}
+
+	if (CASCADE_RECALL < 0 || CASCADE_RECALL > 1) {
+
+		std::cout << "The recall of the cascade must be in [0, 1]." << std::endl;
+		return -1;
+	}
+
+	if (CASCADE_RECALL > 0 && IMAGES_PATH.empty()) {
+
+		std::cout << "The cascade is calibrated on the images the patches were cropped from, provide -images." << std::endl;
+		return -1;
+	}
+
+	if (HOLDOUT < 0 || HOLDOUT >= 1) {
+
+		std::cout << "The held-out fraction must be in [0, 1)." << std::endl;
+		return -1;
+	}
+
+	if (!TRACE.empty() && !TRACE_ENABLED) {
+
+		std::cout << "Tracing is not compiled in, build with -DBOAT_DETECTOR_TRACE=ON to write " << TRACE << "." << std::endl;
+	}
+
+	if (SVM_SEARCH != "opencv" && SVM_SEARCH != "cached") {
+
+		std::cout << "Unknown SVM parameter search " << SVM_SEARCH << ". Use opencv or cached." << std::endl;
+		return -1;
+	}
+
+	if (N_WORDS <= 0) {
+
+		std::cout << "The number of visual words must be positive." << std::endl;
 		return -1;
 	}
 
-	cv::String BOAT_PATCHES_PATH = argv[1];
-	cv::String NONBOAT_PATCHES_PATH = argv[2];
+	if (MEMORY_MB <= 0 || KMEANS_SAMPLE <= 0 || KMEANS_BATCH <= 0 || KMEANS_ITERATIONS <= 0) {
+
+		std::cout << "The memory budget, k-means sample size, batch size and number of iterations must be positive." << std::endl;
+		return -1;
+	}
+
+	if (THREADS <= 0) {
+
+		THREADS = cv::getNumberOfCPUs();
+	}
+
+	cv::setNumThreads(THREADS);
+
+	TRACE_START(TRACE);
 
 	//*********************************** VISUAL VOCABULARY ************************************//
 	
@@ -39,8 +585,6 @@ int main(int argc, char** argv) {
 
 	std::vector<cv::String> positive_files;
 	std::vector<cv::String> negative_files;
-	std::vector<cv::Mat> positive_patches;
-	std::vector<cv::Mat> negative_patches;
 
 	std::vector<cv::String> pattern = { "*.png" };
 
@@ -54,16 +598,8 @@ int main(int argc, char** argv) {
 		return -1;
 	}
 
-	cv::Mat image;
-
-	for (int i = 0; i < positive_files.size(); i++) {
-
-		image = cv::imread(positive_files[i]);
-		positive_patches.push_back(image);
-	}
-
 	std::cout << "Positive patches successfully loaded." << std::endl;
-	std::cout << "Total number of positive patches: " << positive_patches.size() << std::endl;
+	std::cout << "Total number of positive patches: " << positive_files.size() << std::endl;
 	std::cout << std::endl;
 
 	// Load negative patches
@@ -76,87 +612,101 @@ int main(int argc, char** argv) {
 		return -1;
 	}
 
-	for (int i = 0; i < negative_files.size(); i++) {
-
-		image = cv::imread(negative_files[i]);
-		negative_patches.push_back(image);
-	}
-
 	std::cout << "Negative patches successfully loaded." << std::endl;
-	std::cout << "Total number of negative patches: " << negative_patches.size() << std::endl;
+	std::cout << "Total number of negative patches: " << negative_files.size() << std::endl;
 	std::cout << std::endl;
 
 	// SIFT DETECTION
 
-	std::vector<cv::KeyPoint> keypoints;
-	std::vector<cv::Mat> pos_descriptors(positive_patches.size());
-	std::vector<cv::Mat> neg_descriptors(negative_patches.size());
-	cv::Mat descriptors;
+	// patches are never all in memory: they are decoded and described in batches, first to sample the descriptors the
+	// vocabulary is built from, then to compute their bag of words descriptors. Descriptors are visited in patch order
+	// (positives first), so that the vocabulary does not depend on the number of threads nor on the size of the batches
+	std::vector<cv::String> all_files(positive_files);
+	all_files.insert(all_files.end(), negative_files.begin(), negative_files.end());
 
-	cv::Ptr<cv::SIFT> detector = cv::SIFT::create();
+	int n_patches = (int)all_files.size();
+	int n_pos = (int)positive_files.size();
 
-	cv::Mat all_features;
+	// number of codewords for the visual vocabulary
+	int n_words = N_WORDS;
+	int kmeans_sample = std::max(KMEANS_SAMPLE, n_words);
 
-	// for positive patches
+	// memory budget: the sample of descriptors clustered by k-means and the matrix of bag of words descriptors have a
+	// fixed size, batches of descriptors get the rest
+	size_t budget = (size_t)MEMORY_MB * 1024 * 1024;
+	size_t fixed_bytes = ((size_t)kmeans_sample * cv::SIFT::create()->descriptorSize() + (size_t)n_patches * n_words) * sizeof(float);
+	size_t min_batch_bytes = 16 * 1024 * 1024;
+	size_t batch_budget = budget > fixed_bytes + min_batch_bytes ? budget - fixed_bytes : min_batch_bytes;
 
-	std::cout << "Detecting SIFT features for positive patches..." << std::endl;
-	std::cout << std::endl;
+	if (budget <= fixed_bytes + min_batch_bytes) {
 
-	for (int i = 0; i < positive_patches.size(); i++) {
+		std::cout << "The memory budget is too small for the k-means sample and the bag of words descriptors (";
+		std::cout << fixed_bytes / (1024 * 1024) << " MB), batches are limited to " << min_batch_bytes / (1024 * 1024) << " MB." << std::endl;
+	}
 
-		// detect sift features and compute descriptors
-		detector->detectAndCompute(positive_patches[i], cv::Mat(), keypoints, descriptors);
+	// descriptors computed on previous runs are read from the store, only new or changed patches are described.
+	// Without a store, descriptors are spilled to a temporary one, so that the second pass (bag of words) reads them
+	// instead of running SIFT again on every patch
+	const bool TEMPORARY_STORE = DESCRIPTOR_STORE.empty();
+	const cv::String STORE_DIR = TEMPORARY_STORE ? cv::tempfile("_descriptors") : DESCRIPTOR_STORE;
+	cv::Ptr<Descriptor_Store> descriptor_store = cv::makePtr<Descriptor_Store>(STORE_DIR, SIFT_PARAMS);
 
-		if (!descriptors.empty()) {
+	auto removeTemporaryStore = [&]() {
 
-			// pos_descriptors[i] will contain SIFT descriptors computed for image positive_patches[i]
-			pos_descriptors.push_back(descriptors);
+		if (TEMPORARY_STORE && descriptor_store) {
 
-			// all_features will contain ALL the computed SIFT descriptors that are going to be clustered
-			all_features.push_back(descriptors);
+			descriptor_store.release();
+			cv::utils::fs::remove_all(STORE_DIR);
 		}
-	}
+	};
 
-	std::cout << "SIFT features successfully computed for positive patches." << std::endl;
+	std::cout << "Detecting SIFT features for positive and negative patches..." << std::endl;
 	std::cout << std::endl;
 
-	// for negative patches
+	// mini-batch k-means on a bounded random sample of the descriptors, instead of clustering all of them at once
+	Vocabulary_Builder vocabulary_builder(n_words, kmeans_sample, KMEANS_BATCH, KMEANS_ITERATIONS);
 
-	std::cout << "Detecting SIFT features for negative patches..." << std::endl;
-	std::cout << std::endl;
+	int n_described = describeInBatches(all_files, descriptor_store.get(), batch_budget, [&](int, const std::vector<cv::Mat>& descriptors) {
 
-	for (int i = 0; i < negative_patches.size(); i++) {
+		for (int k = 0; k < descriptors.size(); k++) {
 
-		// detect sift features and compute descriptors
-		detector->detectAndCompute(negative_patches[i], cv::Mat(), keypoints, descriptors);
+			vocabulary_builder.add(descriptors[k]);
+		}
+	});
 
-		if (!descriptors.empty()) {
+	std::cout << "SIFT features successfully computed for positive and negative patches";
 
-			// neg_descriptors[i] will contain SIFT descriptors computed for image negative_patches[i]
-			neg_descriptors.push_back(descriptors);
+	if (!TEMPORARY_STORE) {
 
-			all_features.push_back(descriptors);
-		}
+		std::cout << " (" << n_described << " patches described, " << n_patches - n_described << " read from the descriptor store)";
 	}
 
-	std::cout << "SIFT features successfully computed for negative patches." << std::endl;
+	std::cout << "." << std::endl;
 	std::cout << std::endl;
 
 	// K-MEANS CLUSTERING
-	 
-	// number of codewords for the visual vocabulary
-	int n_words = 300;
-	cv::TermCriteria term_criteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 100, 0.01);
 
+	std::cout << "Clustering SIFT descriptors (" << vocabulary_builder.getSampled() << " sampled out of ";
+	std::cout << vocabulary_builder.getSeen() << ")..." << std::endl;
+	std::cout << std::endl;
+
+	cv::Mat vocabulary;
+	bool clustered;
 
-	cv::BOWKMeansTrainer BOWTrainer(n_words, term_criteria);
+	{
+		TRACE_SCOPE("kmeans");
+		clustered = vocabulary_builder.build(vocabulary);
+	}
 
-	std::cout << "Clustering SIFT descriptors..." << std::endl;
-	std::cout << std::endl;
+	if (!clustered) {
 
-	cv::Mat vocabulary = BOWTrainer.cluster(all_features);
+		std::cout << "Not enough SIFT descriptors to build a vocabulary of " << n_words << " words." << std::endl;
+		removeTemporaryStore();
+		return -1;
+	}
 
-	std::cout << "Clustering of SIFT descriptors completed successfully." << std::endl;
+	std::cout << "Clustering of SIFT descriptors completed successfully (" << vocabulary_builder.getIterations();
+	std::cout << " iterations, mean squared distance to the codewords " << vocabulary_builder.getInertia() << ")." << std::endl;
 	std::cout << std::endl;
 
 	cv::FileStorage fs("../../vocabulary.yml", cv::FileStorage::WRITE);
@@ -167,64 +717,70 @@ int main(int argc, char** argv) {
 
 	//*********************************** SVM TRAINING ************************************//
 
-	// create nearest neighbor matcher
-	cv::Ptr<cv::DescriptorMatcher> matcher(new cv::FlannBasedMatcher);
-
-	// create SIFT descriptor extractor
-	cv::Ptr<cv::DescriptorExtractor> extractor(new cv::SiftDescriptorExtractor);
-
-	// create bag of words descriptor extractor using matcher and sift features extractor
-	cv::BOWImgDescriptorExtractor BOWImgDescriptor(extractor, matcher);
+	// create bag of words descriptor extractor (exact nearest codeword search, vectorized when the CPU allows it)
+	BOW_Extractor BOWImgDescriptor;
 
 	// set vocabulary 
 	BOWImgDescriptor.setVocabulary(vocabulary);
 
-	cv::Mat bow_descriptors;
+	// one row per patch at most, allocated once: patches without descriptors get no sample
+	cv::Mat train_samples(n_patches, n_words, CV_32F);
+	cv::Mat labels(n_patches, 1, CV_32S);
+	int n_samples = 0;
 
-	cv::Mat train_samples;
-	cv::Mat labels;
+	// patch described by each sample (negative patches follow the positive ones)
+	std::vector<int> sample_patches;
 
 	// BAG OF WORDS IMAGE DESCRIPTORS COMPUTATION
 
 	// bag of words image descriptors are computed in the following way:
-	// 1. given the SIFT keypoints descriptors computed for each patch, using a nearest neighbor matcher, we find the codewords which are
-	// nearest to such descriptors.
+	// 1. given the SIFT keypoints descriptors computed for each patch, using an exact nearest neighbor search, we find the codewords
+	// which are nearest to such descriptors.
 	// 2. we compute the bow descriptor, which is a normalized histogram of the frequencies of the codewords encountered in the patch.
 	// The i-th bin of such histogram represents the frequency of the i-th codeword in the image.
-	
-	for (int i = 0; i < pos_descriptors.size(); i++) {
+	// descriptors are read again from the store (the temporary one, if no store is given), one batch at a time.
+
+	describeInBatches(all_files, descriptor_store.get(), batch_budget, [&](int first, const std::vector<cv::Mat>& descriptors) {
+
+		// row of each patch of the batch in the sample matrix
+		std::vector<int> rows(descriptors.size(), -1);
 
-		if (!pos_descriptors[i].empty()) {
+		for (int k = 0; k < descriptors.size(); k++) {
 
-			// compute bow descriptor
-			BOWImgDescriptor.compute(pos_descriptors[i], bow_descriptors);
+			if (!descriptors[k].empty()) {
 
-			// add bow descriptor to train samples
-			train_samples.push_back(bow_descriptors);
+				rows[k] = n_samples++;
+				sample_patches.push_back(first + k);
 
-			// corresponding label is '1' since we are working with positive patches
-			labels.push_back(1);
+				// label is '1' for positive patches, '0' for negative patches
+				labels.at<int>(rows[k]) = first + k < n_pos ? 1 : 0;
+			}
 		}
-	}
 
-	std::cout << "BOW image descriptors computed for positives patches." << std::endl;
+		cv::parallel_for_(cv::Range(0, (int)descriptors.size()), [&](const cv::Range& range) {
 
-	for (int i = 0; i < neg_descriptors.size(); i++) {
+			cv::Mat bow_descriptors;
 
-		if (!neg_descriptors[i].empty()) {
+			for (int k = range.start; k < range.end; k++) {
 
-			// compute bow descriptor
-			BOWImgDescriptor.compute(neg_descriptors[i], bow_descriptors);
+				if (rows[k] >= 0) {
 
-			// add bow descriptor to train samples
-			train_samples.push_back(bow_descriptors);
+					TRACE_SCOPE("bow");
 
-			// corresponding label is '0' since we are working with negative patches
-			labels.push_back(0);
-		}
-	}
+					// compute bow descriptor and write it to its row of the train samples
+					BOWImgDescriptor.compute(descriptors[k], bow_descriptors);
+					bow_descriptors.copyTo(train_samples.row(rows[k]));
+				}
+			}
+		});
+	});
+
+	removeTemporaryStore();
 
-	std::cout << "BOW image descriptors computed for negatives patches." << std::endl;
+	train_samples = train_samples.rowRange(0, n_samples);
+	labels = labels.rowRange(0, n_samples);
+
+	std::cout << "BOW image descriptors computed for positive and negative patches." << std::endl;
 	std::cout << std::endl;
 
 	// SVM TRAINING
@@ -234,31 +790,192 @@ int main(int argc, char** argv) {
 	// the SVM chosen is an SVM with a non-linear kernel, namely a radial basis function kernel
 	// with respect to a linear SVM, a non-linear one is more powerful since it can capture also non-linear functions and thus, provide
 	// a better classification if data is not perfectly separable.
+	// alternatively, descriptors are transformed with an explicit feature map approximating an additive kernel
+	// (hellinger or chi-squared) and a linear SVM is trained on them: prediction then costs a single dot product
+	// instead of one kernel evaluation per support vector.
 
-	cv::Ptr<cv::ml::SVM> svm = cv::ml::SVM::create();
+	cv::Mat fit_samples = train_samples;
+	cv::Mat fit_labels = labels;
+	cv::Mat test_samples;
+	cv::Mat test_labels;
 
-	cv::Ptr<cv::ml::TrainData> dataset = cv::ml::TrainData::create(train_samples, cv::ml::SampleTypes::ROW_SAMPLE, labels);
+	if (HOLDOUT > 0) {
 
-	// C-Support Vector Classification
-	// allows imperfect separation of classes, applying a penalty C on outliers
-	svm->setType(cv::ml::SVM::C_SVC);
+		// keep part of the samples aside to measure accuracy and speed of the trained model
+		splitSamples(train_samples, labels, HOLDOUT, fit_samples, fit_labels, test_samples, test_labels);
+	}
 
-	// Radial Basis Function kernel
-	svm->setKernel(cv::ml::SVM::RBF);
+	int kernel = CLASSIFIER == "rbf" ? cv::ml::SVM::RBF : cv::ml::SVM::LINEAR;
 
-	svm->setTermCriteria(cv::TermCriteria(cv::TermCriteria::MAX_ITER + cv::TermCriteria::EPS, 10000, 1e-6));
+	// parallel parameter search on a cached kernel matrix, as long as the matrix fits in the allowed memory
+	cv::Ptr<SVM_Grid_Search> grid_search;
+	double cache_mb = SVM_Grid_Search::getCacheSize(fit_samples.rows) / (1024.0 * 1024.0);
 
-	// train SVM model tuning in an optimal way the different parameters. 
-	// this is done performing k-fold cross validation with k = 10 (default value) using a grid of standard values for each parameter.
-	// in the end, the model which performs better is chosen.
+	if (SVM_SEARCH == "cached" && cache_mb > SVM_CACHE_MB) {
 
-	std::cout << "Training the SVM..." << std::endl;
+		std::cout << "The kernel cache would take " << cache_mb << " MB (limit " << SVM_CACHE_MB << " MB), using trainAuto." << std::endl;
+	}
+	else if (SVM_SEARCH == "cached") {
+
+		grid_search = cv::makePtr<SVM_Grid_Search>(10, SVM_REFINE);
+	}
+
+	std::cout << "Training the SVM (" << CLASSIFIER << ", feature map: " << FEATURE_MAP << ")..." << std::endl;
 	std::cout << std::endl;
 
-	svm->trainAuto(dataset);
+	Batch_SVM model;
+	model.setModel(trainSVM(fit_samples, fit_labels, kernel, feature_map, grid_search.get()), feature_map);
 
-	svm->save("../../svm.yml");
+	model.save(CLASSIFIER == "rbf" ? "../../svm.yml" : "../../svm_linear.yml");
+
+	// the same model in a single binary file, together with the vocabulary, which the detector loads much faster
+	Model_Bundle bundle;
+	cv::String bundle_file = CLASSIFIER == "rbf" ? "../../model.bin" : "../../model_linear.bin";
+
+	if (!bundle.set(vocabulary, model) || !bundle.save(bundle_file)) {
+
+		std::cout << "The model could not be written to " << bundle_file << "." << std::endl;
+	}
 
 	std::cout << "Training done!" << std::endl;
 
+	if (HOLDOUT > 0) {
+
+		std::cout << std::endl;
+		std::cout << "Held-out evaluation on " << test_samples.rows << " samples:" << std::endl;
+
+		reportModel(CLASSIFIER + " (" + FEATURE_MAP + ")", model, test_samples, test_labels);
+
+		if (COMPARE) {
+
+			// train the other kind of classifier on the same split
+			cv::String other = CLASSIFIER == "rbf" ? "linear" : "rbf";
+			Feature_Map::Type other_map = CLASSIFIER == "rbf" ? Feature_Map::HELLINGER : Feature_Map::NONE;
+			int other_kernel = CLASSIFIER == "rbf" ? cv::ml::SVM::LINEAR : cv::ml::SVM::RBF;
+
+			Batch_SVM other_model;
+			other_model.setModel(trainSVM(fit_samples, fit_labels, other_kernel, other_map, grid_search.get()), other_map);
+
+			reportModel(other + " (" + Feature_Map::getName(other_map) + ")", other_model, test_samples, test_labels);
+		}
+	}
+
+	//*********************************** REJECTION CASCADE ************************************//
+
+	if (CASCADE_RECALL > 0) {
+
+		std::cout << std::endl;
+		std::cout << "Calibrating the rejection cascade (target recall " << CASCADE_RECALL << " per stage)..." << std::endl;
+
+		// first stage features, computed as the detector computes them: on the processed images the patches were
+		// cropped from, not on the patches, which are equalized on their own
+		cv::Mat patch_features;
+		std::vector<uchar> located;
+		computeCascadeFeatures(all_files, n_pos, BOAT_PATCHES_PATH, NONBOAT_PATCHES_PATH, IMAGES_PATH, patch_features, located);
+
+		cv::Mat positive_features;
+
+		for (int i = 0; i < n_pos; i++) {
+
+			if (located[i]) {
+
+				positive_features.push_back(patch_features.row(i));
+			}
+		}
+
+		// only the located patches are counted from now on
+		int pos_located = positive_features.rows;
+		int neg_located = 0;
+
+		for (int i = n_pos; i < all_files.size(); i++) {
+
+			neg_located += located[i];
+		}
+
+		int n_located = pos_located + neg_located;
+
+		std::cout << n_located << " of " << all_files.size() << " patches located in their images." << std::endl;
+
+		if (n_located < all_files.size()) {
+
+			std::cout << "The other patches are left out of the calibration (missing image, or region not recorded by the dataset preparation)." << std::endl;
+		}
+
+		Proposal_Cascade cascade;
+		double recall = cascade.calibrate(positive_features, CASCADE_RECALL);
+
+		std::vector<int> passed;
+		cascade.filter(patch_features, passed);
+
+		std::vector<bool> passed_first(all_files.size(), false);
+		int neg_passed = 0;
+
+		for (int i = 0; i < passed.size(); i++) {
+
+			if (located[passed[i]]) {
+
+				passed_first[passed[i]] = true;
+				neg_passed += passed[i] >= n_pos;
+			}
+		}
+
+		std::cout << "First stage: " << 100.0 * recall << "% of positive patches kept, ";
+		std::cout << 100.0 * neg_passed / std::max(neg_located, 1) << "% of negative patches kept." << std::endl;
+
+		// negative patches reaching the final SVM (patches without SIFT descriptors never reach it)
+		int neg_reaching = 0;
+
+		if (CASCADE_LINEAR && CLASSIFIER == "linear") {
+
+			std::cout << "The classifier is already linear, the linear stage is not added." << std::endl;
+		}
+
+		if (CASCADE_LINEAR && CLASSIFIER == "rbf") {
+
+			// linear SVM on hellinger-mapped descriptors, the cheapest model available
+			Batch_SVM linear_model;
+			linear_model.setModel(trainSVM(fit_samples, fit_labels, cv::ml::SVM::LINEAR, Feature_Map::HELLINGER, grid_search.get()), Feature_Map::HELLINGER);
+			// saved under its own name, so that the linear classifier (svm_linear.yml) is not overwritten
+			linear_model.save("../../cascade_linear.yml");
+
+			// the linear stage is calibrated on the positives which pass the first stage
+			cv::Mat stage_positives, stage_negatives;
+
+			for (int i = 0; i < train_samples.rows; i++) {
+
+				if (passed_first[sample_patches[i]]) {
+
+					if (labels.at<int>(i) == 1) {
+
+						stage_positives.push_back(train_samples.row(i));
+					}
+					else {
+
+						stage_negatives.push_back(train_samples.row(i));
+					}
+				}
+			}
+
+			double linear_recall = cascade.calibrateLinear("cascade_linear.yml", linear_model, stage_positives, CASCADE_RECALL);
+
+			cascade.filterLinear(stage_negatives, passed);
+			neg_reaching = (int)passed.size();
+
+			std::cout << "Linear stage: " << 100.0 * linear_recall << "% of the remaining positive patches kept, ";
+			std::cout << 100.0 * neg_reaching / std::max(stage_negatives.rows, 1) << "% of the remaining negative patches kept." << std::endl;
+		}
+		else {
+
+			for (int i = 0; i < train_samples.rows; i++) {
+
+				neg_reaching += labels.at<int>(i) == 0 && passed_first[sample_patches[i]];
+			}
+		}
+
+		std::cout << 100.0 * neg_reaching / std::max(neg_located, 1) << "% of negative patches reach the final SVM." << std::endl;
+
+		cascade.save("../../cascade.yml");
+	}
+
+	TRACE_FINISH(std::cout);
 }
\ No newline at end of file
@@ -0,0 +1,562 @@
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/features2d.hpp>
+#include <opencv2/ml.hpp>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include "Detector_Utils.h"
+#include "BOW_Extractor.h"
+#include "Batch_SVM.h"
+#include "Proposal_Generator.h"
+
+/*
+* Latencies measured for a stage of the detector.
+*/
+struct Stage_Result {
+
+	cv::String name;
+	// number of items (images, patches, samples, boxes...) processed by each iteration
+	int items;
+	cv::String unit;
+	// latency of each iteration (ms)
+	std::vector<double> samples;
+};
+
+
+/*
+* Function to measure a stage: it is run warmup times without measuring, then iterations times.
+*
+* @param name			Name of the stage.
+* @param items			Number of items processed by each run.
+* @param unit			Name of the items.
+* @param warmup			Number of runs not measured.
+* @param iterations		Number of measured runs.
+* @param run			Function running the stage once; it receives the index of the run.
+*
+* @return Stage_Result	Measured latencies.
+*/
+static Stage_Result measure(const cv::String& name, int items, const cv::String& unit, int warmup, int iterations,
+							std::function<void(int)> run) {
+
+	Stage_Result result;
+	result.name = name;
+	result.items = items;
+	result.unit = unit;
+
+	for (int i = 0; i < warmup; i++) {
+
+		run(i);
+	}
+
+	for (int i = 0; i < iterations; i++) {
+
+		cv::TickMeter timer;
+		timer.start();
+		run(warmup + i);
+		timer.stop();
+
+		result.samples.push_back(timer.getTimeMilli());
+	}
+
+	return result;
+}
+
+
+/*
+* Function to draw a synthetic harbour scene: sky and water gradients, hulls, cabins and masts of random boats,
+* quays and Gaussian noise, so that proposals, keypoints and edges behave as on real images.
+*
+* @param &rng			Random number generator (seeded by the caller).
+* @param size			Size of the image.
+*
+* @return cv::Mat		BGR image.
+*/
+static cv::Mat makeImage(cv::RNG& rng, cv::Size size) {
+
+	cv::Mat image(size, CV_8UC3);
+	int horizon = rng.uniform(size.height / 4, size.height / 2);
+
+	for (int y = 0; y < size.height; y++) {
+
+		double t = (double)y / size.height;
+		cv::Scalar color = y < horizon ? cv::Scalar(230 - 60 * t, 200 - 40 * t, 160) : cv::Scalar(120 - 40 * t, 90 - 20 * t, 40);
+		image.row(y).setTo(color);
+	}
+
+	// quays along the horizon
+	for (int k = rng.uniform(1, 4); k > 0; k--) {
+
+		int x = rng.uniform(0, size.width);
+		cv::rectangle(image, cv::Rect(x, horizon - rng.uniform(10, 60), rng.uniform(100, 400), rng.uniform(20, 80)),
+					cv::Scalar(rng.uniform(60, 140), rng.uniform(60, 140), rng.uniform(60, 140)), cv::FILLED);
+	}
+
+	// boats: hull, cabin and mast
+	for (int k = rng.uniform(3, 10); k > 0; k--) {
+
+		int w = rng.uniform(40, size.width / 4);
+		int h = std::max(w / rng.uniform(3, 6), 8);
+		cv::Point base(rng.uniform(0, size.width - w), rng.uniform(horizon, size.height - h));
+		cv::Scalar hull(rng.uniform(0, 255), rng.uniform(0, 255), rng.uniform(0, 255));
+
+		std::vector<cv::Point> points = { base, base + cv::Point(w, 0), base + cv::Point(w - h / 2, h), base + cv::Point(h / 2, h) };
+		cv::fillConvexPoly(image, points, hull);
+		cv::rectangle(image, cv::Rect(base.x + w / 4, base.y - h / 2, w / 3, h / 2), cv::Scalar(240, 240, 240), cv::FILLED);
+		cv::line(image, base + cv::Point(w / 2, 0), base + cv::Point(w / 2, -2 * h), cv::Scalar(30, 30, 30), 2);
+	}
+
+	cv::Mat noise(size, CV_8UC3);
+	rng.fill(noise, cv::RNG::NORMAL, 0, 6);
+	cv::add(image, noise, image);
+
+	return image;
+}
+
+
+/*
+* Function to build a synthetic classifier when no trained SVM is given: an RBF SVM trained on random bag of words
+* histograms, so that its number of support vectors is in the range of a real model.
+*
+* @param &rng			Random number generator (seeded by the caller).
+* @param n_words		Size of the histograms.
+*
+* @return Batch_SVM		Trained classifier.
+*/
+static Batch_SVM makeSVM(cv::RNG& rng, int n_words) {
+
+	int n = 600;
+	cv::Mat samples(n, n_words, CV_32F), labels(n, 1, CV_32S);
+	rng.fill(samples, cv::RNG::UNIFORM, 0, 1);
+
+	for (int i = 0; i < n; i++) {
+
+		cv::Mat row = samples.row(i);
+		cv::normalize(row, row, 1, 0, cv::NORM_L1);
+
+		// boats have more mass on the first words, with some label noise
+		double mass = cv::sum(row.colRange(0, n_words / 2))[0];
+		labels.at<int>(i) = (mass > 0.5) != (rng.uniform(0.0, 1.0) < 0.1) ? 1 : 0;
+	}
+
+	cv::Ptr<cv::ml::SVM> svm = cv::ml::SVM::create();
+	svm->setType(cv::ml::SVM::C_SVC);
+	svm->setKernel(cv::ml::SVM::RBF);
+	svm->setC(10);
+	svm->setGamma(1.0 / n_words);
+	svm->train(samples, cv::ml::ROW_SAMPLE, labels);
+
+	Batch_SVM model;
+	model.setModel(svm);
+
+	return model;
+}
+
+
+/*
+* Function to draw random boxes inside an image, with random scores.
+*
+* @param &rng			Random number generator.
+* @param size			Size of the image.
+* @param n				Number of boxes.
+* @param &boxes			Boxes.
+* @param &scores		Score of each box.
+*/
+static void makeBoxes(cv::RNG& rng, cv::Size size, int n, std::vector<cv::Rect>& boxes, std::vector<float>& scores) {
+
+	boxes.clear();
+	scores.clear();
+
+	for (int i = 0; i < n; i++) {
+
+		int w = rng.uniform(32, size.width / 3);
+		int h = rng.uniform(32, size.height / 3);
+		boxes.push_back(cv::Rect(rng.uniform(0, size.width - w), rng.uniform(0, size.height - h), w, h));
+		scores.push_back(rng.uniform(0.0f, 2.0f));
+	}
+}
+
+
+/*
+* Function to write the results as text, one line per stage.
+*
+* @param &out			Output stream.
+* @param results		Results of the stages.
+*/
+static void writeText(std::ostream& out, const std::vector<Stage_Result>& results) {
+
+	out << cv::format("%-20s %8s %10s %10s %10s %10s %14s", "stage", "items", "mean ms", "p50 ms", "p90 ms", "p99 ms", "throughput") << std::endl;
+
+	for (int i = 0; i < results.size(); i++) {
+
+		const Stage_Result& r = results[i];
+		double mean = std::accumulate(r.samples.begin(), r.samples.end(), 0.0) / std::max((int)r.samples.size(), 1);
+
+		out << cv::format("%-20s %8d %10.3f %10.3f %10.3f %10.3f %10.0f %s/s", r.name.c_str(), r.items, mean, Detector_Utils::percentile(r.samples, 0.5),
+			Detector_Utils::percentile(r.samples, 0.9), Detector_Utils::percentile(r.samples, 0.99), mean > 0 ? r.items * 1000.0 / mean : 0.0, r.unit.c_str()) << std::endl;
+	}
+}
+
+
+/*
+* Function to write the results as a JSON document, to track them across versions.
+*
+* @param &out			Output stream.
+* @param results		Results of the stages.
+* @param seed			Seed of the synthetic data.
+* @param threads		Number of threads used by OpenCV.
+*/
+static void writeJSON(std::ostream& out, const std::vector<Stage_Result>& results, int seed, int threads) {
+
+	out << "{\"opencv\":\"" << CV_VERSION << "\",\"seed\":" << seed << ",\"threads\":" << threads << ",\"stages\":[";
+
+	for (int i = 0; i < results.size(); i++) {
+
+		const Stage_Result& r = results[i];
+		double mean = std::accumulate(r.samples.begin(), r.samples.end(), 0.0) / std::max((int)r.samples.size(), 1);
+
+		out << (i > 0 ? "," : "") << "{\"name\":\"" << r.name << "\",\"items\":" << r.items << ",\"unit\":\"" << r.unit << "\"";
+		out << ",\"iterations\":" << r.samples.size() << ",\"mean_ms\":" << mean;
+		out << ",\"min_ms\":" << (r.samples.empty() ? 0.0 : *std::min_element(r.samples.begin(), r.samples.end()));
+		out << ",\"p50_ms\":" << Detector_Utils::percentile(r.samples, 0.5) << ",\"p90_ms\":" << Detector_Utils::percentile(r.samples, 0.9);
+		out << ",\"p99_ms\":" << Detector_Utils::percentile(r.samples, 0.99) << ",\"max_ms\":" << Detector_Utils::percentile(r.samples, 1.0);
+		out << ",\"items_per_s\":" << (mean > 0 ? r.items * 1000.0 / mean : 0.0) << "}";
+	}
+
+	out << "]}" << std::endl;
+}
+
+
+/*
+* Program that measures the hot paths of the boat detector in isolation: proposals, patch preprocessing, SIFT,
+* bag of words, SVM prediction, non-maxima suppression and intersection over union.
+*
+* Inputs are synthetic images and boxes generated with a fixed seed (or sample images from a directory), so that two
+* runs on the same machine measure the same work. Each stage is run a few times to warm up, then measured; mean,
+* percentiles of the latency and throughput are reported, as text or as JSON (-json).
+*/
+int main(int argc, char** argv) {
+
+	const cv::String keys =
+		"{help h usage ?    |       | print this message }"
+		"{images            |       | directory of sample images (png or jpg) used instead of synthetic ones }"
+		"{vocabulary        | ../vocabulary.yml | vocabulary of visual words (a random one is used if it cannot be read) }"
+		"{svm               |       | trained SVM (default: synthetic RBF SVM) }"
+		"{stages            | all   | comma separated stages to run: selective, edges, process_patches, sift, bow, svm_batch, svm_predict, nms, soft_nms, iou }"
+		"{seed              | 42    | seed of the synthetic data }"
+		"{width             | 800   | width of the synthetic images }"
+		"{height            | 600   | height of the synthetic images }"
+		"{n_images          | 4     | number of images the stages cycle through }"
+		"{n_boxes           | 2000  | number of proposals per image (patches, SVM samples, NMS boxes) }"
+		"{iterations        | 10    | measured runs of each stage }"
+		"{warmup            | 2     | runs of each stage before measuring }"
+		"{threads           | 0     | number of threads used by OpenCV (0: number of CPUs) }"
+		"{json              |       | write the results as JSON }";
+
+	cv::CommandLineParser parser(argc, argv, keys);
+
+	if (parser.has("help")) {
+		parser.printMessage();
+		return 0;
+	}
+
+	cv::String IMAGES = parser.get<cv::String>("images");
+	cv::String VOCABULARY = parser.get<cv::String>("vocabulary");
+	cv::String SVM = parser.get<cv::String>("svm");
+	cv::String STAGES = parser.get<cv::String>("stages");
+	int SEED = parser.get<int>("seed");
+	cv::Size IMAGE_SIZE(std::max(parser.get<int>("width"), 256), std::max(parser.get<int>("height"), 256));
+	int N_IMAGES = std::max(parser.get<int>("n_images"), 1);
+	int N_BOXES = std::max(parser.get<int>("n_boxes"), 1);
+	int ITERATIONS = std::max(parser.get<int>("iterations"), 1);
+	int WARMUP = std::max(parser.get<int>("warmup"), 0);
+	int THREADS = parser.get<int>("threads");
+	bool JSON = parser.has("json");
+
+	// messages go to the standard error, so that the JSON document can be redirected
+	std::ostream& info = JSON ? std::cerr : std::cout;
+
+	if (THREADS <= 0) {
+		THREADS = cv::getNumberOfCPUs();
+	}
+
+	cv::setNumThreads(THREADS);
+
+	std::vector<cv::String> stages;
+	std::stringstream stage_list(STAGES);
+	std::string stage;
+
+	while (std::getline(stage_list, stage, ',')) {
+
+		stages.push_back(stage);
+	}
+
+	auto enabled = [&stages](const cv::String& name) {
+
+		return std::find(stages.begin(), stages.end(), "all") != stages.end() || std::find(stages.begin(), stages.end(), name) != stages.end();
+	};
+
+	// inputs: images, proposals (sliding windows, deterministic) and their processed patches
+	cv::RNG rng(SEED);
+	std::vector<cv::Mat> images;
+
+	if (!IMAGES.empty()) {
+
+		std::vector<cv::String> files;
+		std::vector<cv::String> pattern = { "*.png", "*.jpg" };
+
+		if (Detector_Utils::loadFiles(IMAGES, pattern, files)) {
+
+			info << "Error occurred while loading images from " << IMAGES << "." << std::endl;
+			return -1;
+		}
+
+		std::sort(files.begin(), files.end());
+
+		for (int i = 0; i < files.size() && images.size() < N_IMAGES; i++) {
+
+			cv::Mat image = cv::imread(files[i]);
+
+			if (!image.empty()) {
+
+				images.push_back(image);
+			}
+		}
+	}
+	else {
+
+		for (int i = 0; i < N_IMAGES; i++) {
+
+			images.push_back(makeImage(rng, IMAGE_SIZE));
+		}
+	}
+
+	if (images.empty()) {
+
+		info << "No images to run the benchmark on." << std::endl;
+		return -1;
+	}
+
+	std::vector<cv::Mat> grays(images.size());
+	std::vector<std::vector<cv::Rect>> proposals(images.size());
+	cv::Ptr<Proposal_Generator> windows = Proposal_Generator::create("sliding", N_BOXES);
+
+	for (int i = 0; i < images.size(); i++) {
+
+		cv::cvtColor(images[i], grays[i], cv::COLOR_BGR2GRAY);
+		windows->generate(images[i], proposals[i]);
+	}
+
+	// SIFT and bag of words are measured on a subset of the patches, they are much slower per item
+	const int N_PATCHES = std::min(200, (int)proposals[0].size());
+	std::vector<cv::Rect> patch_rects(proposals[0].begin(), proposals[0].begin() + N_PATCHES);
+	std::vector<cv::Mat> patches;
+	Detector_Utils::processPatches(grays[0], patch_rects, patches);
+
+	cv::Mat vocabulary;
+	cv::FileStorage fs(VOCABULARY, cv::FileStorage::READ);
+
+	if (fs.isOpened()) {
+
+		fs["vocabulary"] >> vocabulary;
+	}
+
+	if (vocabulary.empty()) {
+
+		info << "Vocabulary " << VOCABULARY << " not found, using a random one." << std::endl;
+		vocabulary.create(300, 128, CV_32F);
+		rng.fill(vocabulary, cv::RNG::UNIFORM, 0, 100);
+	}
+
+	BOW_Extractor extractor;
+	extractor.setVocabulary(vocabulary);
+
+	Batch_SVM svm;
+
+	if (!SVM.empty() && !svm.load(SVM)) {
+
+		info << "Error occurred while loading the SVM " << SVM << "." << std::endl;
+		return -1;
+	}
+
+	if (SVM.empty()) {
+
+		svm = makeSVM(rng, vocabulary.rows);
+	}
+
+	cv::Mat samples(N_BOXES, vocabulary.rows, CV_32F);
+	rng.fill(samples, cv::RNG::UNIFORM, 0, 1);
+
+	for (int i = 0; i < samples.rows; i++) {
+
+		cv::Mat row = samples.row(i);
+		cv::normalize(row, row, 1, 0, cv::NORM_L1);
+	}
+
+	std::vector<cv::Rect> boxes;
+	std::vector<float> scores;
+	makeBoxes(rng, images[0].size(), N_BOXES, boxes, scores);
+
+	info << "Benchmark on " << images.size() << " images of " << images[0].cols << "x" << images[0].rows << ", " << THREADS;
+	info << " threads, " << svm.getSupportVectorCount() << " support vectors, kernel " << extractor.getKernelName() << std::endl;
+
+	// stages
+	std::vector<Stage_Result> results;
+	int n = (int)images.size();
+
+	if (enabled("selective")) {
+
+		cv::Ptr<Proposal_Generator> generator = Proposal_Generator::create("selective", 2000);
+		std::vector<cv::Rect> rects;
+
+		results.push_back(measure("selective", 1, "images", std::min(WARMUP, 1), ITERATIONS, [&](int i) {
+
+			generator->generate(images[i % n], rects);
+		}));
+	}
+
+	if (enabled("edges")) {
+
+		cv::Ptr<Proposal_Generator> generator = Proposal_Generator::create("edges", 2000);
+		std::vector<cv::Rect> rects;
+
+		results.push_back(measure("edges", 1, "images", WARMUP, ITERATIONS, [&](int i) {
+
+			generator->generate(images[i % n], rects);
+		}));
+	}
+
+	if (enabled("process_patches")) {
+
+		std::vector<cv::Mat> processed;
+
+		results.push_back(measure("process_patches", (int)proposals[0].size(), "patches", WARMUP, ITERATIONS, [&](int i) {
+
+			Detector_Utils::processPatches(grays[i % n], proposals[i % n], processed);
+		}));
+	}
+
+	// keypoint descriptors of the patches, used by the bag of words stage
+	std::vector<cv::Mat> descriptors(patches.size());
+
+	cv::Ptr<cv::SIFT> detector = cv::SIFT::create();
+	std::vector<cv::KeyPoint> keypoints;
+
+	auto describePatches = [&]() {
+
+		for (int j = 0; j < patches.size(); j++) {
+
+			detector->detectAndCompute(patches[j], cv::Mat(), keypoints, descriptors[j]);
+		}
+	};
+
+	if (enabled("sift")) {
+
+		results.push_back(measure("sift", (int)patches.size(), "patches", WARMUP, ITERATIONS, [&](int) {
+
+			describePatches();
+		}));
+	}
+	else if (enabled("bow")) {
+
+		describePatches();
+	}
+
+	if (enabled("bow")) {
+
+		cv::Mat histogram;
+
+		results.push_back(measure("bow", (int)patches.size(), "patches", WARMUP, ITERATIONS, [&](int) {
+
+			for (int j = 0; j < descriptors.size(); j++) {
+
+				if (!descriptors[j].empty()) {
+
+					extractor.compute(descriptors[j], histogram);
+				}
+			}
+		}));
+	}
+
+	if (enabled("svm_batch")) {
+
+		cv::Mat labels, decision_values;
+
+		results.push_back(measure("svm_batch", samples.rows, "samples", WARMUP, ITERATIONS, [&](int) {
+
+			svm.predict(samples, labels, decision_values);
+		}));
+	}
+
+	if (enabled("svm_predict") && !svm.getModel().empty()) {
+
+		// one cv::ml::SVM::predict call per sample, as before batching
+		cv::Ptr<cv::ml::SVM> model = svm.getModel();
+
+		results.push_back(measure("svm_predict", samples.rows, "samples", WARMUP, ITERATIONS, [&](int) {
+
+			for (int k = 0; k < samples.rows; k++) {
+
+				model->predict(samples.row(k));
+			}
+		}));
+	}
+
+	if (enabled("nms")) {
+
+		std::vector<int> kept_idxs;
+		std::vector<float> kept_scores;
+
+		results.push_back(measure("nms", (int)boxes.size(), "boxes", WARMUP, ITERATIONS, [&](int) {
+
+			Detector_Utils::nonMaximaSuppression(boxes, scores, kept_idxs, kept_scores, 0.5f);
+		}));
+	}
+
+	if (enabled("soft_nms")) {
+
+		std::vector<int> kept_idxs;
+		std::vector<float> kept_scores;
+
+		results.push_back(measure("soft_nms", (int)boxes.size(), "boxes", WARMUP, ITERATIONS, [&](int) {
+
+			Detector_Utils::nonMaximaSuppression(boxes, scores, kept_idxs, kept_scores, 0.5f, 0.5f, 0.1f);
+		}));
+	}
+
+	if (enabled("iou")) {
+
+		// all the pairs of the first boxes
+		int m = std::min((int)boxes.size(), 1000);
+		volatile float sink = 0;
+
+		results.push_back(measure("iou", m * m, "pairs", WARMUP, ITERATIONS, [&](int) {
+
+			float sum = 0;
+
+			for (int a = 0; a < m; a++) {
+
+				for (int b = 0; b < m; b++) {
+
+					sum += Detector_Utils::intersectionOverUnion(boxes[a], boxes[b]);
+				}
+			}
+
+			sink = sum;
+		}));
+	}
+
+	if (JSON) {
+
+		writeJSON(std::cout, results, SEED, THREADS);
+	}
+	else {
+
+		writeText(std::cout, results);
+	}
+
+	return 0;
+}
@@ -2,12 +2,590 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/features2d.hpp>
+#include <opencv2/videoio.hpp>
 #include <opencv2/core/utils/filesystem.hpp>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <functional>
 #include <opencv2/ml.hpp>
 #include <opencv2/ximgproc/segmentation.hpp>
 #include "Detector_Utils.h"
+#include "Batch_SVM.h"
+#include "Model_Bundle.h"
+#include "Proposal_Classifier.h"
+#include "Bounded_Queue.h"
+#include "Detection_Writer.h"
+#include "Proposal_Cache.h"
+#include "Proposal_Generator.h"
+#include "Proposal_Cascade.h"
+#include "Detection_Evaluator.h"
+#include "Trace.h"
+
+/*
+* Image flowing through the stages of the detection pipeline.
+*/
+struct Frame {
+
+	// position of the image in the test set
+	int index;
+
+	cv::String filename;
+	// file name without directory, used in the output records
+	cv::String name;
+	cv::Mat image;
+	// grayscale image, converted once and shared by the cascade, patch extraction and descriptor stages
+	cv::Mat gray;
+	std::vector<cv::Rect> ground_truth;
+
+	std::vector<cv::Rect> proposals;
+	// true if proposals were read from the proposal cache
+	bool proposals_cached = false;
+	// number of proposals before the rejection cascade, and of descriptors fed to the final SVM
+	int n_proposals = 0;
+	int n_classified = 0;
+	std::vector<cv::Mat> patches;
+	std::vector<cv::Rect> pred_boxes;
+	std::vector<float> pred_scores;
+	std::vector<cv::Rect> final_boxes;
+	std::vector<float> final_scores;
+	// intersection over union of each final box with its matched ground truth box (0 if none)
+	std::vector<float> final_ious;
+	// time (ms) spent in each stage of the pipeline
+	std::vector<double> stage_ms;
+};
+
+typedef Bounded_Queue<cv::Ptr<Frame>> Frame_Queue;
+
+
+/*
+* Function to start a stage of the pipeline: n_threads threads pop frames from the input queue, process them and push
+* them to the output queue. The output queue is closed when the last thread of the stage terminates.
+* The time spent processing each frame is appended to its stage_ms.
+*
+* @param &threads		Threads of the pipeline, the new ones are appended.
+* @param n_threads		Number of threads running the stage.
+* @param &input			Queue the frames are read from.
+* @param &output		Queue the processed frames are written to.
+* @param process		Function applied to each frame.
+*/
+static void startStage(std::vector<std::thread>& threads, int n_threads, Frame_Queue& input, Frame_Queue& output,
+					std::function<void(Frame&)> process) {
+
+	cv::Ptr<std::atomic<int>> running = cv::makePtr<std::atomic<int>>(n_threads);
+
+	for (int t = 0; t < n_threads; t++) {
+
+		threads.emplace_back([&input, &output, process, running]() {
+
+			cv::Ptr<Frame> frame;
+
+			while (input.pop(frame)) {
+
+				cv::TickMeter timer;
+				timer.start();
+				process(*frame);
+				timer.stop();
+
+				frame->stage_ms.push_back(timer.getTimeMilli());
+				output.push(frame);
+			}
+
+			if (--(*running) == 0) {
+
+				output.close();
+			}
+		});
+	}
+}
+
+
+/*
+* Function to match the detections of an image with its ground truth boxes.
+* For each ground truth box, the remaining detection giving the highest intersection over union is matched to it.
+*
+* @param &frame			Processed image, final_ious is filled.
+*/
+static void matchGroundTruth(Frame& frame) {
+
+	frame.final_ious.assign(frame.final_boxes.size(), 0.0f);
+
+	// detections not matched yet, with their index in final_boxes
+	std::vector<cv::Rect> remaining = frame.final_boxes;
+	std::vector<int> remaining_idxs;
+
+	for (int j = 0; j < remaining.size(); j++) {
+
+		remaining_idxs.push_back(j);
+	}
+
+	for (int j = 0; j < frame.ground_truth.size() && !remaining.empty(); j++) {
+
+		float max_iou; int max_i;
+		Detector_Utils::getMaxResponseIOU(remaining, frame.ground_truth[j], max_iou, max_i);
+
+		if (max_iou > 0.0f) {
+
+			frame.final_ious[remaining_idxs[max_i]] = max_iou;
+
+			// erase the box already matched
+			remaining.erase(remaining.begin() + max_i);
+			remaining_idxs.erase(remaining_idxs.begin() + max_i);
+		}
+	}
+}
+
+
+/*
+* Function to draw the detections of an image.
+* Bounding boxes depicted in green are the best boxes found for the ground truth boxes, with their intersection over union.
+* The other boxes are depicted in red.
+*
+* @param frame			Processed image, with matched detections.
+*
+* @return cv::Mat		Annotated image.
+*/
+static cv::Mat renderResult(const Frame& frame) {
+
+	cv::Mat outImage = frame.image.clone();
+
+	for (int j = 0; j < frame.final_boxes.size(); j++) {
+
+		const cv::Rect& box = frame.final_boxes[j];
+
+		if (frame.final_ious[j] > 0.0f) {
+
+			// show in green color the box which has maximum IOU for a ground truth box
+			rectangle(outImage, box, cv::Scalar(50, 205, 50), 2);
+
+			// write above the box the corresponding IOU
+			float offset_x = box.x;
+			float offset_y = box.y - 7;
+
+			if (offset_y < 0) {
+				offset_y = box.y + 21;
+			}
+
+			cv::putText(outImage, std::to_string(frame.final_ious[j]), cv::Point(offset_x, offset_y),
+				cv::FONT_HERSHEY_SIMPLEX, 0.7, cv::Scalar(50, 205, 50), 2);
+		}
+		else {
+
+			// the remaining boxes are shown in red color
+			rectangle(outImage, box, cv::Scalar(0, 0, 255), 1);
+		}
+	}
+
+	return outImage;
+}
+
+
+/*
+* Function to show the detections of an image in a window, waiting for a key press.
+*
+* @param frame			Processed image, with matched detections.
+*/
+static void showResult(const Frame& frame) {
+
+	// displaying result 
+	std::cout << "Intersection over union:" << std::endl;
+
+	for (int j = 0; j < frame.final_ious.size(); j++) {
+
+		if (frame.final_ious[j] > 0.0f) {
+
+			std::cout << frame.final_ious[j] << std::endl;
+		}
+	}
+
+	//show output
+	cv::Mat outImage = renderResult(frame);
+	cv::resize(outImage, outImage, cv::Size(1000, 600));
+	cv::imshow("Test image", outImage);
+	cv::waitKey(0);
+
+	std::cout << std::endl;
+}
+
+
+/*
+* Function to measure latency and recall of a proposal backend on the test images, for several resolutions.
+* For each maximum side length, it reports the mean time to compute the proposals of an image, the mean number of
+* proposals and the recall: the fraction of ground truth boxes having a proposal with intersection over union of at
+* least iou_threshold.
+*
+* @param test_files		Test images.
+* @param annot_files	Annotation files of the test images.
+* @param backend		Name of the proposal backend (see Proposal_Generator::create).
+* @param max_sides		Maximum lengths of the longest side of the analyzed image (0: full resolution).
+* @param max_n			Maximum number of proposals per image.
+* @param iou_threshold	Minimum intersection over union for a ground truth box to be recalled.
+* @param &out			Stream the results are written to.
+*/
+static void runProposalBenchmark(const std::vector<cv::String>& test_files, const std::vector<cv::String>& annot_files,
+								const cv::String& backend, const std::vector<int>& max_sides, int max_n, float iou_threshold,
+								std::ostream& out) {
+
+	std::vector<cv::Ptr<Proposal_Generator>> generators;
+
+	for (int k = 0; k < max_sides.size(); k++) {
+
+		generators.push_back(Proposal_Generator::create(backend, max_n, max_sides[k]));
+	}
+
+	std::vector<double> total_ms(max_sides.size(), 0.0);
+	std::vector<size_t> total_proposals(max_sides.size(), 0);
+	std::vector<int> recalled(max_sides.size(), 0);
+	int total_gt = 0;
+
+	for (int i = 0; i < test_files.size(); i++) {
+
+		cv::Mat image = cv::imread(test_files[i]);
+		std::vector<cv::Rect> ground_truth = Detector_Utils::getGroundTruth(annot_files[i]);
+		total_gt += (int)ground_truth.size();
+
+		out << "Processing image " << test_files[i] << "..." << std::endl;
+
+		for (int k = 0; k < max_sides.size(); k++) {
+
+			std::vector<cv::Rect> proposals;
+
+			cv::TickMeter timer;
+			timer.start();
+			generators[k]->generate(image, proposals);
+			timer.stop();
+
+			total_ms[k] += timer.getTimeMilli();
+			total_proposals[k] += proposals.size();
+
+			for (int j = 0; j < ground_truth.size(); j++) {
+
+				float max_iou; int max_i;
+				Detector_Utils::getMaxResponseIOU(proposals, ground_truth[j], max_iou, max_i);
+
+				if (max_iou >= iou_threshold) {
+
+					recalled[k]++;
+				}
+			}
+		}
+	}
+
+	int n_images = std::max((int)test_files.size(), 1);
+
+	out << std::endl << "Proposals (" << backend << ") latency vs recall (" << test_files.size() << " images, ";
+	out << total_gt << " ground truth boxes, IoU >= " << iou_threshold << ")" << std::endl;
+	out << "max_side\tms/image\tproposals/image\trecall" << std::endl;
+
+	for (int k = 0; k < max_sides.size(); k++) {
+
+		out << (max_sides[k] > 0 ? std::to_string(max_sides[k]) : "full") << "\t";
+		out << total_ms[k] / n_images << "\t" << (double)total_proposals[k] / n_images << "\t";
+		out << (total_gt > 0 ? (double)recalled[k] / total_gt : 0.0) << std::endl;
+	}
+}
+
+
+/*
+* Function to find the regions of a frame that changed with respect to a reference frame.
+* Changed pixels are grouped in connected components, whose bounding boxes are enlarged by a margin (so that proposals
+* around the changes can be found) and merged while they overlap.
+*
+* @param mask			Mask of the changed pixels (CV_8U, non-zero where changed).
+* @param margin			Margin (in pixels) added around each group of changed pixels.
+* @param &regions		Changed regions, not overlapping each other.
+*/
+static void getChangedRegions(const cv::Mat& mask, int margin, std::vector<cv::Rect>& regions) {
+
+	regions.clear();
+
+	cv::Mat labels, stats, centroids;
+	int n_labels = cv::connectedComponentsWithStats(mask, labels, stats, centroids, 8, CV_32S);
+	cv::Rect frame_rect(0, 0, mask.cols, mask.rows);
+
+	// label 0 is the background
+	for (int i = 1; i < n_labels; i++) {
+
+		cv::Rect box(stats.at<int>(i, cv::CC_STAT_LEFT), stats.at<int>(i, cv::CC_STAT_TOP),
+					stats.at<int>(i, cv::CC_STAT_WIDTH), stats.at<int>(i, cv::CC_STAT_HEIGHT));
+
+		box = cv::Rect(box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin) & frame_rect;
+		regions.push_back(box);
+	}
+
+	// merge overlapping regions until none overlap
+	bool merged = true;
+
+	while (merged) {
+
+		merged = false;
+
+		for (int i = 0; i < regions.size() && !merged; i++) {
+
+			for (int j = i + 1; j < regions.size() && !merged; j++) {
+
+				if ((regions[i] & regions[j]).area() > 0) {
+
+					regions[i] |= regions[j];
+					regions.erase(regions.begin() + j);
+					merged = true;
+				}
+			}
+		}
+	}
+}
+
+
+/*
+* Function to test whether a rectangle intersects any of the given regions.
+*
+* @param rect			Rectangle.
+* @param regions		Regions.
+*
+* @return bool			Returns true if rect shares at least one pixel with a region.
+*/
+static bool intersectsAny(const cv::Rect& rect, const std::vector<cv::Rect>& regions) {
+
+	for (int i = 0; i < regions.size(); i++) {
+
+		if ((rect & regions[i]).area() > 0) {
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+* Function to detect boats in the frames of a video, reusing the work done on the previous frame.
+*
+* Each frame is compared with the frame of the last full refresh, so that slow drifts accumulate until they are
+* detected: the pixels whose (smoothed) intensity changed by more than diff_threshold are grouped in changed regions.
+* Proposals and detections of the previous frame which do not intersect any changed region are kept as they are;
+* proposals are computed, described and classified only inside the changed regions, so no region is counted twice.
+* The cascade and the descriptors of the new proposals are computed on the whole frame, as for a still image.
+* Every refresh frames (and when most of the frame changed) the whole frame is processed again.
+* Per-frame latency and the fraction of reused proposals are reported.
+*
+* @param &capture			Video (or image sequence) to read frames from.
+* @param generator			Proposal engine.
+* @param cascade			Rejection cascade, if any.
+* @param classifier			Classifier of the proposed regions.
+* @param nms_threshold		Threshold for non-maxima suppression.
+* @param soft_sigma			Gaussian decay of soft-NMS (0: hard NMS).
+* @param soft_min_score		Minimum score of the boxes kept by soft-NMS.
+* @param refresh			Number of frames between two full refreshes (0: every frame is fully processed).
+* @param diff_threshold		Minimum intensity difference for a pixel to be considered changed.
+* @param writer				Writer of the detections, if any.
+* @param *rendered			Queue of the annotated frames to write, if any.
+* @param render_dir			Directory the annotated frames are written to.
+* @param headless			If false, each frame is shown in a window.
+* @param &out				Stream the progress is written to.
+*/
+static void runVideo(cv::VideoCapture& capture, const Proposal_Generator& generator, const cv::Ptr<Proposal_Cascade>& cascade,
+					const Proposal_Classifier& classifier, float nms_threshold, float soft_sigma, float soft_min_score, int refresh,
+					int diff_threshold, const cv::Ptr<Detection_Writer>& writer, Bounded_Queue<std::pair<cv::String, cv::Mat>>* rendered,
+					const cv::String& render_dir, bool headless, std::ostream& out) {
+
+	// margin around the changed pixels in which proposals are recomputed
+	const int margin = 32;
+
+	// smoothed grayscale frame of the last full refresh, changes are measured against it
+	cv::Mat reference_gray;
+	std::vector<cv::Rect> previous_proposals;
+	std::vector<cv::Rect> previous_boxes;
+	std::vector<float> previous_scores;
+
+	double total_ms = 0;
+	size_t total_proposals = 0, total_reused = 0;
+	int n_frames = 0;
+
+	for (int index = 0; ; index++) {
+
+		Frame frame;
+
+		if (!capture.read(frame.image) || frame.image.empty()) {
+
+			break;
+		}
+
+		frame.index = index;
+		frame.name = cv::format("frame%06d.png", index);
+
+		cv::TickMeter timer;
+		timer.start();
+
+		// smoothed grayscale frame, compared with the one of the last full refresh
+		cv::Mat gray;
+		cv::cvtColor(frame.image, frame.gray, cv::COLOR_BGR2GRAY);
+		cv::GaussianBlur(frame.gray, gray, cv::Size(5, 5), 0);
+
+		cv::Rect frame_rect(0, 0, gray.cols, gray.rows);
+		std::vector<cv::Rect> regions;
+		bool full = reference_gray.empty() || refresh <= 0 || index % refresh == 0 || gray.size() != reference_gray.size();
+
+		if (!full) {
+
+			cv::Mat diff, mask;
+			cv::absdiff(gray, reference_gray, diff);
+			cv::threshold(diff, mask, diff_threshold, 1, cv::THRESH_BINARY);
+
+			getChangedRegions(mask, margin, regions);
+
+			double changed_area = 0;
+
+			for (int k = 0; k < regions.size(); k++) {
+
+				changed_area += regions[k].area();
+			}
+
+			// when most of the frame changed, it is cheaper to process it all at once
+			full = changed_area > 0.5 * frame_rect.area();
+
+			if (!full) {
+
+				// keep proposals and detections outside the changed regions, the ones inside are computed again
+				for (int k = 0; k < previous_proposals.size(); k++) {
+
+					if (!intersectsAny(previous_proposals[k], regions)) {
+
+						frame.proposals.push_back(previous_proposals[k]);
+					}
+				}
+
+				for (int k = 0; k < previous_boxes.size(); k++) {
+
+					if (!intersectsAny(previous_boxes[k], regions)) {
+
+						frame.pred_boxes.push_back(previous_boxes[k]);
+						frame.pred_scores.push_back(previous_scores[k]);
+					}
+				}
+			}
+		}
+
+		if (full) {
+
+			regions.assign(1, frame_rect);
+			reference_gray = gray;
+		}
+
+		size_t reused = frame.proposals.size();
+
+		// propose regions inside the changed areas only (in frame coordinates)
+		std::vector<cv::Rect> proposals;
+
+		for (int k = 0; k < regions.size(); k++) {
+
+			const cv::Rect& region = regions[k];
+			std::vector<cv::Rect> region_proposals;
+			generator.generate(frame.image(region), region_proposals);
+
+			for (int j = 0; j < region_proposals.size(); j++) {
+
+				proposals.push_back(region_proposals[j] + region.tl());
+			}
+		}
+
+		// cascade and descriptors are computed on the whole frame, as for a still image: CLAHE tiles and keypoints
+		// near the borders of a crop would differ from the ones the classifier and the cascade were trained with.
+		// Frames without new proposals (nothing changed) skip both
+		std::vector<cv::Rect> boxes;
+		std::vector<float> scores;
+
+		if (!proposals.empty()) {
+
+			if (cascade) {
+
+				cv::Mat processed;
+				Detector_Utils::processImage(frame.gray, processed);
+				cascade->filterProposals(processed, proposals);
+			}
+
+			std::vector<cv::Mat> patches;
+
+			if (classifier.usesPatches()) {
+
+				Detector_Utils::processPatches(frame.gray, proposals, patches);
+			}
+
+			cv::Mat samples;
+			std::vector<int> sample_proposals;
+			classifier.describe(frame.gray, proposals, patches, samples, sample_proposals);
+
+			if (cascade) {
+
+				cascade->filterSamples(samples, sample_proposals);
+			}
+
+			classifier.classify(samples, sample_proposals, proposals, boxes, scores);
+		}
+
+		frame.proposals.insert(frame.proposals.end(), proposals.begin(), proposals.end());
+		frame.pred_boxes.insert(frame.pred_boxes.end(), boxes.begin(), boxes.end());
+		frame.pred_scores.insert(frame.pred_scores.end(), scores.begin(), scores.end());
+
+		std::vector<int> kept_idxs;
+		Detector_Utils::nonMaximaSuppression(frame.pred_boxes, frame.pred_scores, kept_idxs, frame.final_scores, nms_threshold,
+											soft_sigma, soft_min_score);
+
+		for (int j = 0; j < kept_idxs.size(); j++) {
+
+			frame.final_boxes.push_back(frame.pred_boxes[kept_idxs[j]]);
+		}
+
+		// videos have no ground truth, all the boxes are unmatched
+		matchGroundTruth(frame);
+
+		timer.stop();
+
+		previous_proposals = frame.proposals;
+		previous_boxes = frame.pred_boxes;
+		previous_scores = frame.pred_scores;
+
+		double reused_fraction = frame.proposals.empty() ? 0.0 : (double)reused / frame.proposals.size();
+
+		total_ms += timer.getTimeMilli();
+		total_proposals += frame.proposals.size();
+		total_reused += reused;
+		n_frames++;
+
+		out << "Frame " << index << ": " << timer.getTimeMilli() << " ms, ";
+		out << (full ? cv::String("full refresh") : std::to_string(regions.size()) + " changed regions") << ", ";
+		out << frame.proposals.size() << " proposals (" << 100.0 * reused_fraction << "% reused), ";
+		out << frame.final_boxes.size() << " boats." << std::endl;
+
+		if (writer) {
+
+			writer->write(frame.name, frame.final_boxes, frame.final_scores, frame.final_ious);
+		}
+
+		if (rendered) {
+
+			rendered->push(std::make_pair(render_dir + "/" + frame.name, renderResult(frame)));
+		}
+
+		if (!headless) {
+
+			cv::Mat outImage = renderResult(frame);
+			cv::resize(outImage, outImage, cv::Size(1000, 600));
+			cv::imshow("Test video", outImage);
+			cv::waitKey(1);
+		}
+	}
+
+	if (n_frames > 0) {
+
+		out << std::endl << n_frames << " frames, " << total_ms / n_frames << " ms/frame, ";
+		out << 100.0 * total_reused / std::max(total_proposals, (size_t)1) << "% of the proposals reused." << std::endl;
+	}
+}
+
 
 /*
 * Program that implements a boat detector, based on bag-of-words and support vector machine.
@@ -16,199 +594,637 @@
 * Bounding boxes depicted in green are the best boxes the boat detector has found for the boats in the image.
 * Bounding boxes in red are either false positives or poorer detections with respect to the green ones.
 * On the green boxes, it shows the corresponding intersection over union.
+* 
+* Bag of words descriptors of the proposed regions can be computed in two ways (option -bow_mode):
+* - patch: SIFT descriptors are computed from scratch on each processed patch (default).
+* - image: SIFT descriptors are computed once on the whole processed image, keypoints are assigned to their
+*          visual words and indexed in a Keypoint_Map. The histogram of each proposal is built from the keypoints
+*          falling inside its rectangle.
+* - integral: as image, but the histograms are read from per-word summed-area tables (Word_Integral_Image),
+*          with a constant number of lookups per word regardless of the number of keypoints in the proposal.
+* 
+* Proposals are described in parallel by a configurable number of workers (option -threads); detections do not depend
+* on the number of workers.
+* 
+* Test images are not loaded all at once: they flow through a pipeline of stages running concurrently on their own
+* threads (decode -> selective search -> patch extraction/CLAHE -> BOW + SVM -> NMS -> output), connected by bounded
+* queues (option -queue_depth). A stage that gets ahead of the next one waits, so memory stays flat regardless of the
+* number of images and throughput is set by the slowest stage. Results are shown in the order of the test images.
+* 
+* With option -headless no window is opened: the program runs unattended and detections (image name, box, SVM score,
+* matched intersection over union) are written as JSON Lines or CSV (option -format) to a file or to the standard output
+* (option -output). Annotated images are rendered only if a directory is given (option -render_dir), and are written
+* by a separate thread.
+* 
+* Selective search is the slowest step. With option -proposal_cache, proposals are stored in a cache directory keyed by
+* the content of each image and by the segmentation parameters, so that re-running the detector on the same images
+* (e.g. with a different non-maxima suppression threshold or model) skips segmentation.
+* Segmentation can also run on a downscaled copy of each image (options -proposal_max_side, -proposal_scale): proposals
+* are mapped back to the original image. With -mode=proposal_benchmark, the program does not detect boats but measures
+* latency and recall of the proposals on the annotated test images for the sizes given by -benchmark_sides.
+* 
+* Proposals are computed by a pluggable engine (option -proposals, see Proposal_Generator): selective search (default),
+* multi-scale sliding windows or sliding windows ranked by edge density, trading recall for speed.
+* 
+* Non-maxima suppression keeps the boxes with the highest SVM score; with option -soft_nms_sigma, overlapping boxes
+* have their score decayed instead of being suppressed (soft-NMS).
+* 
+* With option -cascade, a rejection cascade calibrated by the training program (see Proposal_Cascade) discards flat
+* regions (sky, water, quay) using constant-time features from integral images before any SIFT is computed, and
+* optionally discards the descriptors scored low by a linear SVM before the RBF SVM.
+* 
+* With -mode=video, the first argument is a video file (or an image sequence, e.g. frames/%04d.png) and the second one
+* the threshold for non-maxima suppression. Frames are processed in order, reusing the proposals and the detections of
+* the previous frame in the areas that did not change (see runVideo).
 */
 int main(int argc, char** argv) {
 
-	if (argc < 4) {
+	const cv::String keys =
+		"{help h usage ?    |       | print this message }"
+		"{@test_path        |       | path to the directory containing the test images }"
+		"{@annotations_path |       | path to the directory containing the annotation files }"
+		"{@nms_threshold    |       | threshold for non-maxima suppression (e.g. 0.5) }"
+		"{bow_mode          | patch | how BOW descriptors are computed: patch (SIFT on each proposal), image (SIFT once per image) or integral (SIFT once per image, summed-area tables) }"
+		"{classifier        | rbf   | classifier trained by the training program: rbf (svm.yml) or linear (svm_linear.yml, explicit feature map + linear SVM) }"
+		"{vocabulary        | ../vocabulary.yml | vocabulary of visual words written by the training program }"
+		"{svm               |       | trained SVM (default: ../svm.yml for rbf, ../svm_linear.yml for linear) }"
+		"{model             |       | binary model bundle written by the training program (e.g. ../model.bin), replaces vocabulary and svm }"
+		"{threads           | 0     | number of workers classifying proposals in parallel (0: number of CPUs) }"
+		"{queue_depth       | 2     | maximum number of images waiting between two stages of the pipeline }"
+		"{proposal_threads  | 1     | number of threads computing proposals }"
+		"{headless          |       | do not show results in a window, write detections instead }"
+		"{output            |       | file detections are written to (- for standard output, the default in headless mode) }"
+		"{format            | jsonl | format of the written detections: jsonl or csv }"
+		"{render_dir        |       | directory annotated images are written to }"
+		"{soft_nms_sigma    | 0     | if greater than 0, apply soft-NMS with this Gaussian decay instead of suppressing overlapping boxes }"
+		"{soft_nms_min_score | 0.1  | minimum SVM score of the boxes kept by soft-NMS }"
+		"{cascade           |       | rejection cascade file written by the training program (e.g. ../cascade.yml) }"
+		"{proposals         | selective | proposal backend: selective (selective search), sliding (multi-scale sliding window) or edges (sliding windows ranked by edge density) }"
+		"{proposal_cache    |       | directory of the cache of proposals }"
+		"{proposal_max_side | 0     | maximum length of the longest side of the image analyzed by selective or edges (0: full resolution) }"
+		"{proposal_scale    | 1     | scale factor applied to the image analyzed by selective or edges }"
+		"{mode              | detect | detect: detect boats, evaluate: detect boats and report accuracy and timings, proposal_benchmark: measure latency and recall of the proposals, video: detect boats in a video }"
+		"{video_refresh     | 10    | in video mode, frames are fully processed every video_refresh frames }"
+		"{video_diff_threshold | 15 | in video mode, minimum intensity difference for a pixel to be considered changed }"
+		"{eval_ious         | 0.3,0.5,0.7 | IoU thresholds the average precision is computed at by evaluate }"
+		"{report            |       | file the evaluation report is written to (default: standard output) }"
+		"{pr_curve          |       | file the precision-recall curves are written to by evaluate (CSV) }"
+		"{trace             |       | Chrome trace file written at the end of the run (builds with BOAT_DETECTOR_TRACE only) }"
+		"{benchmark_sides   | 0,1200,1000,800,600,400 | values of proposal_max_side compared by proposal_benchmark }"
+		"{benchmark_iou     | 0.5   | minimum IoU for a ground truth box to be recalled by proposal_benchmark }";
+
+	cv::CommandLineParser parser(argc, argv, keys);
+
+	cv::String MODE = parser.get<cv::String>("mode");
+
+	if (MODE != "detect" && MODE != "evaluate" && MODE != "proposal_benchmark" && MODE != "video") {
+		std::cout << "Unknown mode " << MODE << ". Use detect, evaluate, proposal_benchmark or video." << std::endl;
+		return -1;
+	}
+
+	if (parser.has("help") || !parser.has(MODE == "detect" || MODE == "evaluate" ? "@nms_threshold" : "@annotations_path")) {
 		std::cout << "Missing arguments. Provide the path to the test images, the corresponding annotations ";
 		std::cout << "and the threshold for non-maxima suppression." << std::endl;
+		std::cout << "In video mode, provide the path to the video (or image sequence) and the threshold for non-maxima suppression." << std::endl;
+		parser.printMessage();
+		return -1;
+	}
+
+	cv::String TEST_PATH = parser.get<cv::String>("@test_path");
+	cv::String ANNOTATIONS_PATH = parser.get<cv::String>("@annotations_path");
+	float NMS_THRESHOLD = MODE == "detect" || MODE == "evaluate" ? parser.get<float>("@nms_threshold") : 0.0f;
+
+	// videos have no annotations: the threshold is the second positional argument
+	if (MODE == "video") {
+		NMS_THRESHOLD = parser.get<float>(1);
+	}
+
+	cv::String BOW_MODE = parser.get<cv::String>("bow_mode");
+	cv::String CLASSIFIER = parser.get<cv::String>("classifier");
+	cv::String VOCABULARY = parser.get<cv::String>("vocabulary");
+	cv::String SVM = parser.get<cv::String>("svm");
+	cv::String MODEL = parser.get<cv::String>("model");
+	int THREADS = parser.get<int>("threads");
+	int QUEUE_DEPTH = std::max(parser.get<int>("queue_depth"), 1);
+	int PROPOSAL_THREADS = std::max(parser.get<int>("proposal_threads"), 1);
+	// evaluation runs unattended
+	bool HEADLESS = parser.has("headless") || MODE == "evaluate";
+	cv::String OUTPUT = parser.get<cv::String>("output");
+	cv::String FORMAT = parser.get<cv::String>("format");
+	cv::String RENDER_DIR = parser.get<cv::String>("render_dir");
+	float SOFT_NMS_SIGMA = parser.get<float>("soft_nms_sigma");
+	float SOFT_NMS_MIN_SCORE = parser.get<float>("soft_nms_min_score");
+	cv::String PROPOSALS = parser.get<cv::String>("proposals");
+	cv::String CASCADE = parser.get<cv::String>("cascade");
+	cv::String PROPOSAL_CACHE = parser.get<cv::String>("proposal_cache");
+	int PROPOSAL_MAX_SIDE = parser.get<int>("proposal_max_side");
+	double PROPOSAL_SCALE = parser.get<double>("proposal_scale");
+	cv::String BENCHMARK_SIDES = parser.get<cv::String>("benchmark_sides");
+	float BENCHMARK_IOU = parser.get<float>("benchmark_iou");
+	int VIDEO_REFRESH = parser.get<int>("video_refresh");
+	int VIDEO_DIFF_THRESHOLD = parser.get<int>("video_diff_threshold");
+	cv::String EVAL_IOUS = parser.get<cv::String>("eval_ious");
+	cv::String REPORT = parser.get<cv::String>("report");
+	cv::String PR_CURVE = parser.get<cv::String>("pr_curve");
+	cv::String TRACE = parser.get<cv::String>("trace");
+
+	// in evaluate mode the report goes to the standard output, detections are written only if requested
+	if (HEADLESS && OUTPUT.empty() && MODE != "evaluate") {
+		OUTPUT = "-";
+	}
+
+	// when detections or the evaluation report are written to the standard output, messages go to the standard error
+	std::ostream& info = OUTPUT == "-" || (MODE == "evaluate" && REPORT.empty()) ? std::cerr : std::cout;
+
+	Proposal_Classifier::BOW_Mode bow_mode;
+
+	if (!Proposal_Classifier::parseMode(BOW_MODE, bow_mode)) {
+		info << "Unknown BOW mode " << BOW_MODE << ". Use patch, image or integral." << std::endl;
 		return -1;
 	}
 
-	cv::String TEST_PATH = argv[1];
-	cv::String ANNOTATIONS_PATH = argv[2];
-	float NMS_THRESHOLD = std::stof(argv[3]);
+	if (CLASSIFIER != "rbf" && CLASSIFIER != "linear") {
+		info << "Unknown classifier " << CLASSIFIER << ". Use rbf or linear." << std::endl;
+		return -1;
+	}
 
-	// load test images
+	if (Proposal_Generator::create(PROPOSALS, 1).empty()) {
+		info << "Unknown proposal backend " << PROPOSALS << ". Use selective, sliding or edges." << std::endl;
+		return -1;
+	}
+
+	Detection_Writer::Format format;
+
+	if (!Detection_Writer::parseFormat(FORMAT, format)) {
+		info << "Unknown output format " << FORMAT << ". Use jsonl or csv." << std::endl;
+		return -1;
+	}
+
+	std::ofstream output_file;
+
+	if (!OUTPUT.empty() && OUTPUT != "-") {
+
+		output_file.open(OUTPUT);
+
+		if (!output_file.is_open()) {
+			info << "Error occurred while opening output file " << OUTPUT << "." << std::endl;
+			return -1;
+		}
+	}
+
+	if (!RENDER_DIR.empty() && !cv::utils::fs::createDirectories(RENDER_DIR)) {
+		info << "Error occurred while creating directory " << RENDER_DIR << "." << std::endl;
+		return -1;
+	}
+
+	if (THREADS <= 0) {
+		THREADS = cv::getNumberOfCPUs();
+	}
+
+	if (!TRACE.empty() && !TRACE_ENABLED) {
+		info << "Tracing is not compiled in, build with -DBOAT_DETECTOR_TRACE=ON to write " << TRACE << "." << std::endl;
+	}
+
+	// scoped timers and counters of the hot paths, summarized at the end of the run
+	TRACE_START(TRACE);
+
+	cv::setNumThreads(THREADS);
+
+	// evaluation of the detections, with the timings of the stages of the pipeline
+	cv::Ptr<Detection_Evaluator> evaluator;
+
+	if (MODE == "evaluate") {
+
+		std::vector<float> ious;
+		std::stringstream values(EVAL_IOUS);
+		std::string value;
+
+		while (std::getline(values, value, ',')) {
+
+			ious.push_back((float)std::atof(value.c_str()));
+		}
+
+		std::vector<cv::String> stages = { "decode", "proposals", "cascade", "patches", "describe + classify", "nms" };
+		evaluator = cv::makePtr<Detection_Evaluator>(ious, stages);
+	}
+
+	// find test images (they are read one at a time by the pipeline)
 
 	std::vector<cv::String> pattern = { "*.png", "*.jpg"};
 	
 	std::vector<cv::String> test_files;
-	std::vector<cv::Mat> test_images;
+	std::vector<cv::String> annot_files;
 
-	if (Detector_Utils::loadFiles(TEST_PATH, pattern, test_files)) {
+	if (MODE != "video") {
+
+		if (Detector_Utils::loadFiles(TEST_PATH, pattern, test_files)) {
 	
-		std::cout << "Error occurred while loading test images." << std::endl;
-		return -1;
+			info << "Error occurred while loading test images." << std::endl;
+			return -1;
+		}
+
+		info << test_files.size() << " test images found." << std::endl;
+
+		// load annotation files
+
+		pattern = { "*.txt" };
+
+		if (Detector_Utils::loadFiles(ANNOTATIONS_PATH, pattern, annot_files) || annot_files.size() < test_files.size()) {
+
+			info << "Error occurred while loading annotations files for test images." << std::endl;
+			return -1;
+		}
 	}
 
-	for (const auto& t : test_files) {
+	// maximum number of proposals per image
+	const int MAX_PROPOSALS = 2000;
+
+	if (MODE == "proposal_benchmark") {
 
-		cv::Mat im = cv::imread(t);
-		test_images.push_back(im);
+		std::vector<int> max_sides;
+		std::stringstream sides(BENCHMARK_SIDES);
+		std::string side;
+
+		while (std::getline(sides, side, ',')) {
+
+			max_sides.push_back(std::atoi(side.c_str()));
+		}
+
+		runProposalBenchmark(test_files, annot_files, PROPOSALS, max_sides, MAX_PROPOSALS, BENCHMARK_IOU, info);
+		return 0;
 	}
 
-	std::cout << "Test images successfully loaded." << std::endl;
+	cv::Mat vocabulary;
+	Batch_SVM svm;
+	cv::TickMeter load_timer;
+	load_timer.start();
 
-	// load annotation files
+	if (!MODEL.empty()) {
 
-	std::vector<cv::String> annot_files;
-	pattern = { "*.txt" };
+		// vocabulary and svm from a single binary bundle, read through a memory mapping
+		Model_Bundle bundle;
+
+		if (!bundle.load(MODEL)) {
+
+			info << "Error occurred while loading the model bundle " << MODEL << "." << std::endl;
+			return -1;
+		}
+
+		if (!bundle.matchesPreprocessing()) {
+
+			info << "The model bundle " << MODEL << " was trained with different preprocessing settings." << std::endl;
+			return -1;
+		}
+
+		vocabulary = bundle.getVocabulary();
+		svm = bundle.getSVM();
+	}
+	else {
+
+		// load vocabulary of visual words
+		cv::FileStorage fs(VOCABULARY, cv::FileStorage::READ);
+
+		if (fs.isOpened()) {
+
+			fs["vocabulary"] >> vocabulary;
+		}
+
+		fs.release();
+
+		if (vocabulary.empty()) {
+
+			info << "Error occurred while loading the vocabulary " << VOCABULARY << "." << std::endl;
+			return -1;
+		}
 
-	if (Detector_Utils::loadFiles(ANNOTATIONS_PATH, pattern, annot_files)) {
+		// load the trained svm, used to classify all the proposals of an image at once
+		// the linear model was trained on descriptors transformed with an explicit feature map, which is applied by Batch_SVM
+		if (SVM.empty()) {
 
-		std::cout << "Error occurred while loading annotations files for test images." << std::endl;
+			SVM = CLASSIFIER == "rbf" ? "../svm.yml" : "../svm_linear.yml";
+		}
+
+		if (!svm.load(SVM)) {
+
+			info << "Error occurred while loading the trained SVM " << SVM << "." << std::endl;
+			return -1;
+		}
+	}
+
+	load_timer.stop();
+	info << "Model loaded in " << load_timer.getTimeMilli() << " ms" << std::endl;
+
+	info << "Classifier: " << (MODEL.empty() ? CLASSIFIER : MODEL) << " (feature map: " << Feature_Map::getName(svm.getFeatureMap()) << ", ";
+	info << svm.getSupportVectorCount() << " support vectors)" << std::endl;
+
+	// create the classifier of proposed regions: bag of words descriptors (exact nearest codeword search, vectorized
+	// when the CPU allows it) computed in parallel by THREADS workers, each one with its own SIFT detector and extractor
+	Proposal_Classifier classifier(vocabulary, svm, bow_mode, THREADS);
+
+	info << "Codeword assignment kernel: " << classifier.getExtractor().getKernelName() << ", ";
+	info << THREADS << " workers" << std::endl;
+
+	// rejection cascade run before the classifier, if any
+	cv::Ptr<Proposal_Cascade> cascade;
+
+	if (!CASCADE.empty()) {
+
+		cascade = cv::makePtr<Proposal_Cascade>();
+
+		if (!cascade->load(CASCADE)) {
+
+			info << "Error occurred while loading the rejection cascade." << std::endl;
+			return -1;
+		}
+
+		info << "Rejection cascade: integral image features" << (cascade->hasLinearStage() ? " + linear SVM" : "") << std::endl;
+	}
+
+	// proposal engine
+	cv::Ptr<Proposal_Generator> generator = Proposal_Generator::create(PROPOSALS, MAX_PROPOSALS, PROPOSAL_MAX_SIDE, PROPOSAL_SCALE);
+
+	// frames of a video are read from a video file or an image sequence
+	cv::VideoCapture capture;
+
+	if (MODE == "video" && !capture.open(TEST_PATH)) {
+
+		info << "Error occurred while opening video " << TEST_PATH << "." << std::endl;
 		return -1;
 	}
 
-	// compute ground truth for test images
+	// detections are written to a file or to the standard output, if requested
+	cv::Ptr<Detection_Writer> writer;
 
-	std::vector<std::vector<cv::Rect>> ground_truth(test_images.size());
+	if (!OUTPUT.empty()) {
 
-	for (int i = 0; i < test_images.size(); i++) {
-	
-		ground_truth[i] = Detector_Utils::getGroundTruth(annot_files[i]);
-	}	
+		writer = cv::makePtr<Detection_Writer>(OUTPUT == "-" ? std::cout : output_file, format);
+	}
 
-	// load vocabulary of visual words
-	cv::Mat vocabulary;
+	// annotated images are written by their own thread, so that encoding does not slow down the output stage
+	Bounded_Queue<std::pair<cv::String, cv::Mat>> rendered(QUEUE_DEPTH);
+	std::thread render_thread;
+
+	if (!RENDER_DIR.empty()) {
 
-	cv::FileStorage fs("../vocabulary.yml", cv::FileStorage::READ);
-	fs["vocabulary"] >> vocabulary;
-	fs.release();
+		render_thread = std::thread([&rendered]() {
 
-	// load the trained svm
-	cv::Ptr<cv::ml::SVM> svm = cv::ml::SVM::create();
-	svm = cv::ml::SVM::load("../svm.yml");
+			std::pair<cv::String, cv::Mat> item;
 
-	cv::Ptr<cv::SIFT> detector = cv::SIFT::create();
+			while (rendered.pop(item)) {
 
-	// create a nearest neighbor matcher
-	cv::Ptr<cv::DescriptorMatcher> matcher(new cv::FlannBasedMatcher);
+				cv::imwrite(item.first, item.second);
+			}
+		});
+	}
 
-	// create a SIFT descriptor extractor
-	cv::Ptr<cv::DescriptorExtractor> extractor(new cv::SiftDescriptorExtractor);
+	if (MODE == "video") {
 
-	// create bag of words descriptor extractor
-	cv::BOWImgDescriptorExtractor BOWImgDescriptor(extractor, matcher);
+		runVideo(capture, *generator, cascade, classifier, NMS_THRESHOLD, SOFT_NMS_SIGMA, SOFT_NMS_MIN_SCORE, VIDEO_REFRESH,
+				VIDEO_DIFF_THRESHOLD, writer, RENDER_DIR.empty() ? 0 : &rendered, RENDER_DIR, HEADLESS, info);
 
-	// set vocabulary obtained with training
-	BOWImgDescriptor.setVocabulary(vocabulary);
+		rendered.close();
 
-	std::vector<cv::KeyPoint> keypoints;
-	cv::Mat descriptors;
-	cv::Mat bow_descriptors;
+		if (render_thread.joinable()) {
 
-	std::vector<cv::Rect> proposals;
-	std::vector<cv::Mat> patches;
-	std::vector<cv::Rect> pred_boxes;
-	std::vector<cv::Rect> final_boxes;
+			render_thread.join();
+		}
 
-	cv::Mat outImage;
+		TRACE_FINISH(info);
+		return 0;
+	}
 
 	// for each test image, run selective search to get proposed regions, process such patches as we processed
-	// the patches used for training, compute bag of words descriptors and classify patches using the trained SVM
+	// the patches used for training, compute bag of words descriptors and classify patches using the trained SVM.
+	// each step is a stage of a pipeline, stages are connected by bounded queues
 
-	for (int i = 0; i < test_images.size(); i++) {
+	Frame_Queue decoded(QUEUE_DEPTH);
+	Frame_Queue proposed(QUEUE_DEPTH);
+	Frame_Queue filtered(QUEUE_DEPTH);
+	Frame_Queue extracted(QUEUE_DEPTH);
+	Frame_Queue classified(QUEUE_DEPTH);
+	Frame_Queue done(QUEUE_DEPTH);
 
-		std::cout << "Processing image " << test_files[i] << std::endl;
+	std::vector<std::thread> threads;
+	cv::TickMeter wall_timer;
+	wall_timer.start();
 
-		// create Selective Search Segmentation object 
-		cv::Ptr<cv::ximgproc::segmentation::SelectiveSearchSegmentation> selectiveSearch;
-		selectiveSearch = cv::ximgproc::segmentation::createSelectiveSearchSegmentation();
+	// decode: read test images and their ground truth
+	threads.emplace_back([&]() {
 
-		// get regions to examine
-		proposals = Detector_Utils::getProposals(test_images[i], selectiveSearch, 2000);
-		
-		std::cout << "Proposals successfully computed." << std::endl;
+		for (int i = 0; i < test_files.size(); i++) {
 
-		// extract patches from test image
-		Detector_Utils::getPatches(proposals, test_images[i], patches);
+			cv::TickMeter timer;
+			timer.start();
 
-		// process patches 
-		Detector_Utils::processPatches(patches);
+			cv::Ptr<Frame> frame = cv::makePtr<Frame>();
+			frame->index = i;
+			frame->filename = test_files[i];
+			frame->name = test_files[i].substr(test_files[i].find_last_of("/\\") + 1);
 
-		std::cout << "Classifying proposals..." << std::endl;
+			{
+				TRACE_SCOPE("decode");
+				frame->image = cv::imread(test_files[i]);
+				frame->ground_truth = Detector_Utils::getGroundTruth(annot_files[i]);
+			}
 
-		outImage = test_images[i].clone();
-		pred_boxes.clear();
-		// for each patch extract bag of words descriptors and classify using svm
-		for (int j = 0; j < patches.size(); j++) {
+			timer.stop();
+			frame->stage_ms.push_back(timer.getTimeMilli());
 
-			// detect SIFT keypoints and compute descriptors
-			detector->detectAndCompute(patches[j], cv::Mat(), keypoints, descriptors);
+			if (!decoded.push(frame)) {
 
-			if (!descriptors.empty()) {
+				break;
+			}
+		}
 
-				// compute bag of words descriptor for the patch
-				BOWImgDescriptor.compute(descriptors, bow_descriptors);
+		decoded.close();
+	});
 
-				// classify patch
-				float response = svm->predict(bow_descriptors);
+	// proposals computed on previous runs are read from the cache, if any
+	cv::Ptr<Proposal_Cache> proposal_cache;
 
-				// if patch is classified as boat:
-				if (response == 1) {
+	if (!PROPOSAL_CACHE.empty()) {
 
-					// j-th patch is obtained from j-th proposed region
-					pred_boxes.push_back(proposals[j]);
-				}
-			}
+		proposal_cache = cv::makePtr<Proposal_Cache>(PROPOSAL_CACHE);
+	}
+
+	// the proposal engine is shared by the proposal threads
+	cv::String proposals_key = generator->getKey();
+
+	// proposals: get regions to examine
+	startStage(threads, PROPOSAL_THREADS, decoded, proposed, [&](Frame& frame) {
+
+		// the image is hashed once, for the lookup and (on a miss) for the new entry
+		uint64_t image_hash = proposal_cache ? Proposal_Cache::hashImage(frame.image) : 0;
+
+		if (proposal_cache && proposal_cache->load(image_hash, proposals_key, frame.proposals)) {
+
+			frame.proposals_cached = true;
+			return;
 		}
 
-		std::cout << "Non-maxima suppression..." << std::endl;
-		std::cout << std::endl;
+		generator->generate(frame.image, frame.proposals);
+		TRACE_COUNT("proposals_generated", (int64_t)frame.proposals.size());
 
-		Detector_Utils::nonMaximaSuppression(pred_boxes, final_boxes, NMS_THRESHOLD);
+		if (proposal_cache) {
 
-		// displaying result 
-		std::cout << "Intersection over union:" << std::endl;
-		outImage = test_images[i].clone();
+			proposal_cache->store(image_hash, proposals_key, frame.proposals);
+		}
+	});
 
-		if (!final_boxes.empty()) {
-		
-			// for each ground truth box, we show in green the bounding box giving the highest response
-			for (int j = 0; j < ground_truth[i].size(); j++) {
+	// extract patches from test image and process them (only needed when descriptors are computed on patches)
+	// rejection cascade: discard flat regions before computing any descriptor
+	startStage(threads, 1, proposed, filtered, [&cascade](Frame& frame) {
 
-				float max_iou; int max_i;
-				Detector_Utils::getMaxResponseIOU(final_boxes, ground_truth[i][j], max_iou, max_i);
+		frame.n_proposals = (int)frame.proposals.size();
+		cv::cvtColor(frame.image, frame.gray, cv::COLOR_BGR2GRAY);
 
-				if (max_iou > 0.0f) {
-					
-					// show in green color the box which has maximum IOU for this ground truth box
-					rectangle(outImage, final_boxes[max_i], cv::Scalar(50, 205, 50), 2);
+		if (cascade) {
 
-					// write above the box the corresponding IOU
-					float offset_x = final_boxes[max_i].x;
-					float offset_y = final_boxes[max_i].y - 7;
+			cv::Mat processed;
+			Detector_Utils::processImage(frame.gray, processed);
+			cascade->filterProposals(processed, frame.proposals);
+		}
+	});
 
-					if (offset_y < 0) {
-						offset_y = final_boxes[max_i].y + 21;
-					}
+	startStage(threads, 1, filtered, extracted, [&classifier](Frame& frame) {
+
+		if (classifier.usesPatches()) {
 
-					cv::putText(outImage, std::to_string(max_iou), cv::Point(offset_x, offset_y),
-						cv::FONT_HERSHEY_SIMPLEX, 0.7, cv::Scalar(50, 205, 50), 2);
+			Detector_Utils::processPatches(frame.gray, frame.proposals, frame.patches);
+		}
+	});
 
-					std::cout << max_iou << std::endl;
+	// extract bag of words descriptors for each proposal and classify them using svm
+	// (the descriptors rejected by the linear stage of the cascade are not classified)
+	startStage(threads, 1, extracted, classified, [&classifier, &cascade](Frame& frame) {
 
-					// erase the box we already shown 
-					final_boxes.erase(final_boxes.begin() + max_i);
-				
-				}
+		cv::Mat samples;
+		std::vector<int> sample_proposals;
+
+		classifier.describe(frame.gray, frame.proposals, frame.patches, samples, sample_proposals);
+
+		if (cascade) {
+
+			cascade->filterSamples(samples, sample_proposals);
+		}
+
+		frame.n_classified = samples.rows;
+		classifier.classify(samples, sample_proposals, frame.proposals, frame.pred_boxes, frame.pred_scores);
+
+		frame.patches.clear();
+		frame.gray.release();
+	});
+
+	// non-maxima suppression, boxes with higher SVM score first
+	startStage(threads, 1, classified, done, [&](Frame& frame) {
+
+		std::vector<int> kept_idxs;
+		Detector_Utils::nonMaximaSuppression(frame.pred_boxes, frame.pred_scores, kept_idxs, frame.final_scores, NMS_THRESHOLD,
+											SOFT_NMS_SIGMA, SOFT_NMS_MIN_SCORE);
+
+		frame.final_boxes.clear();
+
+		for (int j = 0; j < kept_idxs.size(); j++) {
+
+			frame.final_boxes.push_back(frame.pred_boxes[kept_idxs[j]]);
+		}
+
+		TRACE_COUNT("positives_after_nms", (int64_t)frame.final_boxes.size());
+		matchGroundTruth(frame);
+	});
+
+	// output: write and show results in the order of the test images (with several selective search threads, frames may
+	// complete out of order)
+	std::map<int, cv::Ptr<Frame>> pending;
+	int next = 0;
+	cv::Ptr<Frame> frame;
+	size_t total_proposals = 0, total_filtered = 0, total_classified = 0;
+
+	while (done.pop(frame)) {
+
+		pending[frame->index] = frame;
+
+		while (pending.count(next)) {
+
+			Frame& current = *pending[next];
+
+			info << "Processed image " << current.filename << ": " << current.n_proposals << " proposals";
+			info << (current.proposals_cached ? " (cached), " : ", ");
+
+			if (cascade) {
+
+				info << current.proposals.size() << " after cascade, " << current.n_classified << " fed to the SVM, ";
 			}
 
-			// the remaining boxes are shown in red color
-			for (int j = 0; j < final_boxes.size(); j++) {
+			total_proposals += current.n_proposals;
+			total_filtered += current.proposals.size();
+			total_classified += current.n_classified;
+
+			info << current.pred_boxes.size() << " boxes classified as boats, ";
+			info << current.final_boxes.size() << " after non-maxima suppression." << std::endl;
+			info << std::endl;
+
+			if (writer) {
+
+				writer->write(current.name, current.final_boxes, current.final_scores, current.final_ious);
+			}
+
+			if (evaluator) {
 
-				rectangle(outImage, final_boxes[j], cv::Scalar(0, 0, 255), 1);
+				evaluator->add(current.name, current.final_boxes, current.final_scores, current.ground_truth, current.stage_ms);
 			}
-			
+
+			if (!RENDER_DIR.empty()) {
+
+				rendered.push(std::make_pair(RENDER_DIR + "/" + current.name, renderResult(current)));
+			}
+
+			if (!HEADLESS) {
+
+				showResult(current);
+			}
+
+			pending.erase(next);
+			next++;
+		}
+	}
+
+	for (int t = 0; t < threads.size(); t++) {
+
+		threads[t].join();
+	}
+
+	rendered.close();
+
+	if (render_thread.joinable()) {
+
+		render_thread.join();
+	}
+
+	if (cascade && total_proposals > 0) {
+
+		info << "Rejection cascade: " << 100.0 * total_filtered / total_proposals << "% of the proposals passed the first stage, ";
+		info << 100.0 * total_classified / total_proposals << "% reached the final SVM." << std::endl;
+	}
+
+	if (evaluator) {
+
+		std::ofstream report_file;
+
+		if (!REPORT.empty()) {
+
+			report_file.open(REPORT);
 		}
 
-		//show output
-		cv::resize(outImage, outImage, cv::Size(1000, 600));
-		cv::imshow("Test image", outImage);
-		cv::waitKey(0);
+		wall_timer.stop();
+		evaluator->report(REPORT.empty() ? std::cout : report_file, wall_timer.getTimeMilli());
 
-		std::cout << std::endl;
+		if (!PR_CURVE.empty()) {
+
+			std::ofstream curve_file(PR_CURVE);
+			evaluator->writeCurves(curve_file);
+		}
 	}
+
+	TRACE_FINISH(info);
 }
\ No newline at end of file